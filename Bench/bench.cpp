@@ -0,0 +1,490 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "batch.h"
+#include "gameboy.h"
+#include "runner.h"
+
+// usage: GB_Bench [--json F] [--rom F] [--frames N] [--filter S]
+// every result is the best of a few repeats, lower ns per op is better
+
+#ifndef GB_BENCH_ROM
+#define GB_BENCH_ROM "Tests/Tetris.gb"
+#endif
+
+using clock_type = std::chrono::steady_clock;
+
+
+struct Result
+{
+    std::string name;
+    uint64_t ops = 0;
+    double seconds = 0;
+    std::vector<std::pair<std::string, double>> extra;
+
+    double nsPerOp() const { return ops ? seconds * 1e9 / ops : 0; }
+};
+
+static std::vector<Result> results;
+static std::string filter;
+
+static bool wanted(const std::string& name)
+{
+    return filter.empty() || name.find(filter) != std::string::npos;
+}
+
+static void report(const Result& r)
+{
+    std::printf("%-28s %10.2f ns/op", r.name.c_str(), r.nsPerOp());
+    for (const auto& e : r.extra)
+        std::printf("  %s %.2f", e.first.c_str(), e.second);
+    std::printf("\n");
+    results.push_back(r);
+}
+
+// runs body(ops) with ops growing until one run takes a while, then keeps the best of 5
+template<typename F>
+static void measure(const std::string& name, F body)
+{
+    if (!wanted(name)) return;
+
+    uint64_t ops = 1024;
+    double best = 0;
+    while (true)
+    {
+        auto start = clock_type::now();
+        body(ops);
+        best = std::chrono::duration<double>(clock_type::now() - start).count();
+        if (best > 0.05) break;
+        ops *= 4;
+    }
+    for (int rep = 0; rep < 4; ++rep)
+    {
+        auto start = clock_type::now();
+        body(ops);
+        best = std::min(best, std::chrono::duration<double>(clock_type::now() - start).count());
+    }
+
+    Result r;
+    r.name = name;
+    r.ops = ops;
+    r.seconds = best;
+    report(r);
+}
+
+// stops the compiler throwing the work away
+static volatile uint64_t sink;
+
+
+// reaches the private parts of the core
+struct Bench
+{
+    // a loop in work ram with no cartridge, no lcd and no events, so only the cpu runs
+    static void loadLoop(GameBoy& gb)
+    {
+        static const uint8_t program[] = {
+            0x3E, 0x12,       // ld a, 0x12
+            0x80,             // loop: add a, b
+            0x98,             // sbc a, b
+            0xA1,             // and c
+            0xB2,             // or d
+            0xAB,             // xor e
+            0x04,             // inc b
+            0x0D,             // dec c
+            0x78,             // ld a, b
+            0x47,             // ld b, a
+            0x21, 0x00, 0xC1, // ld hl, 0xC100
+            0x77,             // ld (hl), a
+            0x7E,             // ld a, (hl)
+            0x23,             // inc hl
+            0xCB, 0x37,       // swap a
+            0xFE, 0x10,       // cp 0x10
+            0x20, 0x02,       // jr nz, +2
+            0x3C,             // inc a
+            0x00,             // nop
+            0x18, 0xE6,       // jr loop
+        };
+        gb.initMemory();
+        std::copy(std::begin(program), std::end(program), gb.memory + 0xC000);
+        gb.regs = {};
+        gb.setFlags(0);
+        gb.regs.PC = 0xC000;
+        gb.regs.SP = 0xDFFE;
+    }
+
+    static void dispatch()
+    {
+        auto gb = std::make_unique<GameBoy>();
+        loadLoop(*gb);
+        measure("dispatch.emulateCycle", [&](uint64_t ops) {
+            for (uint64_t i = 0; i < ops; ++i) gb->emulateCycle();
+        });
+
+        // the same loop through runUntil, which is what frames use
+        // instructions are worked out from cycles, the loop costs the same every time round
+        loadLoop(*gb);
+        gb->emulateCycle();
+        uint16_t loop = gb->regs.PC;
+        uint64_t loopStart = gb->sched.cycles;
+        uint64_t loopInstructions = 0;
+        do
+        {
+            gb->emulateCycle();
+            loopInstructions++;
+        } while (gb->regs.PC != loop);
+        uint64_t loopCycles = gb->sched.cycles - loopStart;
+
+        const char* names[] = { "dispatch.interpreter", "dispatch.blocks", "dispatch.jit" };
+        for (int mode = 0; mode < 3; ++mode)
+        {
+            if (!wanted(names[mode])) continue;
+            loadLoop(*gb);
+            gb->setBlockCache(mode > 0);
+            if (mode == 2 && !gb->setJit(true)) continue;
+
+            measure(names[mode], [&](uint64_t ops) {
+                uint64_t rounds = (ops + loopInstructions - 1) / loopInstructions;
+                gb->runUntil(gb->sched.cycles + rounds * loopCycles);
+            });
+            results.back().ops = (results.back().ops + loopInstructions - 1) / loopInstructions * loopInstructions;
+        }
+    }
+
+    // 4096 addresses spread over one region so the branch predictor cant learn the pattern
+    static std::vector<uint16_t> addresses(uint16_t base, uint16_t size)
+    {
+        std::vector<uint16_t> out(4096);
+        uint32_t x = 12345;
+        for (uint16_t& a : out)
+        {
+            x = x * 1103515245 + 12345;
+            a = base + (x >> 16) % size;
+        }
+        return out;
+    }
+
+    static void memory()
+    {
+        auto gb = std::make_unique<GameBoy>();
+        gb->initMemory();
+        gb->postBootSetup();
+
+        struct Region { const char* name; uint16_t base; uint16_t size; };
+        static const Region reads[] = {
+            { "read8.rom", 0x0000, 0x8000 },
+            { "read8.wram", 0xC000, 0x2000 },
+            { "read8.hram", 0xFF80, 0x7F },
+        };
+        static const Region writes[] = {
+            { "write8.wram", 0xC000, 0x2000 },
+            { "write8.vram.tiles", 0x8000, 0x1800 },
+            { "write8.hram", 0xFF80, 0x7F },
+        };
+
+        for (const Region& r : reads)
+        {
+            std::vector<uint16_t> addr = addresses(r.base, r.size);
+            measure(r.name, [&](uint64_t ops) {
+                uint64_t sum = 0;
+                for (uint64_t i = 0; i < ops; ++i) sum += gb->read8(addr[i & 4095]);
+                sink = sum;
+            });
+        }
+        for (const Region& r : writes)
+        {
+            std::vector<uint16_t> addr = addresses(r.base, r.size);
+            measure(r.name, [&](uint64_t ops) {
+                for (uint64_t i = 0; i < ops; ++i) gb->write8(addr[i & 4095], uint8_t(i));
+            });
+        }
+    }
+
+    static void alu()
+    {
+        auto gb = std::make_unique<GameBoy>();
+        gb->initMemory();
+
+#define GB_BENCH_ALU(name, expr) \
+        measure("alu." name, [&](uint64_t ops) { \
+            uint8_t x = 0x3C; \
+            for (uint64_t i = 0; i < ops; ++i) { uint8_t y = uint8_t(i); (void)y; x = expr; } \
+            sink = x; \
+        });
+
+        GB_BENCH_ALU("add8", gb->add8(x, y))
+        GB_BENCH_ALU("adc8", gb->adc8(x, y))
+        GB_BENCH_ALU("sub8", gb->sub8(x, y))
+        GB_BENCH_ALU("sbc8", gb->sbc8(x, y))
+        GB_BENCH_ALU("and8", gb->and8(x, y))
+        GB_BENCH_ALU("xor8", gb->xor8(x, y))
+        GB_BENCH_ALU("cp8", (gb->cp8(x, y), uint8_t(x + gb->flags())))
+        GB_BENCH_ALU("inc8", gb->inc8(x))
+        GB_BENCH_ALU("dec8", gb->dec8(x))
+        GB_BENCH_ALU("rl8", gb->rl8(x))
+        GB_BENCH_ALU("swap8", gb->swap8(uint8_t(x + y)))
+        GB_BENCH_ALU("daa", (gb->regs.A = x, gb->daa(), gb->regs.A))
+#undef GB_BENCH_ALU
+    }
+};
+
+
+// fnv-1a over everything a run leaves behind, the modes have to agree
+static uint64_t stateHash(const GameBoy& gb)
+{
+    std::vector<uint8_t> state;
+    gb.saveState(state);
+    uint64_t h = 1469598103934665603ULL;
+    for (uint8_t b : state)
+    {
+        h ^= b;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// title screen, press start, then let the demo play
+static void runTetris(GameBoy& gb, uint64_t frames)
+{
+    for (uint64_t f = 0; f < frames && !gb.crashed; ++f)
+    {
+        gb.joypad = (f >= 500 && f < 510) ? BUTTON_START : 0;
+        gb.runFrame();
+    }
+}
+
+static std::unique_ptr<GameBoy> bootTetris(const std::string& rom)
+{
+    auto gb = std::make_unique<GameBoy>();
+    gb->initMemory();
+    if (!gb->loadROM(rom)) return nullptr;
+    gb->bootSetup();
+    gb->postBootSetup();
+    return gb;
+}
+
+static bool tetris(const std::string& rom, uint64_t frames)
+{
+    const char* names[] = { "tetris.interpreter", "tetris.blocks", "tetris.jit" };
+    if (!wanted(names[0]) && !wanted(names[1]) && !wanted(names[2])) return true;
+
+    // instructions per run are fixed, so count them once with an exact profile
+    auto counter = bootTetris(rom);
+    if (!counter) return false;
+    counter->startProfile(true);
+    runTetris(*counter, frames);
+    uint64_t instructions = 0;
+    for (int i = 0; i < 256; ++i)
+        instructions += counter->profiler->opcodes[i] + counter->profiler->cbOpcodes[i];
+    const uint64_t expected = stateHash(*counter);
+    const uint64_t cycles = counter->sched.cycles;
+
+    for (int mode = 0; mode < 3; ++mode)
+    {
+        if (!wanted(names[mode])) continue;
+
+        double best = 0;
+        uint64_t hash = 0;
+        for (int rep = 0; rep < 3; ++rep)
+        {
+            auto gb = bootTetris(rom);
+            gb->setBlockCache(mode > 0);
+            if (mode == 2 && !gb->setJit(true)) break;
+
+            auto start = clock_type::now();
+            runTetris(*gb, frames);
+            double seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+            best = rep ? std::min(best, seconds) : seconds;
+            hash = stateHash(*gb);
+        }
+        if (best <= 0) continue;
+
+        Result r;
+        r.name = names[mode];
+        r.ops = instructions;
+        r.seconds = best;
+        r.extra = {
+            { "fps", frames / best },
+            { "mips", instructions / best / 1e6 },
+            { "realtime", double(cycles) / CLOCK_HZ / best },
+            { "matches", hash == expected ? 1.0 : 0.0 },
+        };
+        report(r);
+        if (hash != expected) std::cerr << names[mode] << " ended in a different state than the interpreter\n";
+    }
+    return true;
+}
+
+// 16 lanes, lane frames per second against running each lane on its own. the prefix lanes share
+// the title screen and split into different inputs half way, the divergent lanes press their own
+// buttons from frame 0 on, so no console is shared and only running them in lockstep is left
+static bool batch(const std::string& rom, uint64_t frames)
+{
+    const char* names[2][2] = {
+        { "batch.prefix.separate", "batch.prefix.shared" },
+        { "batch.divergent.separate", "batch.divergent.lockstep" },
+    };
+
+    const size_t lanes = Batch::LANES;
+    auto buttonsFor = [&](int scenario, size_t lane, uint64_t f) -> uint16_t {
+        if (f >= 500 && f < 510) return BUTTON_START;
+        if (scenario == 1)
+        {
+            // right, left, a and b in a different mix on every lane, changing every 16 frames
+            const uint16_t mix = uint16_t((lane ^ (f / 16)) & 15);
+            return uint16_t((mix & 3) | (mix & 12) << 2);
+        }
+        if (scenario == 0 && f >= frames / 2 && f < frames / 2 + 30) return uint16_t(1 << (lane % 8));
+        return 0;
+    };
+
+    for (int scenario = 0; scenario < 2; ++scenario)
+    {
+        for (int mode = 0; mode < 2; ++mode)
+        {
+            if (!wanted(names[scenario][mode])) continue;
+
+            double best = 0;
+            size_t consoles = 0;
+            for (int rep = 0; rep < 3; ++rep)
+            {
+                std::vector<Batch> batches(mode ? 1 : lanes);
+                for (Batch& b : batches)
+                    if (!b.load(rom, mode ? lanes : 1, false)) return false;
+
+                std::vector<uint16_t> buttons(lanes);
+                auto start = clock_type::now();
+                for (uint64_t f = 0; f < frames; ++f)
+                {
+                    for (size_t i = 0; i < lanes; ++i) buttons[i] = buttonsFor(scenario, i, f);
+                    if (mode) batches[0].runFrame(buttons.data());
+                    else for (size_t i = 0; i < lanes; ++i) batches[i].runFrame(&buttons[i]);
+                }
+                double seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+                best = rep ? std::min(best, seconds) : seconds;
+
+                consoles = 0;
+                for (const Batch& b : batches) consoles += b.running();
+            }
+
+            Result r;
+            r.name = names[scenario][mode];
+            r.ops = frames * lanes;
+            r.seconds = best;
+            r.extra = { { "laneFps", frames * lanes / best }, { "consoles", double(consoles) } };
+            report(r);
+        }
+    }
+    return true;
+}
+
+
+// two consoles on a link cable, a thread each, against one on its own
+// with a core per console the pair should run each console close to the single speed
+static bool link(const std::string& rom, uint64_t frames)
+{
+    const char* names[] = { "link.single", "link.pair" };
+    if (!wanted(names[0]) && !wanted(names[1])) return true;
+
+    for (int mode = 0; mode < 2; ++mode)
+    {
+        if (!wanted(names[mode])) continue;
+
+        double best = 0;
+        for (int rep = 0; rep < 3; ++rep)
+        {
+            std::unique_ptr<GameBoy> a = bootTetris(rom), b = bootTetris(rom);
+            if (!a || !b) return false;
+            a->setBlockCache(true);
+            b->setBlockCache(true);
+            if (mode)
+            {
+                auto cable = LinkCable::pair();
+                a->attachLink(std::move(cable.first));
+                b->attachLink(std::move(cable.second));
+            }
+
+            auto start = clock_type::now();
+            std::thread other;
+            if (mode) other = std::thread([&] { runTetris(*b, frames); b->detachLink(); });
+            runTetris(*a, frames);
+            a->detachLink();
+            if (mode) other.join();
+            double seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+            best = rep ? std::min(best, seconds) : seconds;
+        }
+
+        Result r;
+        r.name = names[mode];
+        r.ops = frames * (mode ? 2 : 1);
+        r.seconds = best;
+        r.extra = { { "fpsEach", frames / best } };
+        report(r);
+    }
+    return true;
+}
+
+
+static bool writeJSON(const std::string& filename, const std::string& rom, uint64_t frames)
+{
+    std::ofstream out(filename);
+    if (!out)
+    {
+        std::cerr << filename << " couldnt be written!" << "\n";
+        return false;
+    }
+
+    out << "{\n  \"rom\": \"" << rom << "\",\n  \"frames\": " << frames << ",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const Result& r = results[i];
+        out << (i ? ",\n" : "\n") << "    {\"name\": \"" << r.name << "\", \"ops\": " << r.ops
+            << ", \"seconds\": " << r.seconds << ", \"nsPerOp\": " << r.nsPerOp();
+        for (const auto& e : r.extra)
+            out << ", \"" << e.first << "\": " << e.second;
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+    return bool(out);
+}
+
+int main(int argc, char* argv[])
+{
+    std::string json;
+    std::string rom = GB_BENCH_ROM;
+    uint64_t frames = 3600;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        bool ok = true;
+
+        if (arg == "--json" && hasValue) json = argv[++i];
+        else if (arg == "--rom" && hasValue) rom = argv[++i];
+        else if (arg == "--frames" && hasValue) ok = parseNumber(argv[++i], frames);
+        else if (arg == "--filter" && hasValue) filter = argv[++i];
+        else ok = false;
+
+        if (!ok)
+        {
+            std::cerr << "usage: GB_Bench [--json F] [--rom F] [--frames N] [--filter S]\n";
+            return 1;
+        }
+    }
+
+    Bench::dispatch();
+    Bench::memory();
+    Bench::alu();
+    if (!tetris(rom, frames)) return 1;
+    if (!batch(rom, frames)) return 1;
+    if (!link(rom, frames)) return 1;
+
+    if (!json.empty() && !writeJSON(json, rom, frames)) return 1;
+    return 0;
+}
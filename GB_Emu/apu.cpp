@@ -0,0 +1,344 @@
+#include "apu.h"
+#include "audio.h"
+#include "gameboy.h"
+#include "sysInfo.h"
+#include <cstring>
+
+
+// NR10 to 0xFF2F, bits that always read back as 1
+static const uint8_t readMasks[0x20] = {
+    0x80, 0x3F, 0x00, 0xFF, 0xBF, // NR10-NR14
+    0xFF, 0x3F, 0x00, 0xFF, 0xBF, // NR21-NR24
+    0x7F, 0xFF, 0x9F, 0xFF, 0xBF, // NR30-NR34
+    0xFF, 0xFF, 0x00, 0x00, 0xBF, // NR41-NR44
+    0x00, 0x00, 0x70,             // NR50-NR52
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+// bit n is duty step n: 12.5%, 25%, 50%, 75%
+static const uint8_t dutyPatterns[4] = { 0x80, 0x81, 0xE1, 0x7E };
+static const uint8_t noiseDivisors[8] = { 8, 16, 32, 48, 64, 80, 96, 112 };
+
+// each channel has 5 registers from 0xFF10, the noise channel's first one is unused
+static const uint8_t* channelRegs(const uint8_t* io, int c)
+{
+    return io + 0x10 + c * 5;
+}
+
+static uint16_t frequency(const uint8_t* r)
+{
+    return ((r[4] & 0x07) << 8) | r[3];
+}
+
+// t-cycles per waveform step
+static uint32_t period(const uint8_t* io, int c)
+{
+    const uint8_t* r = channelRegs(io, c);
+    if (c == 3) return uint32_t(noiseDivisors[r[3] & 0x07]) << (r[3] >> 4);
+    return (2048 - frequency(r)) * (c == 2 ? 2 : 4);
+}
+
+static bool dacOn(const uint8_t* io, int c)
+{
+    const uint8_t* r = channelRegs(io, c);
+    return c == 2 ? (r[0] & 0x80) : (r[2] & 0xF8);
+}
+
+
+uint8_t Apu::level(int c, const uint8_t* io) const
+{
+    const ApuChannel& k = ch[c];
+    if (!k.enabled) return 0;
+
+    const uint8_t* r = channelRegs(io, c);
+    switch (c)
+    {
+    case 2:
+    {
+        uint8_t shift = (r[2] >> 5) & 0x03; // NR32: mute, 100%, 50%, 25%
+        uint8_t pair = io[0x30 + (k.position >> 1)];
+        uint8_t sample = (k.position & 1) ? (pair & 0x0F) : (pair >> 4);
+        return shift ? sample >> (shift - 1) : 0;
+    }
+    case 3:
+        return (k.lfsr & 1) ? 0 : k.volume;
+    default:
+        return ((dutyPatterns[r[1] >> 6] >> k.position) & 1) ? k.volume : 0;
+    }
+}
+
+// NR51 picks the sides, NR50 scales each side 1-8
+void Apu::mix(int c, const uint8_t* io, AudioOut* out, uint64_t when) const
+{
+    if (!out) return;
+    int v = level(c, io);
+    int left = ((io[0x25] >> (c + 4)) & 1) ? v * (((io[0x24] >> 4) & 0x07) + 1) : 0;
+    int right = ((io[0x25] >> c) & 1) ? v * ((io[0x24] & 0x07) + 1) : 0;
+    out->set(c, left, right, when);
+}
+
+// steps every playing channel up to 'to', each level change goes out at the cycle it happened
+void Apu::run(uint64_t to, const uint8_t* io, AudioOut* out)
+{
+    for (int c = 0; c < 4; ++c)
+    {
+        ApuChannel& k = ch[c];
+        if (!k.enabled) continue;
+
+        uint64_t t = cycles;
+        while (to - t >= k.timer)
+        {
+            t += k.timer;
+            k.timer = period(io, c);
+            if (c == 3)
+            {
+                uint16_t bit = (k.lfsr ^ (k.lfsr >> 1)) & 1;
+                k.lfsr = (k.lfsr >> 1) | (bit << 14);
+                if (io[0x22] & 0x08) k.lfsr = (k.lfsr & ~0x40) | (bit << 6); // 7 bit mode
+            }
+            else
+            {
+                k.position = (k.position + 1) & (c == 2 ? 31 : 7);
+            }
+            mix(c, io, out, t);
+        }
+        k.timer -= uint32_t(to - t);
+    }
+    cycles = to;
+}
+
+uint16_t Apu::sweepNext(const uint8_t* io)
+{
+    uint16_t delta = shadowFreq >> (io[0x10] & 0x07);
+    uint16_t next = (io[0x10] & 0x08) ? shadowFreq - delta : shadowFreq + delta;
+    if (next > 2047) ch[0].enabled = false;
+    return next;
+}
+
+// 512 hz: lengths on even steps, the sweep on 2 and 6, envelopes on 7
+void Apu::clockSequencer(uint8_t* io)
+{
+    if (!(step & 1))
+    {
+        for (int c = 0; c < 4; ++c)
+        {
+            ApuChannel& k = ch[c];
+            if ((channelRegs(io, c)[4] & 0x40) && k.length && --k.length == 0) k.enabled = false;
+        }
+    }
+
+    if ((step == 2 || step == 6) && --sweepTimer == 0)
+    {
+        uint8_t pace = (io[0x10] >> 4) & 0x07;
+        sweepTimer = pace ? pace : 8;
+        if (sweepEnabled && pace)
+        {
+            uint16_t next = sweepNext(io);
+            if (next <= 2047 && (io[0x10] & 0x07))
+            {
+                shadowFreq = next;
+                io[0x13] = next & 0xFF;
+                io[0x14] = (io[0x14] & 0xF8) | (next >> 8);
+                sweepNext(io); // a second overflow check with the new value
+            }
+        }
+    }
+
+    if (step == 7)
+    {
+        for (int c : { 0, 1, 3 })
+        {
+            ApuChannel& k = ch[c];
+            uint8_t env = channelRegs(io, c)[2];
+            if (!k.enabled || !(env & 0x07)) continue;
+            if (k.envTimer > 1)
+            {
+                k.envTimer--;
+                continue;
+            }
+            k.envTimer = env & 0x07;
+            if ((env & 0x08) && k.volume < 15) k.volume++;
+            else if (!(env & 0x08) && k.volume > 0) k.volume--;
+        }
+    }
+
+    step = (step + 1) & 7;
+}
+
+void Apu::trigger(int c, uint8_t* io)
+{
+    ApuChannel& k = ch[c];
+    const uint8_t* r = channelRegs(io, c);
+
+    k.enabled = dacOn(io, c);
+    if (!k.length) k.length = c == 2 ? 256 : 64;
+    k.timer = period(io, c);
+    k.volume = r[2] >> 4;
+    k.envTimer = r[2] & 0x07;
+    if (c == 2) k.position = 0;
+    if (c == 3) k.lfsr = 0x7FFF;
+
+    if (c == 0)
+    {
+        uint8_t pace = (r[0] >> 4) & 0x07;
+        shadowFreq = frequency(r);
+        sweepTimer = pace ? pace : 8;
+        sweepEnabled = pace || (r[0] & 0x07);
+        if (r[0] & 0x07) sweepNext(io);
+    }
+}
+
+
+// while profiling, the host time of an apu call goes to the apu section
+// the calls made from cpu code are taken back off the cpu stretch they happened in
+struct ApuTimer
+{
+    Profiler* profiler;
+    std::chrono::steady_clock::time_point start;
+
+    explicit ApuTimer(Profiler* profiler) : profiler(profiler)
+    {
+        if (profiler) start = std::chrono::steady_clock::now();
+    }
+    ~ApuTimer()
+    {
+        if (profiler) profiler->addApuTime(std::chrono::steady_clock::now() - start);
+    }
+};
+
+// catches the channels up to now, the sequencer ticks in between are taken in order
+void GameBoy::syncApu()
+{
+    while (apu.nextStep <= sched.cycles)
+    {
+        apu.run(apu.nextStep, memory + 0xFF00, audio.get());
+        if (memory[0xFF26] & 0x80)
+        {
+            apu.clockSequencer(memory + 0xFF00);
+            mixApu();
+        }
+        apu.nextStep += CYCLES_SEQUENCER;
+
+        // long runs without a frame end still go out in frame sized pieces
+        if (audio && audio->pending(apu.cycles) >= CYCLES_PER_FRAME) audio->endFrame(apu.cycles);
+    }
+    apu.run(sched.cycles, memory + 0xFF00, audio.get());
+}
+
+void GameBoy::mixApu()
+{
+    if (!audio) return;
+    for (int c = 0; c < 4; ++c)
+        apu.mix(c, memory + 0xFF00, audio.get(), apu.cycles);
+}
+
+// without an output nothing can hear the apu, so it is left alone until a register is touched
+void GameBoy::endAudioFrame()
+{
+    if (!audio) return;
+    ApuTimer timer(profiler.get());
+    syncApu();
+    audio->endFrame(apu.cycles);
+}
+
+// a spin loop polling NR52 has to stop where a length counter could run out
+uint64_t GameBoy::apuNextChange() const
+{
+    if (!(apu.ch[0].enabled | apu.ch[1].enabled | apu.ch[2].enabled | apu.ch[3].enabled)) return UINT64_MAX;
+    if (apu.nextStep > sched.cycles) return apu.nextStep;
+    return sched.cycles + CYCLES_SEQUENCER - (sched.cycles - apu.nextStep) % CYCLES_SEQUENCER;
+}
+
+// a cpu read of NR52 catches the apu up first, so the status below never has to
+void GameBoy::touchAPU()
+{
+    ApuTimer timer(profiler.get());
+    syncApu();
+}
+
+uint8_t GameBoy::readAPU(uint16_t addr) const
+{
+    if (addr >= 0xFF30) return memory[addr]; // wave ram
+    if (addr != 0xFF26) return memory[addr] | readMasks[addr - 0xFF10];
+
+    // channels only stop on sequencer ticks, a peek while the apu is behind runs them on a copy
+    const Apu* now = &apu;
+    Apu ahead;
+    if (apu.nextStep <= sched.cycles && (memory[0xFF26] & 0x80))
+    {
+        ahead = apu;
+        uint8_t io[0x100];
+        std::memcpy(io, memory + 0xFF00, sizeof(io));
+        for (; ahead.nextStep <= sched.cycles; ahead.nextStep += CYCLES_SEQUENCER)
+            ahead.clockSequencer(io);
+        now = &ahead;
+    }
+
+    uint8_t status = 0;
+    for (int c = 0; c < 4; ++c)
+        if (now->ch[c].enabled) status |= 1 << c;
+    return (memory[addr] & 0x80) | 0x70 | status;
+}
+
+void GameBoy::writeAPU(uint16_t addr, uint8_t value)
+{
+    ApuTimer timer(profiler.get());
+    syncApu();
+    uint8_t* io = memory + 0xFF00;
+    const uint8_t reg = addr & 0xFF;
+
+    if (reg >= 0x30)
+    {
+        memory[addr] = value;
+        mixApu();
+        return;
+    }
+
+    if (reg == 0x26)
+    {
+        bool on = value & 0x80;
+        if (!on)
+        {
+            // powering off clears every register and silences all four channels
+            for (int r = 0x10; r < 0x26; ++r) io[r] = 0;
+            for (ApuChannel& k : apu.ch) k.enabled = false;
+        }
+        else if (!(io[0x26] & 0x80))
+        {
+            apu.step = 0;
+        }
+        io[0x26] = value & 0x80;
+        mixApu();
+        return;
+    }
+
+    if (!(io[0x26] & 0x80)) return; // registers ignore writes while powered off
+    io[reg] = value;
+
+    if (reg < 0x24)
+    {
+        const int c = (reg - 0x10) / 5;
+        ApuChannel& k = apu.ch[c];
+        switch ((reg - 0x10) % 5)
+        {
+        case 1: k.length = c == 2 ? 256 - value : 64 - (value & 0x3F); break;
+        case 4: if (value & 0x80) apu.trigger(c, io); break;
+        default: break;
+        }
+        if (!dacOn(io, c)) k.enabled = false;
+    }
+    mixApu();
+}
+
+void GameBoy::startAudio(AudioRing& ring, uint32_t sampleRate)
+{
+    syncApu();
+    audio = std::make_unique<AudioOut>(ring, sampleRate, apu.cycles);
+    mixApu();
+}
+
+void GameBoy::stopAudio()
+{
+    endAudioFrame();
+    audio.reset();
+}
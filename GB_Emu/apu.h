@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+
+class AudioOut;
+
+
+// one of the four voices, the registers themselves stay in memory[0xFF10..0xFF3F]
+struct ApuChannel
+{
+    uint8_t enabled;   // NR52 status bit
+    uint8_t volume;    // envelope level 0-15, unused by the wave channel
+    uint8_t envTimer;  // frame sequencer ticks until the next envelope step
+    uint8_t position;  // duty step 0-7, or wave sample 0-31
+    uint16_t length;   // ticks at 256 hz down to 0 when length enable is set
+    uint16_t lfsr;     // noise only
+    uint32_t timer;    // t-cycles until the next waveform step
+};
+
+// channels only move when something looks: a sound register access, the end of a frame,
+// or a spin loop that might be polling NR52. everything between is caught up in one go
+// plain data on purpose so save states can copy it whole
+struct Apu
+{
+    ApuChannel ch[4];
+    uint64_t cycles;        // channels have been run up to here
+    uint64_t nextStep;      // next frame sequencer tick
+    uint8_t step;           // frame sequencer position 0-7
+    uint8_t sweepEnabled;   // channel 1 frequency sweep
+    uint8_t sweepTimer;
+    uint16_t shadowFreq;
+
+    void run(uint64_t to, const uint8_t* io, AudioOut* out);
+    void clockSequencer(uint8_t* io);
+    void trigger(int c, uint8_t* io);
+    void mix(int c, const uint8_t* io, AudioOut* out, uint64_t when) const; // tells out what channel c sounds like now
+    uint8_t level(int c, const uint8_t* io) const;
+
+private:
+    uint16_t sweepNext(const uint8_t* io); // disables channel 1 on overflow
+};
@@ -0,0 +1,262 @@
+#include "audio.h"
+#include "sysInfo.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+
+// one windowed sinc per sub sample phase, delayed by half the width so it never reaches back
+// each phase sums to 1 so a delta of d moves the integrated output by exactly d
+struct BlipKernel
+{
+    float taps[BlipBuffer::PHASES][BlipBuffer::WIDTH];
+
+    BlipKernel()
+    {
+        const double pi = 3.14159265358979323846;
+        const double cutoff = 0.9; // of nyquist, leaves room for the window to roll off
+        const double half = BlipBuffer::WIDTH / 2;
+
+        for (int p = 0; p < BlipBuffer::PHASES; ++p)
+        {
+            double sum = 0;
+            double raw[BlipBuffer::WIDTH];
+            for (int i = 0; i < BlipBuffer::WIDTH; ++i)
+            {
+                double x = i - half - double(p) / BlipBuffer::PHASES; // samples from the step
+                double sinc = x == 0 ? 1 : std::sin(pi * cutoff * x) / (pi * cutoff * x);
+                double window = std::fabs(x) >= half ? 0 : 0.42 + 0.5 * std::cos(pi * x / half) + 0.08 * std::cos(2 * pi * x / half);
+                raw[i] = sinc * window;
+                sum += raw[i];
+            }
+            for (int i = 0; i < BlipBuffer::WIDTH; ++i)
+                taps[p][i] = float(raw[i] / sum);
+        }
+    }
+};
+
+static const BlipKernel kernel;
+
+// about 20hz at 48khz, takes off the dc the dmg's unipolar channels leave behind
+static const float HIGHPASS = 0.0026f;
+
+BlipBuffer::BlipBuffer(uint32_t clockRate, uint32_t sampleRate, size_t maxSamples)
+    : factor((uint64_t(sampleRate) << 32) / clockRate), buf(maxSamples + WIDTH)
+{
+}
+
+void BlipBuffer::addDelta(uint64_t clock, int delta)
+{
+    uint64_t t = offset + clock * factor;
+    size_t pos = avail + size_t(t >> 32);
+    if (pos + WIDTH > buf.size()) return; // frames are ended often enough that this never happens
+
+    const float* taps = kernel.taps[(t >> 27) & (PHASES - 1)];
+    float* out = &buf[pos];
+    for (int i = 0; i < WIDTH; ++i)
+        out[i] += taps[i] * delta;
+}
+
+void BlipBuffer::endFrame(uint64_t clocks)
+{
+    uint64_t t = offset + clocks * factor;
+    avail += size_t(t >> 32);
+    offset = t & 0xFFFFFFFF;
+}
+
+void BlipBuffer::read(int16_t* out, size_t count, size_t stride)
+{
+    count = std::min(count, avail);
+    for (size_t i = 0; i < count; ++i)
+    {
+        sum += buf[i];
+        highpass += (sum - highpass) * HIGHPASS;
+        float s = std::min(32767.0f, std::max(-32768.0f, sum - highpass));
+        out[i * stride] = int16_t(s);
+    }
+
+    // the tails of steps near the end belong to samples still to come
+    size_t live = avail + WIDTH;
+    std::copy(buf.begin() + count, buf.begin() + live, buf.begin());
+    std::fill(buf.begin() + live - count, buf.begin() + live, 0.0f);
+    avail -= count;
+}
+
+
+AudioRing::AudioRing(size_t frames, bool lossless) : lossless(lossless)
+{
+    size_t size = 1;
+    while (size < frames) size <<= 1;
+    ring.resize(size * 2);
+    mask = size - 1;
+}
+
+size_t AudioRing::available() const
+{
+    return size_t(head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire));
+}
+
+void AudioRing::write(const int16_t* samples, size_t frames)
+{
+    const size_t size = mask + 1;
+    uint64_t h = head.load(std::memory_order_relaxed);
+    while (frames)
+    {
+        size_t room = size - size_t(h - tail.load(std::memory_order_acquire));
+        if (!room)
+        {
+            if (!lossless)
+            {
+                lost.fetch_add(frames, std::memory_order_relaxed);
+                return;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+
+        size_t start = size_t(h & mask);
+        size_t n = std::min({ frames, room, size - start });
+        std::copy(samples, samples + n * 2, &ring[start * 2]);
+        samples += n * 2;
+        frames -= n;
+        h += n;
+        head.store(h, std::memory_order_release);
+    }
+}
+
+size_t AudioRing::read(int16_t* out, size_t frames)
+{
+    const size_t size = mask + 1;
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    size_t total = 0;
+    while (frames)
+    {
+        size_t ready = size_t(head.load(std::memory_order_acquire) - t);
+        if (!ready) break;
+
+        size_t start = size_t(t & mask);
+        size_t n = std::min({ frames, ready, size - start });
+        std::copy(&ring[start * 2], &ring[(start + n) * 2], out);
+        out += n * 2;
+        frames -= n;
+        total += n;
+        t += n;
+        tail.store(t, std::memory_order_release);
+    }
+    return total;
+}
+
+
+// one channel at full volume on both sides is about a fifth of the int16 range
+static const int AMPLITUDE = 48;
+
+static size_t maxSamples(uint32_t sampleRate)
+{
+    // the apu ends a frame at least every frame plus one sequencer tick, this leaves plenty over
+    return size_t(uint64_t(sampleRate) * CYCLES_PER_FRAME * 4 / CLOCK_HZ) + 1;
+}
+
+AudioOut::AudioOut(AudioRing& ring, uint32_t sampleRate, uint64_t start)
+    : ring(ring), left(CLOCK_HZ, sampleRate, maxSamples(sampleRate)),
+    right(CLOCK_HZ, sampleRate, maxSamples(sampleRate)), frameStart(start)
+{
+}
+
+void AudioOut::set(int c, int l, int r, uint64_t when)
+{
+    if (l != levels[c][0]) left.addDelta(when - frameStart, (l - levels[c][0]) * AMPLITUDE);
+    if (r != levels[c][1]) right.addDelta(when - frameStart, (r - levels[c][1]) * AMPLITUDE);
+    levels[c][0] = l;
+    levels[c][1] = r;
+}
+
+void AudioOut::endFrame(uint64_t when)
+{
+    left.endFrame(when - frameStart);
+    right.endFrame(when - frameStart);
+    frameStart = when;
+
+    size_t n = std::min(left.available(), right.available());
+    samples.resize(n * 2);
+    left.read(samples.data(), n, 2);
+    right.read(samples.data() + 1, n, 2);
+    ring.write(samples.data(), n);
+}
+
+
+std::unique_ptr<AudioSink> AudioSink::open(const std::string& filename, uint32_t sampleRate)
+{
+    std::unique_ptr<AudioSink> s(new AudioSink(sampleRate));
+    s->wav = filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".wav") == 0;
+    s->file.open(filename, std::ios::binary);
+    if (s->wav) s->writeHeader(0);
+    if (!s->file)
+    {
+        std::cerr << filename << " couldnt be written!" << "\n";
+        return nullptr;
+    }
+
+    s->writer = std::thread(&AudioSink::drain, s.get());
+    return s;
+}
+
+AudioSink::AudioSink(uint32_t sampleRate) : ring(DEFAULT_FRAMES, true), sampleRate(sampleRate)
+{
+}
+
+AudioSink::~AudioSink()
+{
+    stopping.store(true, std::memory_order_release);
+    if (writer.joinable()) writer.join();
+
+    // sizes were unknown when the header went out
+    if (wav && file)
+    {
+        file.seekp(0);
+        writeHeader(frames.load(std::memory_order_relaxed));
+    }
+}
+
+static void putLE(std::ofstream& file, uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+        file.put(char(value >> (i * 8)));
+}
+
+// 44 byte canonical header, 16 bit stereo pcm
+void AudioSink::writeHeader(uint64_t dataFrames)
+{
+    uint32_t dataBytes = uint32_t(std::min<uint64_t>(dataFrames * 4, 0xFFFFFFFF - 36));
+    file.write("RIFF", 4);
+    putLE(file, 36 + dataBytes, 4);
+    file.write("WAVEfmt ", 8);
+    putLE(file, 16, 4);
+    putLE(file, 1, 2); // pcm
+    putLE(file, 2, 2); // channels
+    putLE(file, sampleRate, 4);
+    putLE(file, sampleRate * 4, 4);
+    putLE(file, 4, 2); // bytes per frame
+    putLE(file, 16, 2);
+    file.write("data", 4);
+    putLE(file, dataBytes, 4);
+}
+
+void AudioSink::drain()
+{
+    std::vector<int16_t> chunk(8192 * 2);
+    while (true)
+    {
+        bool last = stopping.load(std::memory_order_acquire);
+        size_t n = ring.read(chunk.data(), chunk.size() / 2);
+        if (!n)
+        {
+            if (last) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            continue;
+        }
+        file.write(reinterpret_cast<const char*>(chunk.data()), n * 4);
+        frames.fetch_add(n, std::memory_order_relaxed);
+    }
+    file.flush();
+}
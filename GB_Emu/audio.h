@@ -0,0 +1,109 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+constexpr uint32_t AUDIO_RATE = 48000; // default host sample rate
+
+
+// band limited step synthesis, every level change lands as a windowed sinc step
+// so square edges dont alias on the way down from 4mhz to the host rate
+// deltas go in at cycle times, whole samples come out once a frame is ended
+class BlipBuffer
+{
+public:
+    static constexpr int WIDTH = 16;  // taps per step
+    static constexpr int PHASES = 32; // sub sample positions
+
+    BlipBuffer(uint32_t clockRate, uint32_t sampleRate, size_t maxSamples);
+
+    void addDelta(uint64_t clock, int delta); // clock counts from the start of the current frame
+    void endFrame(uint64_t clocks);           // everything before clocks can be read, the next frame starts there
+    size_t available() const { return avail; }
+    void read(int16_t* out, size_t count, size_t stride); // takes count samples off the front
+
+private:
+    uint64_t factor;     // samples per clock, 32.32 fixed point
+    uint64_t offset = 0; // fraction of a sample the current frame starts at
+    std::vector<float> buf;
+    size_t avail = 0;
+    float sum = 0;       // running integral of the deltas
+    float highpass = 0;  // slow average taken off to drop the dc offset
+};
+
+
+// single producer, single consumer ring of interleaved stereo samples
+// lossless rings make the producer wait for room, like Trace, so files never miss a sample
+// otherwise whatever doesnt fit is dropped and the emulator never waits on a slow device
+class AudioRing
+{
+public:
+    AudioRing(size_t frames, bool lossless);
+
+    void write(const int16_t* samples, size_t frames);
+    size_t read(int16_t* out, size_t frames); // up to frames, returns how many there were
+    size_t available() const;
+    uint64_t dropped() const { return lost.load(std::memory_order_relaxed); }
+
+private:
+    std::vector<int16_t> ring;
+    size_t mask; // in frames
+    bool lossless;
+    std::atomic<uint64_t> lost{ 0 };
+
+    alignas(64) std::atomic<uint64_t> head{ 0 }; // written by the emulator
+    alignas(64) std::atomic<uint64_t> tail{ 0 }; // written by the consumer
+};
+
+
+// the apu's end: per channel levels become deltas in two blip buffers,
+// finished samples go into the ring at each frame end
+class AudioOut
+{
+public:
+    AudioOut(AudioRing& ring, uint32_t sampleRate, uint64_t start);
+
+    void set(int c, int left, int right, uint64_t when); // channel c now outputs left/right
+    void endFrame(uint64_t when);
+    void restart(uint64_t when) { frameStart = when; } // the clock jumped, after a state load
+    uint64_t pending(uint64_t when) const { return when - frameStart; }
+
+private:
+    AudioRing& ring;
+    BlipBuffer left, right;
+    uint64_t frameStart;
+    int levels[4][2] = {};
+    std::vector<int16_t> samples;
+};
+
+
+// headless sink, drains a ring to a .wav file or raw s16le stereo for any other name
+class AudioSink
+{
+public:
+    static constexpr size_t DEFAULT_FRAMES = 1 << 15; // about 0.7s at 48khz
+
+    // null when the file cant be created
+    static std::unique_ptr<AudioSink> open(const std::string& filename, uint32_t sampleRate = AUDIO_RATE);
+    ~AudioSink(); // writes what is left and fills in the wav sizes
+
+    AudioRing ring;
+    uint64_t written() const { return frames.load(std::memory_order_relaxed); }
+
+private:
+    AudioSink(uint32_t sampleRate);
+    void drain();
+    void writeHeader(uint64_t dataFrames);
+
+    uint32_t sampleRate;
+    bool wav = false;
+    std::ofstream file;
+    std::thread writer;
+    std::atomic<bool> stopping{ false };
+    std::atomic<uint64_t> frames{ 0 };
+};
@@ -0,0 +1,55 @@
+#include "batch.h"
+#include "gameboy.h"
+#include <algorithm>
+
+
+bool Batch::load(const std::string& romPath, size_t lanes, bool jit)
+{
+    auto gb = std::make_unique<GameBoy>();
+    gb->initMemory();
+    if (!gb->loadROM(romPath)) return false;
+
+    gb->bootSetup();
+    gb->postBootSetup();
+    gb->setBlockCache(true);
+    if (jit) gb->setJit(true);
+
+    consoles.clear();
+    consoles.push_back(std::move(gb));
+    laneConsole.assign(lanes, 0);
+    return true;
+}
+
+// first the consoles whose lanes disagree are split, then they all run their frame in lockstep
+void Batch::runFrame(const uint16_t* buttons)
+{
+    std::vector<uint16_t> wanted(consoles.size(), IDLE);
+    std::vector<std::pair<uint32_t, size_t>> forks; // console << 8 | buttons -> the copy made this frame
+
+    for (size_t i = 0; i < laneConsole.size(); ++i)
+    {
+        if (buttons[i] == IDLE) continue;
+        const size_t c = laneConsole[i];
+        if (wanted[c] == IDLE) wanted[c] = buttons[i];
+        if (wanted[c] == buttons[i]) continue;
+
+        const uint32_t key = uint32_t(c << 8) | buttons[i];
+        auto fork = std::find_if(forks.begin(), forks.end(), [&](const auto& f) { return f.first == key; });
+        if (fork == forks.end())
+        {
+            consoles.push_back(consoles[c]->clone());
+            wanted.push_back(buttons[i]);
+            fork = forks.insert(forks.end(), { key, consoles.size() - 1 });
+        }
+        laneConsole[i] = fork->second;
+    }
+
+    std::vector<GameBoy*> running;
+    for (size_t c = 0; c < consoles.size(); ++c)
+    {
+        if (wanted[c] == IDLE || consoles[c]->crashed) continue;
+        consoles[c]->joypad = uint8_t(wanted[c]);
+        running.push_back(consoles[c].get());
+    }
+    GameBoy::runFramesLockstep(running.data(), running.size());
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class GameBoy;
+
+
+// many copies of one rom stepped in lockstep, a frame at a time
+// the core is deterministic, so lanes that have been fed the same buttons so far are
+// still the same console bit for bit. they share one GameBoy that runs once for all of them,
+// and it only forks when its lanes ask for different buttons on the same frame.
+// the consoles left after that run through GameBoy::runFramesLockstep: each rom block is
+// decoded once and run op by op across every console sitting at it, consoles whose code
+// has gone somewhere else run their own blocks
+class Batch
+{
+public:
+    static constexpr size_t LANES = 16; // runJobs batches up to this many jobs on one rom
+    static constexpr uint16_t IDLE = 0x100; // lane is finished, its console may carry on for the others
+
+    // boots every lane, false when the rom cant be loaded
+    bool load(const std::string& romPath, size_t lanes, bool jit);
+
+    // buttons[lane] is held for the whole frame
+    // read a lane's results before idling it, the console behind it can keep going
+    void runFrame(const uint16_t* buttons);
+
+    const GameBoy& lane(size_t i) const { return *consoles[laneConsole[i]]; }
+    size_t lanes() const { return laneConsole.size(); }
+    size_t running() const { return consoles.size(); } // distinct consoles behind the lanes
+
+private:
+    std::vector<std::unique_ptr<GameBoy>> consoles;
+    std::vector<size_t> laneConsole;
+};
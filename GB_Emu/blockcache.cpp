@@ -0,0 +1,436 @@
+#include "blockcache.h"
+#include "gameboy.h"
+#include "sysInfo.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+
+void BlockCache::markCode(const Block& b)
+{
+    for (uint32_t addr = b.start; addr < b.end; ++addr)
+        codeBytes[addr >> 3] |= 1 << (addr & 7);
+
+    const size_t index = &b - entries;
+    for (int page = b.start >> 8; page <= (b.end - 1) >> 8; ++page)
+        pageBlocks[page - 0x80][index / 64] |= uint64_t(1) << (index % 64);
+}
+
+bool BlockCache::pageHasCode(uint8_t page) const
+{
+    const uint8_t* bits = &codeBytes[page * 32];
+    for (int i = 0; i < 32; ++i)
+        if (bits[i]) return true;
+    return false;
+}
+
+// only code bytes get here and only ram blocks mark any, so addr is always in ram
+bool BlockCache::invalidate(uint16_t addr)
+{
+    const int page = addr >> 8;
+    bool dropped = false;
+    for (int w = 0; w < WORDS; ++w)
+    {
+        uint64_t& word = pageBlocks[page - 0x80][w];
+        uint64_t bits = word;
+        for (int bit = 0; bits; ++bit, bits >>= 1)
+        {
+            if (!(bits & 1)) continue;
+
+            Block& b = entries[w * 64 + bit];
+            bool onPage = b.key != Block::NO_KEY && b.start >= 0x8000 && page >= (b.start >> 8) && page <= ((b.end - 1) >> 8);
+            if (onPage && addr >= b.start && addr < b.end)
+            {
+                b.key = Block::NO_KEY;
+                dropped = true;
+                onPage = false;
+            }
+            if (!onPage) word &= ~(uint64_t(1) << bit);
+        }
+    }
+
+    // every block over this byte is gone now, so its bit is exact again
+    codeBytes[addr >> 3] &= ~(1 << (addr & 7));
+    return dropped;
+}
+
+void BlockCache::clear()
+{
+    for (Block& b : entries)
+        b.key = Block::NO_KEY;
+    std::fill(std::begin(codeBytes), std::end(codeBytes), 0);
+    std::memset(pageBlocks, 0, sizeof(pageBlocks));
+}
+
+void BlockCache::dropRam()
+{
+    for (Block& b : entries)
+        if (b.start >= 0x8000) b.key = Block::NO_KEY;
+    std::fill(std::begin(codeBytes), std::end(codeBytes), 0);
+    std::memset(pageBlocks, 0, sizeof(pageBlocks));
+}
+
+
+void BlockCache::dropNative()
+{
+    for (Block& b : entries)
+    {
+        b.native = nullptr;
+        b.hits = 0;
+    }
+}
+
+
+// blocks never straddle the fixed bank, the switchable bank, ram and hram
+// echo ram is left to the interpreter, a write through c000-ddff couldnt find blocks decoded up there
+static int codeRegion(uint16_t addr)
+{
+    if (addr < 0x4000) return 0;
+    if (addr < 0x8000) return 1;
+    if (addr < 0xE000) return 2;
+    if (addr < 0xFF80) return 3;
+    return 4;
+}
+
+// ops that change nothing but registers, memory reads have no side effects here
+static bool readOnlyOp(const MicroOp& op)
+{
+    const uint8_t o = op.opcode;
+    const int x = o >> 6, y = (o >> 3) & 7, z = o & 7;
+
+    if (o == 0xCB) return ((op.operand >> 6) & 3) == 1 || (op.operand & 7) != 6; // bit n,(hl) only reads
+    if (x == 1) return o != 0x76 && y != 6;  // ld r,r' and ld r,(hl)
+    if (x == 2) return true;                 // alu a,r
+    if (x == 3) return z == 6 || o == 0xF0 || o == 0xF2 || o == 0xFA; // alu a,n and the ld a,(io) forms
+    if (z == 4 || z == 5 || z == 6) return y != 6; // inc, dec and ld r,n, but not on (hl)
+    return o == 0x00 || o == 0x0A || o == 0x1A
+        || o == 0x07 || o == 0x0F || o == 0x17 || o == 0x1F || o == 0x2F || o == 0x37 || o == 0x3F;
+}
+
+// a loop of one block that only reads, like ldh a,(STAT) / and 3 / jr nz
+static bool isSpinLoop(const Block& b)
+{
+    const MicroOp& last = b.ops[b.count - 1];
+    uint16_t target;
+    switch (last.opcode)
+    {
+    case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+        target = uint16_t(b.end + int8_t(last.operand & 0xFF));
+        break;
+    case 0xC3: case 0xC2: case 0xCA: case 0xD2: case 0xDA:
+        target = last.operand;
+        break;
+    default:
+        return false;
+    }
+    if (target != b.start) return false;
+
+    for (int i = 0; i < b.count - 1; ++i)
+        if (!readOnlyOp(b.ops[i])) return false;
+    return true;
+}
+
+void GameBoy::setBlockCache(bool on)
+{
+    if (on && !blocks) blocks = std::make_unique<BlockCache>();
+    if (!on) blocks.reset();
+    mapPages();
+}
+
+// banked windows hold different code at the same pc
+uint32_t GameBoy::codeKey(uint16_t pc) const
+{
+    uint32_t bank = 0;
+    if (pc < 0x4000) bank = cart.romBank0;
+    else if (pc < 0x8000) bank = cart.romBank;
+    else if (pc >= 0xA000 && pc < 0xC000) bank = cart.ramBank;
+    return (bank << 16) | pc;
+}
+
+bool GameBoy::buildBlock(Block& b, uint32_t key, uint16_t pc)
+{
+    const int region = codeRegion(pc);
+
+    b.key = key;
+    b.start = pc;
+    b.count = 0;
+    b.cycles = 0;
+    b.maxCycles = 0;
+    b.hits = 0;
+    b.native = nullptr;
+    b.spin = false;
+
+    while (b.count < Block::MAX_OPS)
+    {
+        uint8_t opcode = read8(pc);
+        const OpInfo& info = opTable[opcode];
+        uint16_t last = pc + info.length - 1;
+        if (last < pc || codeRegion(last) != region) break;
+
+        MicroOp& op = b.ops[b.count++];
+        op.operand = 0;
+        if (info.length > 1) op.operand = read8(pc + 1);
+        if (info.length > 2) op.operand |= read8(pc + 2) << 8;
+        op.length = info.length;
+        op.opcode = opcode;
+
+        if (opcode == 0xCB)
+        {
+            const OpInfo& cb = cbTable[op.operand & 0xFF];
+            op.handler = cb.handler;
+            op.cycles = info.cycles + cb.cycles;
+        }
+        else
+        {
+            op.handler = info.handler;
+            op.cycles = info.cycles;
+        }
+
+        b.cycles += op.cycles;
+        pc += info.length;
+
+        if (info.endsBlock)
+        {
+            b.maxCycles = b.cycles + info.takenCycles;
+            break;
+        }
+        if (pc == 0 || codeRegion(pc) != region) break;
+    }
+
+    if (b.count == 0) return false;
+    if (b.maxCycles == 0) b.maxCycles = b.cycles;
+    b.end = pc;
+    b.spin = isSpinLoop(b);
+
+    // ram holding code loses its fast write page so writes can find the blocks
+    if (b.start >= 0x8000)
+    {
+        blocks->markCode(b);
+        for (int page = b.start >> 8; page <= (b.end - 1) >> 8; ++page)
+            if (page < 0xFE) mapCodePage(page);
+    }
+    return true;
+}
+
+Block* GameBoy::lookupBlock(uint16_t pc)
+{
+    if (codeRegion(pc) == 3 || pc == 0xFFFF) return nullptr; // echo, oam, io and IE are never code we want to keep
+
+    uint32_t key = codeKey(pc);
+    if (Block* b = blocks->find(key)) return b;
+
+    Block& b = blocks->allocate(key);
+    if (!buildBlock(b, key, pc))
+    {
+        b.key = Block::NO_KEY;
+        return nullptr;
+    }
+    return &b;
+}
+
+// a spin block came back to its start with every register as it was
+// everything it reads only changes at events, so each lap until then is the same
+// lap, jump over the ones that would still fit whole before limit
+void GameBoy::skipSpin(const Block& b, const Registers& before, uint64_t lapStart, uint64_t limit)
+{
+    Registers now = regs;
+    now.F = flags();
+    if (std::memcmp(&now, &before, sizeof(Registers)) != 0) return;
+    if (dmaActive) return; // a bus the dma holds reads something new every m-cycle
+
+    uint64_t lap = sched.cycles - lapStart;
+    limit = std::min(limit, apuNextChange()); // NR52 can change between events
+    limit = std::min(limit, spinReadLimit);   // and so can DIV and TIMA
+    if (sched.cycles + b.maxCycles > limit) return;
+    sched.cycles += ((limit - sched.cycles - b.maxCycles) / lap + 1) * lap;
+}
+
+// spin blocks remember where they started so skipSpin can tell a lap changed nothing
+inline void GameBoy::startBlock(const Block& b, Registers& before, uint64_t& lapStart)
+{
+    lapStart = sched.cycles;
+    if (b.spin)
+    {
+        before = regs;
+        before.F = flags();
+        spinReadLimit = UINT64_MAX;
+    }
+
+    // io writes and writes over cached code stop the block on the next boundary
+    blockBreak = false;
+}
+
+inline void GameBoy::finishBlock(Block& b, bool ranNative, const Registers& before, uint64_t lapStart, uint64_t limit)
+{
+    // compile after the run so the block cant have been dropped under us
+    if (!ranNative && jit && ++b.hits == Jit::HOT_THRESHOLD && b.key != Block::NO_KEY)
+        b.native = compileBlock(b);
+
+    if (b.spin && regs.PC == b.start) skipSpin(b, before, lapStart, limit);
+
+    if (eiDelay && --eiDelay == 0) ime = true;
+}
+
+inline void GameBoy::runBlock(Block& b, uint64_t limit)
+{
+    Registers before;
+    uint64_t lapStart;
+    startBlock(b, before, lapStart);
+
+    const bool ranNative = b.native != nullptr;
+    if (ranNative)
+    {
+        syncFlags(); // native code keeps F in a host register
+        b.native(this);
+    }
+    else
+    {
+        for (int i = 0; i < b.count; ++i)
+        {
+            const MicroOp& op = b.ops[i];
+            regs.PC += op.length;
+            sched.cycles += op.cycles;
+            op.handler(*this, op.operand);
+            if (blockBreak) break;
+        }
+    }
+
+    finishBlock(b, ranNative, before, lapStart, limit);
+}
+
+// whole blocks run only when they finish before the next event, so events and
+// interrupts land on exactly the same instruction as with emulateCycle
+void GameBoy::runBlocks(uint64_t stop)
+{
+    while (!crashed)
+    {
+        uint64_t limit = std::min(stop, sched.nextEvent());
+        if (sched.cycles >= limit) return;
+        if (skipHalt(limit)) continue;
+
+        bool irq = ime && irqPending;
+        Block* b = (halted || eiDelay || singleStep || irq) ? nullptr : lookupBlock(regs.PC);
+        if (!b || sched.cycles + b->maxCycles > limit)
+        {
+            emulateCycle();
+            continue;
+        }
+        runBlock(*b, limit);
+    }
+}
+
+// runs this console the way run(target, true) and runBlocks would, up to the next
+// interpreted rom block that fits before limit, and hands that back unrun.
+// null once the frame is over
+Block* GameBoy::nextSharedBlock(uint64_t target, uint64_t& limit)
+{
+    for (;;)
+    {
+        limit = std::min(target, sched.nextEvent());
+        if (crashed || sched.cycles >= limit)
+        {
+            Event event;
+            while (sched.popDue(event))
+                handleEvent(event);
+            if (crashed || frameDone || sched.cycles >= target) return nullptr;
+            continue;
+        }
+        if (skipHalt(limit)) continue;
+
+        bool irq = ime && irqPending;
+        Block* b = (halted || eiDelay || singleStep || irq) ? nullptr : lookupBlock(regs.PC);
+        if (!b || sched.cycles + b->maxCycles > limit)
+        {
+            emulateCycle();
+            continue;
+        }
+
+        // ram can hold different code on each console, native code has nothing to share
+        if (b->start >= 0x8000 || b->native)
+        {
+            runBlock(*b, limit);
+            continue;
+        }
+        return b;
+    }
+}
+
+// every console steps to its next rom block, then consoles waiting at the same one run it
+// together, each op across all of them before the next. the rom and bank are the same so the
+// ops are too: only the first console's copy is read and each handler stays hot for the rest.
+// a console that breaks out of the block drops out of it, the others carry on
+void GameBoy::runFramesLockstep(GameBoy* const* consoles, size_t count)
+{
+    struct Lane
+    {
+        GameBoy* gb;
+        uint64_t target;
+        uint64_t limit;
+        Block* block;
+        Registers before;
+        uint64_t lapStart;
+        bool running;
+    };
+
+    std::vector<Lane> lanes;
+    for (size_t i = 0; i < count; ++i)
+    {
+        GameBoy* gb = consoles[i];
+        if (!gb->blocks || gb->profiler)
+        {
+            gb->runFrame();
+            continue;
+        }
+        gb->frameDone = false;
+        lanes.push_back({ gb, gb->sched.cycles + CYCLES_PER_FRAME, 0, nullptr, {}, 0, false });
+    }
+
+    while (!lanes.empty())
+    {
+        for (size_t i = 0; i < lanes.size();)
+        {
+            Lane& l = lanes[i];
+            l.block = l.gb->nextSharedBlock(l.target, l.limit);
+            if (l.block)
+            {
+                ++i;
+                continue;
+            }
+            l.gb->endAudioFrame();
+            lanes[i] = lanes.back();
+            lanes.pop_back();
+        }
+        auto byKey = [](const Lane& a, const Lane& b) { return a.block->key < b.block->key; };
+        if (!std::is_sorted(lanes.begin(), lanes.end(), byKey)) std::sort(lanes.begin(), lanes.end(), byKey);
+
+        for (size_t first = 0, last; first < lanes.size(); first = last)
+        {
+            last = first + 1;
+            while (last < lanes.size() && lanes[last].block->key == lanes[first].block->key) ++last;
+
+            for (size_t i = first; i < last; ++i)
+            {
+                lanes[i].gb->startBlock(*lanes[i].block, lanes[i].before, lanes[i].lapStart);
+                lanes[i].running = true;
+            }
+
+            const Block& shared = *lanes[first].block;
+            for (int op = 0; op < shared.count; ++op)
+            {
+                const MicroOp& m = shared.ops[op];
+                for (size_t i = first; i < last; ++i)
+                {
+                    if (!lanes[i].running) continue;
+                    GameBoy& gb = *lanes[i].gb;
+                    gb.regs.PC += m.length;
+                    gb.sched.cycles += m.cycles;
+                    m.handler(gb, m.operand);
+                    if (gb.blockBreak) lanes[i].running = false;
+                }
+            }
+
+            for (size_t i = first; i < last; ++i)
+                lanes[i].gb->finishBlock(*lanes[i].block, false, lanes[i].before, lanes[i].lapStart, lanes[i].limit);
+        }
+    }
+}
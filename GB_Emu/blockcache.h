@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdint>
+#include "opcodes.h"
+
+
+// one instruction with its operand already pulled out of memory
+// cb ops point straight at their cb handler, cycles include the prefix
+struct MicroOp
+{
+    OpHandler handler;
+    uint16_t operand;
+    uint8_t cycles;
+    uint8_t length;
+    uint8_t opcode;  // 0xCB for the cb page, the cb opcode is then the operand
+};
+
+class GameBoy;
+typedef void (*NativeBlock)(GameBoy* gb);
+
+// a straight line run of instructions, ending at the first branch or block ending op
+struct Block
+{
+    static constexpr uint32_t NO_KEY = 0xFFFFFFFF;
+    static constexpr int MAX_OPS = 16;
+
+    uint32_t key = NO_KEY; // bank << 16 | start pc
+    uint16_t start = 0;
+    uint16_t end = 0;      // one past the last byte
+    uint16_t cycles = 0;   // every op at its not taken cost
+    uint16_t maxCycles = 0; // plus the last op taking its branch
+    uint8_t count = 0;
+    uint16_t hits = 0;            // runs so far, the jit picks up hot blocks
+    bool spin = false;            // loops straight back to start and never writes, may be polling
+    NativeBlock native = nullptr; // jit output, same effect as running ops
+    MicroOp ops[MAX_OPS];
+};
+
+
+// direct mapped, a colliding block just replaces the old one
+// rom blocks live until evicted, ram blocks also die when a byte they were decoded from is written
+class BlockCache
+{
+public:
+    static constexpr int ENTRIES = 1024;
+
+    Block* find(uint32_t key)
+    {
+        Block& b = entries[slot(key)];
+        return b.key == key ? &b : nullptr;
+    }
+
+    Block& allocate(uint32_t key) { return entries[slot(key)]; }
+
+    // remembers which ram bytes are code so writes can find out cheaply,
+    // and which entries each ram page has blocks in so they can find the blocks
+    void markCode(const Block& b);
+    bool isCode(uint16_t addr) const { return codeBytes[addr >> 3] & (1 << (addr & 7)); }
+    bool pageHasCode(uint8_t page) const;
+
+    // drops every block decoded from addr, returns true if any were dropped
+    bool invalidate(uint16_t addr);
+    void clear();
+    void dropRam(); // ram contents were replaced wholesale, rom blocks survive
+
+    // forget all jit output, the code buffer it lived in is being reused
+    void dropNative();
+
+private:
+    static uint32_t slot(uint32_t key) { return (key * 2654435761u) >> 22; } // top 10 bits
+    static constexpr int WORDS = ENTRIES / 64;
+
+    Block entries[ENTRIES];
+    uint8_t codeBytes[0x10000 / 8] = {};
+    // one bit per entry for each ram page from 0x80 up, set when a block there was decoded
+    // from the page, entries reused since are only weeded out when the page is next written
+    uint64_t pageBlocks[0x80][WORDS] = {};
+};
@@ -0,0 +1,512 @@
+#include "cartridge.h"
+#include "gameboy.h"
+#include "sysInfo.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+static std::mutex registryLock;
+static std::map<std::string, std::weak_ptr<const RomImage>> registry;
+
+std::shared_ptr<const RomImage> RomImage::open(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(registryLock);
+
+    for (auto it = registry.begin(); it != registry.end();)
+    {
+        if (it->second.expired()) it = registry.erase(it);
+        else ++it;
+    }
+
+    auto found = registry.find(path);
+    if (found != registry.end()) return found->second.lock();
+
+    std::shared_ptr<RomImage> rom(new RomImage());
+    if (!rom->load(path)) return nullptr;
+    registry[path] = rom;
+    return rom;
+}
+
+bool RomImage::load(const std::string& path)
+{
+    // whole banks map straight in, anything else (tiny test roms) is padded out to 32KB of 0xFF
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+    size_t size = size_t(fileSize.QuadPart);
+    if (size >= 0x8000 && size % 0x4000 == 0)
+    {
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping) bytes = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        mapped = bytes != nullptr;
+    }
+    CloseHandle(file);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    size_t size = fstat(fd, &info) == 0 ? size_t(info.st_size) : 0;
+    if (size >= 0x8000 && size % 0x4000 == 0)
+    {
+        void* p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            bytes = static_cast<const uint8_t*>(p);
+            mapped = true;
+        }
+    }
+    close(fd);
+#endif
+
+    if (mapped)
+    {
+        length = size;
+        return true;
+    }
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+
+    copy.assign(std::max<size_t>(0x8000, (size + 0x3FFF) & ~size_t(0x3FFF)), 0xFF);
+    file.read(reinterpret_cast<char*>(copy.data()), std::min(size, copy.size()));
+    bytes = copy.data();
+    length = copy.size();
+    return true;
+}
+
+// roms handed over in memory are copied, the caller's buffer can go away straight after
+std::shared_ptr<const RomImage> RomImage::fromMemory(const uint8_t* data, size_t size)
+{
+    if (!data || !size) return nullptr;
+
+    std::shared_ptr<RomImage> rom(new RomImage());
+    rom->copy.assign(std::max<size_t>(0x8000, (size + 0x3FFF) & ~size_t(0x3FFF)), 0xFF);
+    std::copy(data, data + std::min(size, rom->copy.size()), rom->copy.begin());
+    rom->bytes = rom->copy.data();
+    rom->length = rom->copy.size();
+    return rom;
+}
+
+RomImage::~RomImage()
+{
+    if (!mapped) return;
+#ifdef _WIN32
+    UnmapViewOfFile(bytes);
+    CloseHandle(mapping);
+#else
+    munmap(const_cast<uint8_t*>(bytes), length);
+#endif
+}
+
+
+// msync from here, so a slow disk never holds up a frame
+struct CartRam::Flusher
+{
+    uint8_t* bytes;
+    size_t length;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stop = false;
+    std::thread thread;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+
+    void sync()
+    {
+#ifdef _WIN32
+        FlushViewOfFile(bytes, length);
+        FlushFileBuffers(file);
+#else
+        msync(bytes, length, MS_SYNC);
+#endif
+    }
+
+    void run(unsigned flushMs)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        while (!stop)
+        {
+            if (flushMs) wake.wait_for(guard, std::chrono::milliseconds(flushMs), [this] { return stop; });
+            else wake.wait(guard, [this] { return stop; });
+            sync();
+        }
+    }
+
+    ~Flusher()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stop = true;
+        }
+        wake.notify_one();
+        thread.join();
+
+#ifdef _WIN32
+        UnmapViewOfFile(bytes);
+        CloseHandle(mapping);
+        CloseHandle(file);
+#else
+        munmap(bytes, length);
+#endif
+    }
+};
+
+CartRam::CartRam()
+{
+}
+
+CartRam::CartRam(const CartRam& other)
+{
+    *this = other;
+}
+
+CartRam& CartRam::operator=(const CartRam& other)
+{
+    if (this == &other) return *this;
+    release();
+    owned.assign(other.bytes, other.bytes + other.length);
+    bytes = owned.data();
+    length = owned.size();
+    return *this;
+}
+
+CartRam::~CartRam()
+{
+    release();
+}
+
+void CartRam::release()
+{
+    flusher.reset();
+    owned.clear();
+    bytes = nullptr;
+    length = 0;
+}
+
+void CartRam::reset(size_t size)
+{
+    release();
+    owned.assign(size, 0x00);
+    bytes = owned.data();
+    length = size;
+}
+
+// longer files are fine, some emulators put the clock after the ram
+bool CartRam::mapFile(const std::string& path, size_t size, unsigned flushMs)
+{
+    if (!size) return false;
+    uint8_t* p = nullptr;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        std::cerr << path << " couldnt be opened!" << "\n";
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+    if (fileSize.QuadPart != 0 && size_t(fileSize.QuadPart) < size)
+    {
+        CloseHandle(file);
+        std::cerr << path << " isnt a save for this cartridge\n";
+        return false;
+    }
+
+    // a mapping longer than the file grows it, with zeros
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, 0, DWORD(size), nullptr);
+    if (mapping) p = static_cast<uint8_t*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+    if (!p)
+    {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        std::cerr << path << " couldnt be mapped!" << "\n";
+        return false;
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        std::cerr << path << " couldnt be opened!" << "\n";
+        return false;
+    }
+    struct stat info;
+    size_t fileSize = fstat(fd, &info) == 0 ? size_t(info.st_size) : 0;
+    if (fileSize != 0 && fileSize < size)
+    {
+        close(fd);
+        std::cerr << path << " isnt a save for this cartridge\n";
+        return false;
+    }
+    if (fileSize == 0 && ftruncate(fd, off_t(size)) != 0)
+    {
+        close(fd);
+        std::cerr << path << " couldnt be written!" << "\n";
+        return false;
+    }
+
+    void* m = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED)
+    {
+        std::cerr << path << " couldnt be mapped!" << "\n";
+        return false;
+    }
+    p = static_cast<uint8_t*>(m);
+#endif
+
+    release();
+    bytes = p;
+    length = size;
+    flusher = std::make_unique<Flusher>();
+    flusher->bytes = p;
+    flusher->length = size;
+#ifdef _WIN32
+    flusher->file = file;
+    flusher->mapping = mapping;
+#endif
+    flusher->thread = std::thread(&Flusher::run, flusher.get(), flushMs);
+    return true;
+}
+
+
+bool GameBoy::loadROM(const std::string& filename)
+{
+    std::shared_ptr<const RomImage> rom = RomImage::open(filename);
+    if (!rom)
+    {
+        std::cerr << filename << " couldnt be opened!" << "\n";
+        return false;
+    }
+    loadROM(rom);
+    return true;
+}
+
+void GameBoy::loadROM(std::shared_ptr<const RomImage> rom)
+{
+    cart = Cartridge();
+    cart.rom = rom;
+    cart.romBanks = rom->banks();
+
+    const uint8_t type = rom->data()[0x0147];
+    switch (type)
+    {
+    case 0x00: case 0x08: cart.mbc = MBC_NONE; break;
+    case 0x09: cart.mbc = MBC_NONE; cart.hasBattery = true; break;
+    case 0x01: case 0x02: cart.mbc = MBC_1; break;
+    case 0x03: cart.mbc = MBC_1; cart.hasBattery = true; break;
+    case 0x0F: case 0x10: cart.mbc = MBC_3; cart.hasRtc = true; cart.hasBattery = true; break;
+    case 0x11: case 0x12: cart.mbc = MBC_3; break;
+    case 0x13: cart.mbc = MBC_3; cart.hasBattery = true; break;
+    case 0x19: case 0x1A: case 0x1C: case 0x1D: cart.mbc = MBC_5; break;
+    case 0x1B: case 0x1E: cart.mbc = MBC_5; cart.hasBattery = true; break;
+    default:
+        std::cerr << "unsupported cartridge type 0x" << std::hex << int(type) << std::dec << ", running it without a mapper\n";
+        break;
+    }
+
+    // 0x0149, 2KB carts still get a whole bank
+    static const uint8_t ramSizes[6] = { 0, 1, 1, 4, 16, 8 };
+    const uint8_t ramCode = rom->data()[0x0149];
+    cart.ramBanks = ramCode < 6 ? ramSizes[ramCode] : 0;
+    cart.ram.reset(cart.ramBanks * 0x2000);
+    cart.rtcCycles = sched.cycles;
+    // without a mapper there is no enable register, rom+ram carts just have their ram there
+    if (cart.mbc == MBC_NONE) cart.ramEnabled = cart.ramBanks != 0;
+
+    if (blocks) blocks->clear();
+    updateBanks();
+}
+
+// battery backed ram lives in the save file from here on, carts without a battery have nothing to keep
+bool GameBoy::loadBattery(const std::string& path, unsigned flushMs)
+{
+    if (!cart.hasBattery || cart.ram.empty()) return true;
+    if (!cart.ram.mapFile(path, cart.ram.size(), flushMs)) return false;
+    mapPages(); // ram pages point into the mapping now
+    return true;
+}
+
+
+// mbc3 ram bank numbers 0x08-0x0C select a clock register instead
+static bool rtcSelected(const Cartridge& cart)
+{
+    return cart.mbc == MBC_3 && cart.ramSelect >= 0x08;
+}
+
+// ram pages point into the current ram bank, disabled ram and rtc registers go the slow way
+void GameBoy::mapCartPage(uint8_t page)
+{
+    if (page < 0x80)
+    {
+        uint32_t bank = page < 0x40 ? cart.romBank0 : cart.romBank;
+        readPage[page] = cart.rom->data() + bank * 0x4000 + (page & 0x3F) * 0x100;
+        writePage[page] = nullptr; // mbc registers
+        return;
+    }
+
+    uint8_t* data = nullptr;
+    if (cart.ramEnabled && cart.ramBanks && !rtcSelected(cart))
+        data = &cart.ram[cart.ramBank * 0x2000 + (page - 0xA0) * 0x100];
+
+    readPage[page] = data;
+    writePage[page] = (data && !(blocks && blocks->pageHasCode(page))) ? data : nullptr;
+}
+
+// bank switches only repoint the rom and ram windows, nothing is copied
+void GameBoy::updateBanks()
+{
+    const uint16_t banks = cart.romBanks;
+    switch (cart.mbc)
+    {
+    case MBC_NONE:
+        cart.romBank = 1;
+        cart.romBank0 = 0;
+        cart.ramBank = 0;
+        break;
+    case MBC_1:
+        cart.romBank = ((cart.bankHigh << 5) | cart.bankLow) % banks;
+        cart.romBank0 = cart.mode ? (cart.bankHigh << 5) % banks : 0;
+        cart.ramBank = cart.mode ? cart.bankHigh : 0;
+        break;
+    case MBC_3:
+        cart.romBank = cart.bankLow % banks;
+        cart.romBank0 = 0;
+        cart.ramBank = cart.ramSelect & 0x03;
+        break;
+    case MBC_5:
+        cart.romBank = ((cart.bankHigh << 8) | cart.bankLow) % banks;
+        cart.romBank0 = 0;
+        cart.ramBank = cart.ramSelect;
+        break;
+    }
+    if (cart.ramBanks) cart.ramBank %= cart.ramBanks;
+
+    for (int page = 0x00; page < 0x80; ++page)
+        mapCartPage(page);
+    for (int page = 0xA0; page < 0xC0; ++page)
+        mapCartPage(page);
+}
+
+void GameBoy::writeMBC(uint16_t addr, uint8_t value)
+{
+    if (cart.mbc == MBC_NONE) return;
+
+    // the block running now may have been decoded from the bank being switched out
+    blockBreak = true;
+
+    if (addr < 0x2000)
+    {
+        cart.ramEnabled = (value & 0x0F) == 0x0A;
+    }
+    else if (addr < 0x4000)
+    {
+        switch (cart.mbc)
+        {
+        case MBC_1: cart.bankLow = (value & 0x1F) ? (value & 0x1F) : 1; break;
+        case MBC_3: cart.bankLow = (value & 0x7F) ? (value & 0x7F) : 1; break;
+        case MBC_5:
+            if (addr < 0x3000) cart.bankLow = value;
+            else cart.bankHigh = value & 0x01;
+            break;
+        default: return;
+        }
+    }
+    else if (addr < 0x6000)
+    {
+        switch (cart.mbc)
+        {
+        case MBC_1: cart.bankHigh = value & 0x03; break;
+        case MBC_3: cart.ramSelect = value & 0x0F; break;
+        case MBC_5: cart.ramSelect = value & 0x0F; break;
+        default: return;
+        }
+    }
+    else
+    {
+        if (cart.mbc == MBC_1) cart.mode = value & 0x01;
+        if (cart.mbc == MBC_3 && cart.hasRtc)
+        {
+            // writing 0 then 1 copies the running clock into the readable registers
+            if (cart.latchWrite == 0x00 && value == 0x01)
+            {
+                tickRTC();
+                std::memcpy(cart.rtcLatched, cart.rtc, sizeof(cart.rtc));
+            }
+            cart.latchWrite = value;
+        }
+    }
+
+    updateBanks();
+}
+
+uint8_t GameBoy::readCartRAM(uint16_t addr) const
+{
+    if (!cart.ramEnabled) return 0xFF;
+    if (rtcSelected(cart))
+        return (cart.hasRtc && cart.ramSelect <= 0x0C) ? cart.rtcLatched[cart.ramSelect - 0x08] : 0xFF;
+    if (!cart.ramBanks) return 0xFF;
+    return cart.ram[cart.ramBank * 0x2000 + (addr - 0xA000)];
+}
+
+void GameBoy::writeCartRAM(uint16_t addr, uint8_t value)
+{
+    if (!cart.ramEnabled) return;
+    if (rtcSelected(cart))
+    {
+        if (cart.hasRtc && cart.ramSelect <= 0x0C) writeRTC(cart.ramSelect - 0x08, value);
+        return;
+    }
+    if (!cart.ramBanks) return;
+    cart.ram[cart.ramBank * 0x2000 + (addr - 0xA000)] = value;
+}
+
+
+// the clock runs off emulated time so runs stay deterministic
+void GameBoy::tickRTC()
+{
+    uint64_t seconds = (sched.cycles - cart.rtcCycles) / CLOCK_HZ;
+    cart.rtcCycles += seconds * CLOCK_HZ;
+    if (!seconds || (cart.rtc[4] & 0x40)) return; // halted
+
+    uint16_t days = cart.rtc[3] | ((cart.rtc[4] & 0x01) << 8);
+    uint64_t total = cart.rtc[0] + cart.rtc[1] * 60ull + cart.rtc[2] * 3600ull + days * 86400ull + seconds;
+
+    cart.rtc[0] = total % 60;
+    cart.rtc[1] = (total / 60) % 60;
+    cart.rtc[2] = (total / 3600) % 24;
+    uint64_t allDays = total / 86400;
+    if (allDays > 511) cart.rtc[4] |= 0x80; // day counter carry, sticks until written
+    cart.rtc[3] = allDays & 0xFF;
+    cart.rtc[4] = (cart.rtc[4] & 0xFE) | ((allDays >> 8) & 0x01);
+}
+
+void GameBoy::writeRTC(uint8_t reg, uint8_t value)
+{
+    static const uint8_t masks[5] = { 0x3F, 0x3F, 0x1F, 0xFF, 0xC1 };
+    tickRTC();
+    if (reg == 0) cart.rtcCycles = sched.cycles; // writing seconds restarts the current second
+    cart.rtc[reg] = value & masks[reg];
+}
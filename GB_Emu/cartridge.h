@@ -0,0 +1,109 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+// read only view of a rom file
+// opening a path that is already open hands back the same mapping, so every
+// instance running one game shares a single physical copy
+class RomImage
+{
+public:
+    static std::shared_ptr<const RomImage> open(const std::string& path);
+    static std::shared_ptr<const RomImage> fromMemory(const uint8_t* data, size_t size);
+    ~RomImage();
+
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+    uint16_t banks() const { return uint16_t(length / 0x4000); } // 16KB each
+
+private:
+    RomImage() = default;
+    bool load(const std::string& path);
+
+    const uint8_t* bytes = nullptr;
+    size_t length = 0;
+    bool mapped = false;
+    std::vector<uint8_t> copy; // files that arent whole banks get padded out in memory instead
+#ifdef _WIN32
+    void* mapping = nullptr;
+#endif
+};
+
+
+// external ram on the cartridge, plain memory or a save file mapped straight in
+// battery saves are written back by a background thread, the emulation thread only ever
+// stores to memory. copies are always plain memory so a clone never writes someone's save
+class CartRam
+{
+public:
+    static constexpr unsigned DEFAULT_FLUSH_MS = 1000;
+
+    CartRam();
+    CartRam(const CartRam& other);
+    CartRam& operator=(const CartRam& other);
+    ~CartRam(); // writes a mapped save back one last time
+
+    void reset(size_t size); // plain memory, zeroed
+    // size bytes of path, created if it isnt there, flushed every flushMs (0 = only at the end)
+    bool mapFile(const std::string& path, size_t size, unsigned flushMs = DEFAULT_FLUSH_MS);
+    bool mapped() const { return flusher != nullptr; }
+
+    uint8_t* data() { return bytes; }
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    uint8_t& operator[](size_t i) { return bytes[i]; }
+    uint8_t operator[](size_t i) const { return bytes[i]; }
+
+private:
+    void release();
+
+    uint8_t* bytes = nullptr;
+    size_t length = 0;
+    std::vector<uint8_t> owned;
+
+    struct Flusher;
+    std::unique_ptr<Flusher> flusher; // set while a file is mapped
+};
+
+
+enum MbcType : uint8_t
+{
+    MBC_NONE,
+    MBC_1,
+    MBC_3,
+    MBC_5,
+};
+
+// cartridge header byte 0x0147 and the bank registers behind 0x0000-0x7FFF
+struct Cartridge
+{
+    std::shared_ptr<const RomImage> rom; // null = flat memory, like the built in test program
+    MbcType mbc = MBC_NONE;
+    bool hasRtc = false;
+    bool hasBattery = false;   // ram keeps its contents with the power off
+    uint16_t romBanks = 2;
+    uint8_t ramBanks = 0;      // 8KB each
+    CartRam ram;
+
+    bool ramEnabled = false;
+    uint8_t bankLow = 1;       // mbc1 5 bits, mbc3 7 bits, mbc5 low 8 bits of the rom bank
+    uint8_t bankHigh = 0;      // mbc1 2 bits, mbc5 rom bank bit 8
+    uint8_t ramSelect = 0;     // mbc3/mbc5 ram bank, on mbc3 0x08-0x0C pick an rtc register instead
+    uint8_t mode = 0;          // mbc1 banking mode
+
+    // worked out from the registers above whenever one is written
+    uint16_t romBank = 1;      // mapped at 0x4000
+    uint16_t romBank0 = 0;     // mapped at 0x0000, only mbc1 mode 1 moves it
+    uint8_t ramBank = 0;
+
+    // mbc3 clock: seconds, minutes, hours, day low, day high | halt | day carry
+    uint8_t rtc[5] = {};
+    uint8_t rtcLatched[5] = {};
+    uint8_t latchWrite = 0xFF;
+    uint64_t rtcCycles = 0;    // master clock at the last second folded into rtc
+};
@@ -1,29 +1,11 @@
-#include "cpu.h"
-#include "memory.h"
+#include "gameboy.h"
+#include "opcodes.h"
+#include <algorithm>
 #include <iostream>
-#include <cstdlib>
+#include <utility>
 
 
-Registers regs;
-
-
-void printCPUState()
-{
-    std::cout << "PC: 0x" << std::hex << regs.PC
-        << " | A: 0x" << (int)regs.A
-        << " | B: 0x" << (int)regs.B
-        << " | C: 0x" << (int)regs.C
-        << " | D: 0x" << (int)regs.D
-        << " | E: 0x" << (int)regs.E
-        << " | H: 0x" << (int)regs.H
-        << " | L: 0x" << (int)regs.L
-        << " | F: 0x" << (int)regs.F
-        << "\n";
-}
-
-
-
-void bootSetup()
+void GameBoy::bootSetup()
 {
     regs.A = 0x01;
     regs.F = 0xB0; // z=1, n=0, h=1, c=1
@@ -38,553 +20,963 @@ void bootSetup()
     regs.SP = 0xFFFE;
 }
 
-bool getFlagZero() { return regs.F & 0x80; }
-bool getFlagSub() { return regs.F & 0x40; }
-bool getFlagHalfCarry() { return regs.F & 0x20; }
-bool getFlagCarry() { return regs.F & 0x10; }
+#if GB_LAZY_FLAGS
 
-void setFlagZero(bool c) { regs.F = (regs.F & ~0x80) | (c ? 0x80 : 0x00); }
-void setFlagSub(bool c) { regs.F = (regs.F & ~0x40) | (c ? 0x40 : 0x00); }
-void setFlagHalfCarry(bool c) { regs.F = (regs.F & ~0x20) | (c ? 0x20 : 0x00); }
-void setFlagCarry(bool c) { regs.F = (regs.F & ~0x10) | (c ? 0x10 : 0x00); }
+uint8_t GameBoy::flags() const
+{
+    const uint8_t z = lazy.result == 0 ? 0x80 : 0x00;
+    switch (lazy.op)
+    {
+    case LAZY_ADD:
+        return z | (((lazy.a & 0xF) + (lazy.b & 0xF) + lazy.carry) > 0xF ? 0x20 : 0x00)
+            | ((lazy.a + lazy.b + lazy.carry) > 0xFF ? 0x10 : 0x00);
+    case LAZY_SUB:
+        return z | 0x40 | ((lazy.a & 0xF) < ((lazy.b & 0xF) + lazy.carry) ? 0x20 : 0x00)
+            | (lazy.a < lazy.b + lazy.carry ? 0x10 : 0x00);
+    case LAZY_AND: return z | 0x20;
+    case LAZY_OR: return z;
+    case LAZY_INC: return z | (regs.F & 0x10) | ((lazy.a & 0xF) == 0xF ? 0x20 : 0x00);
+    case LAZY_DEC: return z | 0x40 | (regs.F & 0x10) | ((lazy.a & 0xF) == 0 ? 0x20 : 0x00);
+    default: return regs.F;
+    }
+}
 
+// jr z/nz and jr c/nc are most of the reads, those two skip building the whole of F
+bool GameBoy::getFlagZero() { return lazy.op ? lazy.result == 0 : (regs.F & 0x80); }
+bool GameBoy::getFlagSub() { return flags() & 0x40; }
+bool GameBoy::getFlagHalfCarry() { return flags() & 0x20; }
 
-uint8_t inc8(uint8_t x)
+bool GameBoy::getFlagCarry()
 {
+    switch (lazy.op)
+    {
+    case LAZY_ADD: return lazy.a + lazy.b + lazy.carry > 0xFF;
+    case LAZY_SUB: return lazy.a < lazy.b + lazy.carry;
+    case LAZY_AND: case LAZY_OR: return false;
+    default: return regs.F & 0x10;
+    }
+}
+
+void GameBoy::setFlagZero(bool c) { syncFlags(); regs.F = (regs.F & ~0x80) | (c ? 0x80 : 0x00); }
+void GameBoy::setFlagSub(bool c) { syncFlags(); regs.F = (regs.F & ~0x40) | (c ? 0x40 : 0x00); }
+void GameBoy::setFlagHalfCarry(bool c) { syncFlags(); regs.F = (regs.F & ~0x20) | (c ? 0x20 : 0x00); }
+void GameBoy::setFlagCarry(bool c) { syncFlags(); regs.F = (regs.F & ~0x10) | (c ? 0x10 : 0x00); }
+
+#else
+
+uint8_t GameBoy::flags() const { return regs.F; }
+
+bool GameBoy::getFlagZero() { return regs.F & 0x80; }
+bool GameBoy::getFlagSub() { return regs.F & 0x40; }
+bool GameBoy::getFlagHalfCarry() { return regs.F & 0x20; }
+bool GameBoy::getFlagCarry() { return regs.F & 0x10; }
+
+void GameBoy::setFlagZero(bool c) { regs.F = (regs.F & ~0x80) | (c ? 0x80 : 0x00); }
+void GameBoy::setFlagSub(bool c) { regs.F = (regs.F & ~0x40) | (c ? 0x40 : 0x00); }
+void GameBoy::setFlagHalfCarry(bool c) { regs.F = (regs.F & ~0x20) | (c ? 0x20 : 0x00); }
+void GameBoy::setFlagCarry(bool c) { regs.F = (regs.F & ~0x10) | (c ? 0x10 : 0x00); }
+
+#endif
+
+
+uint8_t GameBoy::inc8(uint8_t x)
+{
+#if GB_LAZY_FLAGS
+    regs.F = getFlagCarry() ? 0x10 : 0x00;
+    lazy = { LAZY_INC, x, 0, 0, uint8_t(x + 1) };
+    return x + 1;
+#else
     setFlagHalfCarry(((x & 0x0F) + 1) > 0x0F);
     x++;
     setFlagZero(x == 0);
     setFlagSub(false);
     return x;
+#endif
 }
 
-uint8_t dec8(uint8_t x)
+uint8_t GameBoy::dec8(uint8_t x)
 {
+#if GB_LAZY_FLAGS
+    regs.F = getFlagCarry() ? 0x10 : 0x00;
+    lazy = { LAZY_DEC, x, 0, 0, uint8_t(x - 1) };
+    return x - 1;
+#else
     setFlagHalfCarry((x & 0x0F) == 0);
     x--;
     setFlagZero(x == 0x00);
     setFlagSub(true);
     return x;
+#endif
 }
 
 
-void pushStack(uint8_t hi, uint8_t lo)
+void GameBoy::pushStack(uint8_t hi, uint8_t lo)
 {
     regs.SP -= 1;
-    memory[regs.SP] = hi;
+    write8(regs.SP, hi);
     regs.SP -= 1;
-    memory[regs.SP] = lo;
+    write8(regs.SP, lo);
     return;
 }
 
-void popStack(uint8_t &hi, uint8_t &lo)
+void GameBoy::popStack(uint8_t &hi, uint8_t &lo)
 {
-    hi = memory[regs.SP++];
-    lo = memory[regs.SP++];
+    lo = read8(regs.SP++);
+    hi = read8(regs.SP++);
 }
 
 
-uint8_t add8(uint8_t a, uint8_t b)
+uint8_t GameBoy::add8(uint8_t a, uint8_t b)
 {
     uint16_t sum = a + b;
+#if GB_LAZY_FLAGS
+    lazy = { LAZY_ADD, a, b, 0, uint8_t(sum) };
+#else
     regs.F = 0x00;
 
     setFlagZero((sum & 0xFF) == 0);
     setFlagSub(false);
     setFlagHalfCarry(((a & 0xF) + (b & 0xF)) > 0xF);
     setFlagCarry(sum > 0xFF);
+#endif
 
     return static_cast<uint8_t>(sum);
 }
 
-uint8_t sub8(uint8_t a, uint8_t b)
+uint8_t GameBoy::sub8(uint8_t a, uint8_t b)
 {
     uint8_t sum = a - b;
+#if GB_LAZY_FLAGS
+    lazy = { LAZY_SUB, a, b, 0, sum };
+#else
     regs.F = 0x00;
 
     setFlagZero(sum == 0);
     setFlagSub(true);
     setFlagHalfCarry((a & 0xF) < (b & 0xF));
     setFlagCarry(a < b);
+#endif
 
     return sum;
 }
 
-uint8_t adc8(uint8_t a, uint8_t b)
+uint8_t GameBoy::adc8(uint8_t a, uint8_t b)
 {
-    uint8_t carry = getFlagCarry() ? 0 : 1;
-    uint8_t sum = a + b + carry;
+    uint8_t carry = getFlagCarry() ? 1 : 0;
+    uint16_t sum = a + b + carry;
+#if GB_LAZY_FLAGS
+    lazy = { LAZY_ADD, a, b, carry, uint8_t(sum) };
+#else
     regs.F = 0x00;
 
     setFlagZero((sum & 0xFF) == 0);
     setFlagSub(false);
     setFlagHalfCarry(((a & 0xF) + (b & 0xF) + carry) > 0xF);
     setFlagCarry(sum > 0xFF);
+#endif
 
-    return sum;
+    return static_cast<uint8_t>(sum);
 }
 
-uint8_t and8(uint8_t a, uint8_t b)
+uint8_t GameBoy::and8(uint8_t a, uint8_t b)
 {
     uint8_t result = a & b;
+#if GB_LAZY_FLAGS
+    lazy = { LAZY_AND, a, b, 0, result };
+#else
     regs.F = 0;
 
     setFlagZero(result == 0);
     setFlagSub(false);
     setFlagHalfCarry(true);
     setFlagCarry(false);
+#endif
 
     return result;
 }
 
-uint8_t or8(uint8_t a, uint8_t b)
+uint8_t GameBoy::or8(uint8_t a, uint8_t b)
 {
     uint8_t result = a | b;
+#if GB_LAZY_FLAGS
+    lazy = { LAZY_OR, a, b, 0, result };
+#else
     regs.F = 0;
 
     setFlagZero(result == 0);
     setFlagSub(false);
     setFlagHalfCarry(false);
     setFlagCarry(false);
+#endif
 
     return result;
 }
 
-uint8_t xor8(uint8_t a, uint8_t b)
+uint8_t GameBoy::xor8(uint8_t a, uint8_t b)
 {
     uint8_t result = a ^ b;
+#if GB_LAZY_FLAGS
+    lazy = { LAZY_OR, a, b, 0, result };
+#else
     regs.F = 0;
 
     setFlagZero(result == 0);
     setFlagSub(false);
     setFlagHalfCarry(false);
     setFlagCarry(false);
+#endif
 
     return result;
 }
 
-void cp8(uint8_t a, uint8_t b)
+void GameBoy::cp8(uint8_t a, uint8_t b)
 {
+#if GB_LAZY_FLAGS
+    lazy = { LAZY_SUB, a, b, 0, uint8_t(a - b) };
+#else
     regs.F = 0;
 
     setFlagZero(a - b == 0);
     setFlagSub(true);
     setFlagHalfCarry((a & 0xF) < (b & 0xF));
     setFlagCarry(a < b);
-
-    return;
+#endif
 }
 
-uint8_t sbc8(uint8_t a, uint8_t b)
+uint8_t GameBoy::sbc8(uint8_t a, uint8_t b)
 {
     uint8_t carry = getFlagCarry();
     uint8_t result = a - b - carry;
+#if GB_LAZY_FLAGS
+    lazy = { LAZY_SUB, a, b, carry, result };
+#else
     regs.F = 0;
 
     setFlagZero(result == 0);
     setFlagSub(true);
     setFlagHalfCarry((a & 0xF) < ((b & 0xF) + carry));
     setFlagCarry(a < b + carry);
+#endif
+
+    return result;
+}
+
+
+// cb page rotates and shifts, the A only versions clear Z afterwards
+uint8_t GameBoy::rlc8(uint8_t x)
+{
+    uint8_t result = static_cast<uint8_t>((x << 1) | (x >> 7));
+    setFlags(0);
+    setFlagZero(result == 0);
+    setFlagCarry(x & 0x80);
+    return result;
+}
+
+uint8_t GameBoy::rrc8(uint8_t x)
+{
+    uint8_t result = static_cast<uint8_t>((x >> 1) | (x << 7));
+    setFlags(0);
+    setFlagZero(result == 0);
+    setFlagCarry(x & 0x01);
+    return result;
+}
+
+uint8_t GameBoy::rl8(uint8_t x)
+{
+    uint8_t result = static_cast<uint8_t>((x << 1) | (getFlagCarry() ? 1 : 0));
+    setFlags(0);
+    setFlagZero(result == 0);
+    setFlagCarry(x & 0x80);
+    return result;
+}
+
+uint8_t GameBoy::rr8(uint8_t x)
+{
+    uint8_t result = static_cast<uint8_t>((x >> 1) | (getFlagCarry() ? 0x80 : 0));
+    setFlags(0);
+    setFlagZero(result == 0);
+    setFlagCarry(x & 0x01);
+    return result;
+}
 
+uint8_t GameBoy::sla8(uint8_t x)
+{
+    uint8_t result = static_cast<uint8_t>(x << 1);
+    setFlags(0);
+    setFlagZero(result == 0);
+    setFlagCarry(x & 0x80);
     return result;
 }
 
+uint8_t GameBoy::sra8(uint8_t x)
+{
+    uint8_t result = static_cast<uint8_t>((x >> 1) | (x & 0x80));
+    setFlags(0);
+    setFlagZero(result == 0);
+    setFlagCarry(x & 0x01);
+    return result;
+}
+
+uint8_t GameBoy::swap8(uint8_t x)
+{
+    uint8_t result = static_cast<uint8_t>((x << 4) | (x >> 4));
+    setFlags(0);
+    setFlagZero(result == 0);
+    return result;
+}
 
-void error(uint8_t opcode)
+uint8_t GameBoy::srl8(uint8_t x)
+{
+    uint8_t result = x >> 1;
+    setFlags(0);
+    setFlagZero(result == 0);
+    setFlagCarry(x & 0x01);
+    return result;
+}
+
+void GameBoy::bit8(uint8_t bit, uint8_t x)
+{
+    setFlagZero(!(x & (1 << bit)));
+    setFlagSub(false);
+    setFlagHalfCarry(true);
+}
+
+// add hl, rr leaves Z alone, H and C come from bits 11 and 15
+uint16_t GameBoy::add16(uint16_t a, uint16_t b)
+{
+    uint32_t sum = a + b;
+
+    setFlagSub(false);
+    setFlagHalfCarry(((a & 0x0FFF) + (b & 0x0FFF)) > 0x0FFF);
+    setFlagCarry(sum > 0xFFFF);
+
+    return static_cast<uint16_t>(sum);
+}
+
+// add sp, e and ld hl, sp+e take H and C from the low byte
+uint16_t GameBoy::addSP(uint8_t e)
+{
+    uint16_t result = static_cast<uint16_t>(regs.SP + static_cast<int8_t>(e));
+    setFlags(0);
+
+    setFlagHalfCarry(((regs.SP & 0x0F) + (e & 0x0F)) > 0x0F);
+    setFlagCarry(((regs.SP & 0xFF) + e) > 0xFF);
+
+    return result;
+}
+
+void GameBoy::daa()
+{
+    uint8_t a = regs.A;
+    uint8_t adjust = 0;
+    bool carry = getFlagCarry();
+
+    if (getFlagHalfCarry() || (!getFlagSub() && (a & 0x0F) > 0x09)) adjust |= 0x06;
+    if (carry || (!getFlagSub() && a > 0x99))
+    {
+        adjust |= 0x60;
+        carry = true;
+    }
+
+    regs.A = getFlagSub() ? a - adjust : a + adjust;
+    setFlagZero(regs.A == 0);
+    setFlagHalfCarry(false);
+    setFlagCarry(carry);
+}
+
+
+// jumps to the highest priority pending interrupt, 5 m-cycles
+bool GameBoy::serviceInterrupts()
+{
+    const uint8_t pending = irqPending;
+    if (!ime || !pending) return false;
+
+    uint8_t index = 0;
+    while (!(pending & (1 << index))) index++;
+
+    ime = false;
+    halted = false;
+    memory[0xFF0F] &= ~(1 << index);
+    updateInterrupts();
+    pushStack(regs.PC >> 8, regs.PC & 0xFF);
+    regs.PC = 0x40 + index * 8;
+    sched.cycles += 20;
+    return true;
+}
+
+
+void GameBoy::error(uint8_t opcode)
 {
     std::cerr << "invalid opcode: 0x" << std::hex << (int)opcode << "\n";
-    std::exit(1);
+    crashed = true; // dont take the other instances down with us
 }
 
 
-void emulateCycle() {
-    uint8_t opcode = memory[regs.PC++];
 
-    std::cout << "Executing opcode 0x" << std::hex << (int)opcode << " at PC=0x" << regs.PC << "\n";
-    void printCPUState();
 
-    switch (opcode) {
+// opcode handlers, one template per instruction family
+// R is the 3 bit register field (b c d e h l (hl) a), P the 2 bit pair field,
+// CC the condition (nz z nc c) and ALU the 3 bit operation (add adc sub sbc and xor or cp)
+struct Ops
+{
+    template<int R> static uint8_t getR(GameBoy& gb)
+    {
+        Registers& r = gb.regs;
+        if constexpr (R == 0) return r.B;
+        else if constexpr (R == 1) return r.C;
+        else if constexpr (R == 2) return r.D;
+        else if constexpr (R == 3) return r.E;
+        else if constexpr (R == 4) return r.H;
+        else if constexpr (R == 5) return r.L;
+        else if constexpr (R == 6) return gb.read8(r.HL());
+        else return r.A;
+    }
+
+    template<int R> static void setR(GameBoy& gb, uint8_t value)
+    {
+        Registers& r = gb.regs;
+        if constexpr (R == 0) r.B = value;
+        else if constexpr (R == 1) r.C = value;
+        else if constexpr (R == 2) r.D = value;
+        else if constexpr (R == 3) r.E = value;
+        else if constexpr (R == 4) r.H = value;
+        else if constexpr (R == 5) r.L = value;
+        else if constexpr (R == 6) gb.write8(r.HL(), value);
+        else r.A = value;
+    }
 
-    case 0x00: break; // nop
+    // bc de hl sp
+    template<int P> static uint16_t getRP(GameBoy& gb)
+    {
+        if constexpr (P == 0) return gb.regs.BC();
+        else if constexpr (P == 1) return gb.regs.DE();
+        else if constexpr (P == 2) return gb.regs.HL();
+        else return gb.regs.SP;
+    }
 
+    template<int P> static void setRP(GameBoy& gb, uint16_t value)
+    {
+        if constexpr (P == 0) gb.regs.setBC(value);
+        else if constexpr (P == 1) gb.regs.setDE(value);
+        else if constexpr (P == 2) gb.regs.setHL(value);
+        else gb.regs.SP = value;
+    }
 
-            // byte increments / decrements
-    case 0x3C: regs.A = inc8(regs.A); break; // inc a
-    case 0x3D: regs.A = dec8(regs.A); break; // dec a
-    case 0x04: regs.B = inc8(regs.B); break; // inc b
-    case 0x05: regs.B = dec8(regs.B); break; // dec b
-    case 0x0C: regs.C = inc8(regs.C); break; // inc c
-    case 0x0D: regs.C = dec8(regs.C); break; // dec c
-    case 0x14: regs.D = inc8(regs.D); break; // inc d
-    case 0x15: regs.D = dec8(regs.D); break; // dec d
-    case 0x1C: regs.E = inc8(regs.E); break; // inc e
-    case 0x1D: regs.E = dec8(regs.E); break; // dec e
-    case 0x24: regs.H = inc8(regs.H); break; // inc h
-    case 0x25: regs.H = dec8(regs.H); break; // dec h
-    case 0x2C: regs.L = inc8(regs.L); break; // inc l
-    case 0x2D: regs.L = dec8(regs.L); break; // dec l
+    template<int CC> static bool cond(GameBoy& gb)
+    {
+        if constexpr (CC == 0) return !gb.getFlagZero();
+        else if constexpr (CC == 1) return gb.getFlagZero();
+        else if constexpr (CC == 2) return !gb.getFlagCarry();
+        else return gb.getFlagCarry();
+    }
 
+    template<int ALU> static void alu(GameBoy& gb, uint8_t value)
+    {
+        Registers& r = gb.regs;
+        if constexpr (ALU == 0) r.A = gb.add8(r.A, value);
+        else if constexpr (ALU == 1) r.A = gb.adc8(r.A, value);
+        else if constexpr (ALU == 2) r.A = gb.sub8(r.A, value);
+        else if constexpr (ALU == 3) r.A = gb.sbc8(r.A, value);
+        else if constexpr (ALU == 4) r.A = gb.and8(r.A, value);
+        else if constexpr (ALU == 5) r.A = gb.xor8(r.A, value);
+        else if constexpr (ALU == 6) r.A = gb.or8(r.A, value);
+        else gb.cp8(r.A, value);
+    }
 
+    // rlc rrc rl rr sla sra swap srl
+    template<int K> static uint8_t shift(GameBoy& gb, uint8_t value)
+    {
+        if constexpr (K == 0) return gb.rlc8(value);
+        else if constexpr (K == 1) return gb.rrc8(value);
+        else if constexpr (K == 2) return gb.rl8(value);
+        else if constexpr (K == 3) return gb.rr8(value);
+        else if constexpr (K == 4) return gb.sla8(value);
+        else if constexpr (K == 5) return gb.sra8(value);
+        else if constexpr (K == 6) return gb.swap8(value);
+        else return gb.srl8(value);
+    }
 
+    static void push16(GameBoy& gb, uint16_t value) { gb.pushStack(value >> 8, value & 0xFF); }
 
-            // 16 bit increments
-    case 0x03: // inc bc
+    static uint16_t pop16(GameBoy& gb)
     {
-        uint16_t x = regs.BC();
-        regs.setBC(++x);
-        break;
+        uint8_t hi, lo;
+        gb.popStack(hi, lo);
+        return (hi << 8) | lo;
     }
-    case 0x13: // inc de
+
+
+    static void nop(GameBoy&, uint16_t) {}
+    template<uint8_t OP> static void invalid(GameBoy& gb, uint16_t) { gb.error(OP); }
+
+    // 8 bit loads
+    template<int D, int S> static void ldRR(GameBoy& gb, uint16_t) { setR<D>(gb, getR<S>(gb)); }
+    template<int R> static void ldRN(GameBoy& gb, uint16_t n) { setR<R>(gb, static_cast<uint8_t>(n)); }
+
+    // ld (bc), a / ld (de), a / ld (hl+), a / ld (hl-), a and the matching loads into a
+    template<int P, bool TO_A> static void ldIndirect(GameBoy& gb, uint16_t)
     {
-        uint16_t x = regs.DE();
-        regs.setDE(++x);
-        break;
+        Registers& r = gb.regs;
+        uint16_t addr = P == 0 ? r.BC() : P == 1 ? r.DE() : r.HL();
+
+        if constexpr (TO_A) r.A = gb.read8(addr);
+        else gb.write8(addr, r.A);
+
+        if constexpr (P == 2) r.setHL(addr + 1);
+        if constexpr (P == 3) r.setHL(addr - 1);
     }
-    case 0x23: // inc hl
+
+    static void ldNNA(GameBoy& gb, uint16_t nn) { gb.write8(nn, gb.regs.A); }
+    static void ldANN(GameBoy& gb, uint16_t nn) { gb.regs.A = gb.read8(nn); }
+    static void ldhNA(GameBoy& gb, uint16_t n) { gb.write8(0xFF00 + (n & 0xFF), gb.regs.A); }
+    static void ldhAN(GameBoy& gb, uint16_t n) { gb.regs.A = gb.read8(0xFF00 + (n & 0xFF)); }
+    static void ldhCA(GameBoy& gb, uint16_t) { gb.write8(0xFF00 + gb.regs.C, gb.regs.A); }
+    static void ldhAC(GameBoy& gb, uint16_t) { gb.regs.A = gb.read8(0xFF00 + gb.regs.C); }
+
+    // 16 bit loads and arithmetic
+    template<int P> static void ldRPNN(GameBoy& gb, uint16_t nn) { setRP<P>(gb, nn); }
+    template<int P> static void incRP(GameBoy& gb, uint16_t) { setRP<P>(gb, getRP<P>(gb) + 1); }
+    template<int P> static void decRP(GameBoy& gb, uint16_t) { setRP<P>(gb, getRP<P>(gb) - 1); }
+    template<int P> static void addHL(GameBoy& gb, uint16_t) { gb.regs.setHL(gb.add16(gb.regs.HL(), getRP<P>(gb))); }
+
+    static void ldNNSP(GameBoy& gb, uint16_t nn)
     {
-        uint16_t x = regs.HL();
-        regs.setHL(++x);
-        break;
+        gb.write8(nn, gb.regs.SP & 0xFF);
+        gb.write8(nn + 1, gb.regs.SP >> 8);
     }
-    case 0x33: { regs.SP++; break; } // inc sp
+    static void ldSPHL(GameBoy& gb, uint16_t) { gb.regs.SP = gb.regs.HL(); }
+    static void addSPE(GameBoy& gb, uint16_t e) { gb.regs.SP = gb.addSP(static_cast<uint8_t>(e)); }
+    static void ldHLSPE(GameBoy& gb, uint16_t e) { gb.regs.setHL(gb.addSP(static_cast<uint8_t>(e))); }
 
+    // push / pop use bc de hl af
+    template<int P> static void push(GameBoy& gb, uint16_t)
+    {
+        if constexpr (P == 3) push16(gb, (gb.regs.A << 8) | gb.flags());
+        else push16(gb, getRP<P>(gb));
+    }
+
+    template<int P> static void pop(GameBoy& gb, uint16_t)
+    {
+        uint16_t value = pop16(gb);
+        if constexpr (P == 3)
+        {
+            gb.regs.A = value >> 8;
+            gb.setFlags(value & 0xF0); // the low nibble of F is always 0
+        }
+        else setRP<P>(gb, value);
+    }
+
+    // 8 bit arithmetic
+    template<int R> static void inc(GameBoy& gb, uint16_t) { setR<R>(gb, gb.inc8(getR<R>(gb))); }
+    template<int R> static void dec(GameBoy& gb, uint16_t) { setR<R>(gb, gb.dec8(getR<R>(gb))); }
+    template<int ALU, int R> static void aluR(GameBoy& gb, uint16_t) { alu<ALU>(gb, getR<R>(gb)); }
+    template<int ALU> static void aluN(GameBoy& gb, uint16_t n) { alu<ALU>(gb, static_cast<uint8_t>(n)); }
+
+    // rlca rrca rla rra are the cb shifts on A with Z forced clear
+    template<int K> static void rotateA(GameBoy& gb, uint16_t)
+    {
+        gb.regs.A = shift<K>(gb, gb.regs.A);
+        gb.setFlagZero(false);
+    }
+
+    static void daa(GameBoy& gb, uint16_t) { gb.daa(); }
 
-             // 16 bit decrements
-    case 0x0B: // dec bc
+    static void cpl(GameBoy& gb, uint16_t)
     {
-        uint16_t x = regs.BC();
-        regs.setBC(--x);
-        break;
+        gb.regs.A = ~gb.regs.A;
+        gb.setFlagSub(true);
+        gb.setFlagHalfCarry(true);
     }
-    case 0x1B: // dec de
+
+    static void scf(GameBoy& gb, uint16_t)
     {
-        uint16_t x = regs.DE();
-        regs.setDE(--x);
-        break;
+        gb.setFlagSub(false);
+        gb.setFlagHalfCarry(false);
+        gb.setFlagCarry(true);
     }
-    case 0x2B: // dec hl
+
+    static void ccf(GameBoy& gb, uint16_t)
     {
-        uint16_t x = regs.HL();
-        regs.setHL(--x);
-        break;
+        gb.setFlagSub(false);
+        gb.setFlagHalfCarry(false);
+        gb.setFlagCarry(!gb.getFlagCarry());
     }
-    case 0x3B: { regs.SP--; break; } // dec sp
 
+    // jumps, calls and returns, taken branches pay their extra cycles here
+    static void jr(GameBoy& gb, uint16_t e) { gb.regs.PC += static_cast<int8_t>(e); }
+    static void jp(GameBoy& gb, uint16_t nn) { gb.regs.PC = nn; }
+    static void jpHL(GameBoy& gb, uint16_t) { gb.regs.PC = gb.regs.HL(); }
 
+    static void call(GameBoy& gb, uint16_t nn)
+    {
+        push16(gb, gb.regs.PC);
+        gb.regs.PC = nn;
+    }
 
+    static void ret(GameBoy& gb, uint16_t) { gb.regs.PC = pop16(gb); }
 
+    static void reti(GameBoy& gb, uint16_t)
+    {
+        gb.regs.PC = pop16(gb);
+        gb.ime = true;
+    }
 
-             // load immediate byte
-    case 0x06: regs.B = memory[regs.PC++]; break; // ld b, n
-    case 0x0E: regs.C = memory[regs.PC++]; break; // ld c, n
-    case 0x16: regs.D = memory[regs.PC++]; break; // ld d, n
-    case 0x1E: regs.E = memory[regs.PC++]; break; // ld e, n
-    case 0x26: regs.H = memory[regs.PC++]; break; // ld h, n
-    case 0x2E: regs.L = memory[regs.PC++]; break; // ld l, n
-    case 0x3E: regs.A = memory[regs.PC++]; break; // ld a, n
+    template<int CC> static void jrCC(GameBoy& gb, uint16_t e)
+    {
+        if (!cond<CC>(gb)) return;
+        jr(gb, e);
+        gb.sched.cycles += 4;
+    }
 
+    template<int CC> static void jpCC(GameBoy& gb, uint16_t nn)
+    {
+        if (!cond<CC>(gb)) return;
+        jp(gb, nn);
+        gb.sched.cycles += 4;
+    }
 
-        // load immediate 2 bytes
-    case 0x01: // ld bc, u8
+    template<int CC> static void callCC(GameBoy& gb, uint16_t nn)
     {
-        uint8_t lo = memory[regs.PC++];
-        uint8_t hi = memory[regs.PC++];
-        regs.setBC((hi << 8) | lo);
-        break;
+        if (!cond<CC>(gb)) return;
+        call(gb, nn);
+        gb.sched.cycles += 12;
     }
-    case 0x11: // ld de, u8
+
+    template<int CC> static void retCC(GameBoy& gb, uint16_t)
     {
-        uint8_t lo = memory[regs.PC++];
-        uint8_t hi = memory[regs.PC++];
-        regs.setDE((hi << 8) | lo);
-        break;
+        if (!cond<CC>(gb)) return;
+        ret(gb, 0);
+        gb.sched.cycles += 12;
     }
-    case 0x21: // ld hl, u8
+
+    template<int N> static void rst(GameBoy& gb, uint16_t) { call(gb, N * 8); }
+
+    // cpu control
+    static void di(GameBoy& gb, uint16_t)
     {
-        uint8_t lo = memory[regs.PC++];
-        uint8_t hi = memory[regs.PC++];
-        regs.setHL((hi << 8) | lo);
-        break;
+        gb.ime = false;
+        gb.eiDelay = 0;
     }
-    case 0x31: // ld sp, u8
+
+    static void ei(GameBoy& gb, uint16_t) { gb.eiDelay = 2; }
+    static void halt(GameBoy& gb, uint16_t) { gb.halted = true; }
+    static void stop(GameBoy&, uint16_t) {} // no speed switch or low power mode on dmg
+
+    static void prefixCB(GameBoy& gb, uint16_t op)
     {
-        uint8_t lo = memory[regs.PC++];
-        uint8_t hi = memory[regs.PC++];
-        regs.SP = (hi << 8) | lo;
-        break;
+        const OpInfo& info = cbTable[op & 0xFF];
+        gb.sched.cycles += info.cycles;
+        info.handler(gb, op);
     }
 
+    // cb page
+    template<int K, int R> static void cbShift(GameBoy& gb, uint16_t) { setR<R>(gb, shift<K>(gb, getR<R>(gb))); }
+    template<int B, int R> static void bit(GameBoy& gb, uint16_t) { gb.bit8(B, getR<R>(gb)); }
+    template<int B, int R> static void res(GameBoy& gb, uint16_t) { setR<R>(gb, getR<R>(gb) & ~(1 << B)); }
+    template<int B, int R> static void set(GameBoy& gb, uint16_t) { setR<R>(gb, getR<R>(gb) | (1 << B)); }
 
 
-    case 0x02: { memory[regs.BC()] = regs.A; break; } // ld (bc), a
-    case 0x12: { memory[regs.DE()] = regs.A; break; } // ld (de), a
+    // picks the handler for an opcode from its x y z fields
+    template<uint8_t OP> static constexpr OpHandler decode()
+    {
+        constexpr int x = OP >> 6, y = (OP >> 3) & 7, z = OP & 7, p = y >> 1, q = y & 1;
+
+        if constexpr (x == 0)
+        {
+            if constexpr (z == 0)
+            {
+                if constexpr (y == 0) return &nop;
+                else if constexpr (y == 1) return &ldNNSP;
+                else if constexpr (y == 2) return &stop;
+                else if constexpr (y == 3) return &jr;
+                else return &jrCC<y - 4>;
+            }
+            else if constexpr (z == 1) return q ? &addHL<p> : &ldRPNN<p>;
+            else if constexpr (z == 2) return &ldIndirect<p, q>;
+            else if constexpr (z == 3) return q ? &decRP<p> : &incRP<p>;
+            else if constexpr (z == 4) return &inc<y>;
+            else if constexpr (z == 5) return &dec<y>;
+            else if constexpr (z == 6) return &ldRN<y>;
+            else if constexpr (y < 4) return &rotateA<y>;
+            else if constexpr (y == 4) return &daa;
+            else if constexpr (y == 5) return &cpl;
+            else if constexpr (y == 6) return &scf;
+            else return &ccf;
+        }
+        else if constexpr (x == 1)
+        {
+            if constexpr (OP == 0x76) return &halt;
+            else return &ldRR<y, z>;
+        }
+        else if constexpr (x == 2) return &aluR<y, z>;
+        else
+        {
+            if constexpr (z == 0)
+            {
+                if constexpr (y < 4) return &retCC<y>;
+                else if constexpr (y == 4) return &ldhNA;
+                else if constexpr (y == 5) return &addSPE;
+                else if constexpr (y == 6) return &ldhAN;
+                else return &ldHLSPE;
+            }
+            else if constexpr (z == 1)
+            {
+                if constexpr (q == 0) return &pop<p>;
+                else if constexpr (p == 0) return &ret;
+                else if constexpr (p == 1) return &reti;
+                else if constexpr (p == 2) return &jpHL;
+                else return &ldSPHL;
+            }
+            else if constexpr (z == 2)
+            {
+                if constexpr (y < 4) return &jpCC<y>;
+                else if constexpr (y == 4) return &ldhCA;
+                else if constexpr (y == 5) return &ldNNA;
+                else if constexpr (y == 6) return &ldhAC;
+                else return &ldANN;
+            }
+            else if constexpr (z == 3)
+            {
+                if constexpr (y == 0) return &jp;
+                else if constexpr (y == 1) return &prefixCB;
+                else if constexpr (y == 6) return &di;
+                else if constexpr (y == 7) return &ei;
+                else return &invalid<OP>;
+            }
+            else if constexpr (z == 4)
+            {
+                if constexpr (y < 4) return &callCC<y>;
+                else return &invalid<OP>;
+            }
+            else if constexpr (z == 5)
+            {
+                if constexpr (q == 0) return &push<p>;
+                else if constexpr (p == 0) return &call;
+                else return &invalid<OP>;
+            }
+            else if constexpr (z == 6) return &aluN<y>;
+            else return &rst<y>;
+        }
+    }
 
+    template<uint8_t OP> static constexpr OpHandler decodeCB()
+    {
+        constexpr int x = OP >> 6, y = (OP >> 3) & 7, z = OP & 7;
 
+        if constexpr (x == 0) return &cbShift<y, z>;
+        else if constexpr (x == 1) return &bit<y, z>;
+        else if constexpr (x == 2) return &res<y, z>;
+        else return &set<y, z>;
+    }
+};
 
 
-    case 0xEA: // ld (a16), a
+// t-cycles per opcode, conditional branches are listed at their not taken cost
+static constexpr uint8_t opcodeCycles[256] =
+{
+//  x0  x1  x2  x3  x4  x5  x6  x7  x8  x9  xA  xB  xC  xD  xE  xF
+     4, 12,  8,  8,  4,  4,  8,  4, 20,  8,  8,  8,  4,  4,  8,  4, // 0x
+     4, 12,  8,  8,  4,  4,  8,  4, 12,  8,  8,  8,  4,  4,  8,  4, // 1x
+     8, 12,  8,  8,  4,  4,  8,  4,  8,  8,  8,  8,  4,  4,  8,  4, // 2x
+     8, 12,  8,  8, 12, 12, 12,  4,  8,  8,  8,  8,  4,  4,  8,  4, // 3x
+     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 4x
+     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 5x
+     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 6x
+     8,  8,  8,  8,  8,  8,  4,  8,  4,  4,  4,  4,  4,  4,  8,  4, // 7x
+     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 8x
+     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 9x
+     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // Ax
+     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // Bx
+     8, 12, 12, 16, 12, 16,  8, 16,  8, 16, 12,  4, 12, 24,  8, 16, // Cx
+     8, 12, 12,  0, 12, 16,  8, 16,  8, 16, 12,  0, 12,  0,  8, 16, // Dx
+    12, 12,  8,  0,  0, 16,  8, 16, 16,  4, 16,  0,  0,  0,  8, 16, // Ex
+    12, 12,  8,  4,  0, 16,  8, 16, 12,  8, 16,  4,  0,  0,  8, 16, // Fx
+};
+
+
+static constexpr uint8_t opLength(uint8_t op)
+{
+    const int x = op >> 6, y = (op >> 3) & 7, z = op & 7, q = y & 1, p = y >> 1;
+
+    if (x == 0)
     {
-        uint8_t lo = memory[regs.PC++];
-        uint8_t hi = memory[regs.PC++];
-        memory[(hi << 8) | lo] = regs.A;
-        break;
+        if (z == 0) return y == 0 ? 1 : y == 1 ? 3 : 2; // nop, ld (nn) sp, stop and jr take operands
+        if (z == 1) return q ? 1 : 3;
+        if (z == 6) return 2;
+        return 1;
     }
-    case 0xFA: // ld a, (a16)
+    if (x == 3)
     {
-        uint8_t lo = memory[regs.PC++];
-        uint8_t hi = memory[regs.PC++];
-        regs.A = memory[(hi << 8) | lo];
-        break;
+        if (z == 0) return y < 4 ? 1 : 2;
+        if (z == 2) return (y < 4 || y == 5 || y == 7) ? 3 : 1;
+        if (z == 3) return y == 0 ? 3 : y == 1 ? 2 : 1;
+        if (z == 4) return y < 4 ? 3 : 1;
+        if (z == 5) return (q && p == 0) ? 3 : 1;
+        if (z == 6) return 2;
     }
+    return 1;
+}
 
+static constexpr uint8_t opTakenCycles(uint8_t op)
+{
+    if ((op & 0xE7) == 0x20) return 4;  // jr cc
+    if ((op & 0xE7) == 0xC2) return 4;  // jp cc
+    if ((op & 0xE7) == 0xC4) return 12; // call cc
+    if ((op & 0xE7) == 0xC0) return 12; // ret cc
+    return 0;
+}
 
+// anything that can move PC somewhere other than the next instruction, plus the
+// ops that change interrupt or halt state, so a decoded block never runs past them
+static constexpr bool opEndsBlock(uint8_t op)
+{
+    const int x = op >> 6, y = (op >> 3) & 7, z = op & 7;
 
+    if (x == 0) return op == 0x10 || op == 0x18 || (op & 0xE7) == 0x20; // stop, jr, jr cc
+    if (x == 1) return op == 0x76;                                      // halt
+    if (x == 2) return false;
 
-    case 0xF2: { regs.A = memory[0xFF00 + regs.C]; break; } // ld a, (c)
-    case 0xE2: { memory[0xFF00 + regs.C] = regs.A; break; } // ld (c), a
+    switch (z)
+    {
+    case 0: case 2: return y < 4;          // ret cc, jp cc
+    case 1: return (y & 1) && y != 7;      // ret, reti, jp hl
+    case 3: return y != 1;                 // jp, di, ei and holes, not the cb prefix
+    case 4: return true;                   // call cc and holes
+    case 5: return y & 1;                  // call and holes
+    case 7: return true;                   // rst
+    default: return false;
+    }
+}
 
+// cost after the prefix, (hl) operands pay for the extra memory accesses
+static constexpr uint8_t cbCycles(uint8_t op)
+{
+    if ((op & 7) != 6) return 4;
+    return (op >> 6) == 1 ? 8 : 12;
+}
 
+template<size_t... I>
+static constexpr std::array<OpInfo, 256> makeOpTable(std::index_sequence<I...>)
+{
+    return { { OpInfo{ Ops::decode<I>(), opcodeCycles[I], opTakenCycles(I), opLength(I), opEndsBlock(I) }... } };
+}
 
-    case 0x2A: {
-        regs.A = memory[regs.HL()];
-        regs.setHL(regs.HL() + 1); break;
-    } // ld a, (hl+)
-    case 0x3A: {
-        regs.A = memory[regs.HL()];
-        regs.setHL(regs.HL() - 1); break;
-    } // ld a, (hl-)
-    case 0x22: {
-        memory[regs.HL()] = regs.A;
-        regs.setHL(regs.HL() + 1); break;
-    } // ld (hl+), a
-    case 0x32: {
-        memory[regs.HL()] = regs.A;
-        regs.setHL(regs.HL() - 1); break;
-    } // ld (hl-), a
+template<size_t... I>
+static constexpr std::array<OpInfo, 256> makeCBTable(std::index_sequence<I...>)
+{
+    return { { OpInfo{ Ops::decodeCB<I>(), cbCycles(I), 0, 1, false }... } };
+}
 
+constexpr std::array<OpInfo, 256> opTable = makeOpTable(std::make_index_sequence<256>());
+constexpr std::array<OpInfo, 256> cbTable = makeCBTable(std::make_index_sequence<256>());
 
 
+// reads the immediate and moves PC past the whole instruction
+inline uint16_t GameBoy::fetchOperand(const OpInfo& op)
+{
+    uint16_t operand = 0;
+    if (op.length > 1) operand = read8(regs.PC + 1);
+    if (op.length > 2) operand |= read8(regs.PC + 2) << 8;
+    regs.PC += op.length;
+    return operand;
+}
 
+void GameBoy::emulateCycle()
+{
+    if (serviceInterrupts()) return;
 
-            // ld a, r
-    case 0x78: { regs.A = regs.B; break; } // ld a, b
-    case 0x79: { regs.A = regs.C; break; } // ld a, c
-    case 0x7A: { regs.A = regs.D; break; } // ld a, d
-    case 0x7B: { regs.A = regs.E; break; } // ld a, e
-    case 0x7C: { regs.A = regs.H; break; } // ld a, h
-    case 0x7D: { regs.A = regs.L; break; } // ld a, l
-    case 0x7E: { regs.A = memory[regs.HL()]; break; } // ld a, (hl)
-    case 0x7F: { regs.A = regs.A; break; } // ld a, a
+    if (halted)
+    {
+        // any pending interrupt wakes the cpu, even with ime off
+        if (!irqPending)
+        {
+            sched.cycles += 4;
+            return;
+        }
+        halted = false;
+    }
 
-             // ld b, r
-    case 0x40: { regs.B = regs.B; break; } // ld b, b
-    case 0x41: { regs.B = regs.C; break; } // ld b, c
-    case 0x42: { regs.B = regs.D; break; } // ld b, d
-    case 0x43: { regs.B = regs.E; break; } // ld b, e
-    case 0x44: { regs.B = regs.H; break; } // ld b, h
-    case 0x45: { regs.B = regs.L; break; } // ld b, l
-    case 0x46: { regs.B = memory[regs.HL()]; break; } // ld b, (hl)
-    case 0x47: { regs.B = regs.A; break; } // ld b, a
+    uint8_t opcode = read8(regs.PC);
+    const OpInfo& op = opTable[opcode];
+
+    if (singleStep)
+    {
+        if (trace) traceInstruction(opcode);
+        if (profiler && profiler->exact) profileAt(true);
+    }
+
+    uint16_t operand = fetchOperand(op);
+    sched.cycles += op.cycles;
+    op.handler(*this, operand);
+
+    if (eiDelay && --eiDelay == 0) ime = true;
+}
+
+
+#if GB_THREADED_DISPATCH
+
+// the plain case for the threaded loop, anything unusual goes through emulateCycle
+inline bool GameBoy::fetchThreaded(uint64_t stop, uint8_t& opcode, uint16_t& operand)
+{
+    while (true)
+    {
+        uint64_t limit = std::min(stop, sched.nextEvent());
+        if (crashed || sched.cycles >= limit) return false;
+
+        bool irq = ime && irqPending;
+        if (!(halted || eiDelay || singleStep || irq)) break;
+        if (!skipHalt(limit)) emulateCycle();
+    }
+
+    opcode = read8(regs.PC);
+    const OpInfo& op = opTable[opcode];
+    operand = fetchOperand(op);
+    sched.cycles += op.cycles;
+    return true;
+}
+
+// every handler gets its own copy of the dispatch so the indirect jumps
+// are predicted per opcode instead of all sharing one switch.
+// ei counts its own delay down like emulateCycle does, the instruction after it then
+// goes through emulateCycle and turns ime on. the check folds away for every other opcode
+void GameBoy::runInstructions(uint64_t stop)
+{
+#define GB_OP_ADDR(h, l) &&op_##h##l,
+#define GB_OP_BODY(h, l) op_##h##l: Ops::decode<0x##h##l>()(*this, operand); \
+    if (0x##h##l == 0xFB && eiDelay && --eiDelay == 0) ime = true; \
+    GB_DISPATCH();
+#define GB_REP16(M, h) M(h, 0) M(h, 1) M(h, 2) M(h, 3) M(h, 4) M(h, 5) M(h, 6) M(h, 7) \
+    M(h, 8) M(h, 9) M(h, A) M(h, B) M(h, C) M(h, D) M(h, E) M(h, F)
+#define GB_REP256(M) GB_REP16(M, 0) GB_REP16(M, 1) GB_REP16(M, 2) GB_REP16(M, 3) \
+    GB_REP16(M, 4) GB_REP16(M, 5) GB_REP16(M, 6) GB_REP16(M, 7) \
+    GB_REP16(M, 8) GB_REP16(M, 9) GB_REP16(M, A) GB_REP16(M, B) \
+    GB_REP16(M, C) GB_REP16(M, D) GB_REP16(M, E) GB_REP16(M, F)
+#define GB_DISPATCH() do { if (!fetchThreaded(stop, opcode, operand)) return; goto *labels[opcode]; } while (0)
+
+    static void* const labels[256] = { GB_REP256(GB_OP_ADDR) };
+    uint8_t opcode;
+    uint16_t operand;
+
+    GB_DISPATCH();
+    GB_REP256(GB_OP_BODY)
+
+#undef GB_DISPATCH
+#undef GB_REP256
+#undef GB_REP16
+#undef GB_OP_BODY
+#undef GB_OP_ADDR
+}
+
+#else
+
+void GameBoy::runInstructions(uint64_t stop)
+{
+    while (!crashed)
+    {
+        uint64_t limit = std::min(stop, sched.nextEvent());
+        if (sched.cycles >= limit) return;
+        if (!skipHalt(limit)) emulateCycle();
+    }
+}
 
-             // ld c, r
-    case 0x48: { regs.C = regs.B; break; } // ld c, b
-    case 0x49: { regs.C = regs.C; break; } // ld c, c
-    case 0x4A: { regs.C = regs.D; break; } // ld c, d
-    case 0x4B: { regs.C = regs.E; break; } // ld c, e
-    case 0x4C: { regs.C = regs.H; break; } // ld c, h
-    case 0x4D: { regs.C = regs.L; break; } // ld c, l
-    case 0x4E: { regs.C = memory[regs.HL()]; break; } // ld c, (hl)
-    case 0x4F: { regs.C = regs.A; break; } // ld c, a
-
-             // ld d, r
-    case 0x50: { regs.D = regs.B; break; } // ld d, b
-    case 0x51: { regs.D = regs.C; break; } // ld d, c
-    case 0x52: { regs.D = regs.D; break; } // ld d, d
-    case 0x53: { regs.D = regs.E; break; } // ld d, e
-    case 0x54: { regs.D = regs.H; break; } // ld d, h
-    case 0x55: { regs.D = regs.L; break; } // ld d, l
-    case 0x56: { regs.D = memory[regs.HL()]; break; } // ld d, (hl)
-    case 0x57: { regs.D = regs.A; break; } // ld d, a
-
-             // ld e, r
-    case 0x58: { regs.E = regs.B; break; } // ld e, b
-    case 0x59: { regs.E = regs.C; break; } // ld e, c
-    case 0x5A: { regs.E = regs.D; break; } // ld e, d
-    case 0x5B: { regs.E = regs.E; break; } // ld e, e
-    case 0x5C: { regs.E = regs.H; break; } // ld e, h
-    case 0x5D: { regs.E = regs.L; break; } // ld e, l
-    case 0x5E: { regs.E = memory[regs.HL()]; break; } // ld e, (hl)
-    case 0x5F: { regs.E = regs.A; break; } // ld e, a
-
-             // ld h, r
-    case 0x60: { regs.H = regs.B; break; } // ld h, b
-    case 0x61: { regs.H = regs.C; break; } // ld h, c
-    case 0x62: { regs.H = regs.D; break; } // ld h, d
-    case 0x63: { regs.H = regs.E; break; } // ld h, e
-    case 0x64: { regs.H = regs.H; break; } // ld h, h
-    case 0x65: { regs.H = regs.L; break; } // ld h, l
-    case 0x66: { regs.H = memory[regs.HL()]; break; } // ld h, (hl)
-    case 0x67: { regs.H = regs.A; break; } // ld h, a
-
-             // ld l, r
-    case 0x68: { regs.L = regs.B; break; } // ld l, b
-    case 0x69: { regs.L = regs.C; break; } // ld l, c
-    case 0x6A: { regs.L = regs.D; break; } // ld l, d
-    case 0x6B: { regs.L = regs.E; break; } // ld l, e
-    case 0x6C: { regs.L = regs.H; break; } // ld l, h
-    case 0x6D: { regs.L = regs.L; break; } // ld l, l
-    case 0x6E: { regs.L = memory[regs.HL()]; break; } // ld l, (hl)
-    case 0x6F: { regs.L = regs.A; break; } // ld l, a
-
-             // ld (hl), r
-    case 0x70: { memory[regs.HL()] = regs.B; break; } // ld (hl), b
-    case 0x71: { memory[regs.HL()] = regs.C; break; } // ld (hl), c
-    case 0x72: { memory[regs.HL()] = regs.D; break; } // ld (hl), d
-    case 0x73: { memory[regs.HL()] = regs.E; break; } // ld (hl), e
-    case 0x74: { memory[regs.HL()] = regs.H; break; } // ld (hl), h
-    case 0x75: { memory[regs.HL()] = regs.L; break; } // ld (hl), l
-    case 0x77: { memory[regs.HL()] = regs.A; break; } // ld (hl), a
-
-
-
-
-             // push to stack
-    case 0xC5: { pushStack(regs.B, regs.C); break; } // push bc
-    case 0xD5: { pushStack(regs.D, regs.E); break; } // push de
-    case 0xE5: { pushStack(regs.H, regs.L); break; } // push hl
-    case 0xF5: { pushStack(regs.A, regs.F & 0xF0); break; } // push af
-
-
-
-             // pop from stack
-    case 0xC1: { popStack(regs.B, regs.C); break; } // pop bc
-    case 0xD1: { popStack(regs.D, regs.E); break; } // pop de
-    case 0xE1: { popStack(regs.H, regs.L); break; } // pop hl
-    case 0xF1: { popStack(regs.A, regs.F); regs.F &= 0xF0b; break; } // pop af
-
-
-
-
-
-             // add
-    case 0x87: { regs.A = add8(regs.A, regs.A); break; } // add a, a
-    case 0x80: { regs.A = add8(regs.A, regs.B); break; } // add a, b
-    case 0x81: { regs.A = add8(regs.A, regs.C); break; } // add a, c
-    case 0x82: { regs.A = add8(regs.A, regs.D); break; } // add a, d
-    case 0x83: { regs.A = add8(regs.A, regs.E); break; } // add a, e
-    case 0x84: { regs.A = add8(regs.A, regs.H); break; } // add a, h
-    case 0x85: { regs.A = add8(regs.A, regs.L); break; } // add a, l
-    case 0x86: { regs.A = add8(regs.A, memory[regs.HL()]); break; } // add a, (hl)
-    case 0xC6: { regs.A = add8(regs.A, memory[regs.PC + 1]); regs.PC++; break; } // add a, u8
-
-             // sub
-    case 0x97: { regs.A = sub8(regs.A, regs.A); break; } // sub a, a
-    case 0x90: { regs.A = sub8(regs.A, regs.B); break; } // sub a, b
-    case 0x91: { regs.A = sub8(regs.A, regs.C); break; } // sub a, c
-    case 0x92: { regs.A = sub8(regs.A, regs.D); break; } // sub a, d
-    case 0x93: { regs.A = sub8(regs.A, regs.E); break; } // sub a, e
-    case 0x94: { regs.A = sub8(regs.A, regs.H); break; } // sub a, h
-    case 0x95: { regs.A = sub8(regs.A, regs.L); break; } // sub a, l
-    case 0x96: { regs.A = sub8(regs.A, memory[regs.HL()]); break; } // sub a, (hl)
-    case 0xD6: { regs.A = sub8(regs.A, memory[regs.PC + 1]); regs.PC++; break; } // sub a, u8
-
-             // adc
-    case 0x8F: { regs.A = adc8(regs.A, regs.A); break; } // adc a, a
-    case 0x88: { regs.A = adc8(regs.A, regs.B); break; } // adc a, b
-    case 0x89: { regs.A = adc8(regs.A, regs.C); break; } // adc a, c
-    case 0x8A: { regs.A = adc8(regs.A, regs.D); break; } // adc a, d
-    case 0x8B: { regs.A = adc8(regs.A, regs.E); break; } // adc a, e
-    case 0x8C: { regs.A = adc8(regs.A, regs.H); break; } // adc a, h
-    case 0x8D: { regs.A = adc8(regs.A, regs.L); break; } // adc a, l
-    case 0x8E: { regs.A = adc8(regs.A, memory[regs.HL()]); break; } // adc a, (hl)
-    case 0xCE: { regs.A = adc8(regs.A, memory[regs.PC + 1]); regs.PC++; break; } // adc a, u8
-
-             // and
-    case 0xA7: { regs.A = and8(regs.A, regs.A); break; } // and a, b
-    case 0xA0: { regs.A = and8(regs.A, regs.B); break; } // and a, b
-    case 0xA1: { regs.A = and8(regs.A, regs.C); break; } // and a, c
-    case 0xA2: { regs.A = and8(regs.A, regs.D); break; } // and a, d
-    case 0xA3: { regs.A = and8(regs.A, regs.E); break; } // and a, e
-    case 0xA4: { regs.A = and8(regs.A, regs.H); break; } // and a, h
-    case 0xA5: { regs.A = and8(regs.A, regs.L); break; } // and a, l
-    case 0xA6: { regs.A = and8(regs.A, memory[regs.HL()]); break; } // and a, (hl)
-    case 0xE6: { regs.A = and8(regs.A, memory[regs.PC + 1]); regs.PC++; break; } // and a, u8
-
-             // or
-    case 0xB7: { regs.A = or8(regs.A, regs.A); break; } // or a, a
-    case 0xB0: { regs.A = or8(regs.A, regs.B); break; } // or a, b
-    case 0xB1: { regs.A = or8(regs.A, regs.C); break; } // or a, c
-    case 0xB2: { regs.A = or8(regs.A, regs.D); break; } // or a, d
-    case 0xB3: { regs.A = or8(regs.A, regs.E); break; } // or a, e
-    case 0xB4: { regs.A = or8(regs.A, regs.H); break; } // or a, h
-    case 0xB5: { regs.A = or8(regs.A, regs.L); break; } // or a, l
-    case 0xB6: { regs.A = or8(regs.A, memory[regs.HL()]); break; } // or a, (hl)
-    case 0xF6: { regs.A = or8(regs.A, memory[regs.PC + 1]); regs.PC++; break; } // or a, u8
-
-             // xor
-    case 0xAF: { regs.A = xor8(regs.A, regs.A); break; } // xor a, a
-    case 0xA8: { regs.A = xor8(regs.A, regs.B); break; } // xor a, b
-    case 0xA9: { regs.A = xor8(regs.A, regs.C); break; } // xor a, c
-    case 0xAA: { regs.A = xor8(regs.A, regs.D); break; } // xor a, d
-    case 0xAB: { regs.A = xor8(regs.A, regs.E); break; } // xor a, e
-    case 0xAC: { regs.A = xor8(regs.A, regs.H); break; } // xor a, h
-    case 0xAD: { regs.A = xor8(regs.A, regs.L); break; } // xor a, l
-    case 0xAE: { regs.A = xor8(regs.A, memory[regs.HL()]); break; } // xor a, (hl)
-    case 0xEE: { regs.A = xor8(regs.A, memory[regs.PC + 1]); regs.PC++; break; } // xor a, u8
-
-             // cp
-    case 0xBF: { cp8(regs.A, regs.A); break; } // cp a, a
-    case 0xB8: { cp8(regs.A, regs.B); break; } // cp a, b
-    case 0xB9: { cp8(regs.A, regs.C); break; } // cp a, c
-    case 0xBA: { cp8(regs.A, regs.D); break; } // cp a, d
-    case 0xBB: { cp8(regs.A, regs.E); break; } // cp a, e
-    case 0xBC: { cp8(regs.A, regs.H); break; } // cp a, h
-    case 0xBD: { cp8(regs.A, regs.L); break; } // cp a, l
-    case 0xBE: { cp8(regs.A, memory[regs.HL()]); break; } // cp a, (hl)
-    case 0xFE: { cp8(regs.A, memory[regs.PC + 1]); regs.PC++; break; } // cp a, u8
-
-             // sbc
-    case 0x9F: { regs.A = sbc8(regs.A, regs.A); break; } // sbc a, a
-    case 0x98: { regs.A = sbc8(regs.A, regs.B); break; } // sbc a, b
-    case 0x99: { regs.A = sbc8(regs.A, regs.C); break; } // sbc a, c
-    case 0x9A: { regs.A = sbc8(regs.A, regs.D); break; } // sbc a, d
-    case 0x9B: { regs.A = sbc8(regs.A, regs.E); break; } // sbc a, e
-    case 0x9C: { regs.A = sbc8(regs.A, regs.H); break; } // sbc a, h
-    case 0x9D: { regs.A = sbc8(regs.A, regs.L); break; } // sbc a, l
-    case 0x9E: { regs.A = sbc8(regs.A, memory[regs.HL()]); break; } // sbc a, (hl)
-    case 0xDE: { regs.A = sbc8(regs.A, memory[regs.PC + 1]); regs.PC++; break; } // sbc a, u8
-
-
-
-    case 0x07: // rlca
-    {
-        uint8_t carry = (regs.A & 0x80) >> 7;
-        regs.A = static_cast<uint8_t>((regs.A << 1) | carry);
-
-        setFlagZero(false);
-        setFlagSub(false);
-        setFlagHalfCarry(false);
-        setFlagCarry(carry);
-        break;
-    }
-
-    case 0x17: { break; } // rla
-    case 0x0F: { break; } // rrca
-    case 0x1F: { break; } // rra
-
-
-
-
-    default: { error(opcode); break; }
-           /*
-           null inrange opcodes:
-           0xD3 0xE3
-           0xE4 0xF4
-           0xD3 0xDB
-           0xEB 0xEC
-           0xFC 0xDD
-           0xED 0xFD
-           */
-
-    }
-}
\ No newline at end of file
+#endif
@@ -1,7 +1,10 @@
 #pragma once
 #include <cstdint>
 
-extern struct Registers regs;
+// 1 = alu ops only note what they did, F is worked out when something reads a flag
+#ifndef GB_LAZY_FLAGS
+#define GB_LAZY_FLAGS 0
+#endif
 
 struct Registers
 {
@@ -25,6 +28,22 @@ struct Registers
     void setHL(uint16_t val) { H = val >> 8; L = val & 0xFF; }
 };
 
-void emulateCycle();
-void bootSetup();
-void printCPUState();
\ No newline at end of file
+// last flag setting alu op for lazy flags, adc/sbc/cp share add and sub with carry as the input
+// inc and dec keep C, it stays in F
+enum LazyOp : uint8_t
+{
+    LAZY_NONE, // F is up to date
+    LAZY_ADD,
+    LAZY_SUB,
+    LAZY_AND,
+    LAZY_OR,   // or and xor
+    LAZY_INC,
+    LAZY_DEC,
+};
+
+struct LazyFlags
+{
+    uint8_t op;
+    uint8_t a, b, carry;
+    uint8_t result;
+};
@@ -0,0 +1,145 @@
+#include "display.h"
+#include "gameboy.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+
+void TripleBuffer::publish(const uint8_t* pixels, uint64_t number)
+{
+    Frame& f = frames[back];
+    f.number = number;
+    std::memcpy(f.pixels, pixels, FRAME_BYTES);
+    back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & 0x03;
+}
+
+const TripleBuffer::Frame* TripleBuffer::acquire()
+{
+    if (!(middle.load(std::memory_order_relaxed) & FRESH)) return nullptr;
+    front = middle.exchange(front, std::memory_order_acq_rel) & 0x03;
+    return &frames[front];
+}
+
+
+std::unique_ptr<FrameDump> FrameDump::open(const std::string& filename, DumpMode mode, size_t frames)
+{
+    std::unique_ptr<FrameDump> d(new FrameDump(mode, frames));
+    d->file.open(filename, std::ios::binary);
+    if (!d->file)
+    {
+        std::cerr << filename << " couldnt be written!" << "\n";
+        return nullptr;
+    }
+
+    d->writer = std::thread(&FrameDump::drain, d.get());
+    return d;
+}
+
+FrameDump::FrameDump(DumpMode mode, size_t frames) : mode(mode)
+{
+    size_t size = 1;
+    while (size < frames) size <<= 1;
+    ring.resize(size * FRAME_BYTES);
+    numbers.resize(size);
+    mask = size - 1;
+}
+
+FrameDump::~FrameDump()
+{
+    stopping.store(true, std::memory_order_release);
+    if (writer.joinable()) writer.join();
+}
+
+void FrameDump::push(const uint8_t* pixels, uint64_t number)
+{
+    uint64_t h = head.load(std::memory_order_relaxed);
+    while (h - tail.load(std::memory_order_acquire) == numbers.size())
+        std::this_thread::yield();
+
+    size_t slot = size_t(h & mask);
+    std::memcpy(&ring[slot * FRAME_BYTES], pixels, FRAME_BYTES);
+    numbers[slot] = number;
+    head.store(h + 1, std::memory_order_release);
+}
+
+static uint64_t hashFrame(const uint8_t* pixels)
+{
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < FRAME_BYTES; ++i)
+    {
+        h ^= pixels[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// raw frames go out as long contiguous runs straight from the ring,
+// hash lines are gathered into one buffer per pass
+void FrameDump::drain()
+{
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    std::string lines;
+    char line[48];
+
+    while (true)
+    {
+        bool last = stopping.load(std::memory_order_acquire);
+        uint64_t h = head.load(std::memory_order_acquire);
+        if (h == t)
+        {
+            if (last) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        while (t != h)
+        {
+            size_t start = size_t(t & mask);
+            size_t count = size_t(std::min<uint64_t>(h - t, numbers.size() - start));
+            if (mode == DUMP_FRAMES)
+            {
+                file.write(reinterpret_cast<const char*>(&ring[start * FRAME_BYTES]), count * FRAME_BYTES);
+            }
+            else
+            {
+                for (size_t i = start; i < start + count; ++i)
+                {
+                    int n = std::snprintf(line, sizeof(line), "%llu %016llx\n",
+                        (unsigned long long)numbers[i], (unsigned long long)hashFrame(&ring[i * FRAME_BYTES]));
+                    lines.append(line, n);
+                }
+            }
+            t += count;
+            tail.store(t, std::memory_order_release);
+        }
+
+        if (!lines.empty())
+        {
+            file.write(lines.data(), lines.size());
+            lines.clear();
+        }
+        file.flush();
+    }
+}
+
+
+// a finished frame goes to whoever is watching, frame skipped ones were never drawn
+void GameBoy::presentFrame()
+{
+    if (skipRender) return;
+    if (display) display->publish(framebuffer[0], frameCount);
+    if (frameDump) frameDump->push(framebuffer[0], frameCount);
+}
+
+bool GameBoy::startFrameDump(const std::string& filename, DumpMode mode)
+{
+    frameDump = FrameDump::open(filename, mode);
+    return frameDump != nullptr;
+}
+
+void GameBoy::stopFrameDump()
+{
+    frameDump.reset();
+}
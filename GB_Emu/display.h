@@ -0,0 +1,76 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sysInfo.h"
+
+constexpr size_t FRAME_BYTES = SCREEN_WIDTH * SCREEN_HEIGHT; // one shade byte per pixel
+
+
+// three frames: the emulator fills one, the newest finished one waits in the middle,
+// the consumer holds the third. both sides only ever swap indices, neither waits
+// a consumer that falls behind just sees the newest frame, older ones are skipped
+class TripleBuffer
+{
+public:
+    struct Frame
+    {
+        uint64_t number; // frameCount when it finished
+        uint8_t pixels[SCREEN_HEIGHT][SCREEN_WIDTH];
+    };
+
+    void publish(const uint8_t* pixels, uint64_t number); // emulator thread
+    const Frame* acquire(); // consumer thread, null if nothing new since the last call
+
+private:
+    static constexpr uint8_t FRESH = 0x04; // set in middle when it holds an unread frame
+
+    Frame frames[3] = {};
+    uint8_t back = 0;                  // emulator's
+    uint8_t front = 2;                 // consumer's
+    alignas(64) std::atomic<uint8_t> middle{ 1 };
+};
+
+
+enum DumpMode : uint8_t
+{
+    DUMP_FRAMES, // FRAME_BYTES of shades per frame, back to back
+    DUMP_HASHES, // one text line per frame: frame number and a 64 bit fnv-1a of its pixels
+};
+
+// headless frame sink for recording and ci, every frame is kept, in order
+// frames wait in a ring and a background thread writes whole runs of them at once
+// hashing happens on that thread too, the emulator only copies the pixels in
+// the emulator waits only if the disk falls a whole ring behind, same as Trace
+class FrameDump
+{
+public:
+    static constexpr size_t DEFAULT_FRAMES = 64; // about 1.5MB, power of 2
+
+    // null when the file cant be created, a fifo works as well as a plain file
+    static std::unique_ptr<FrameDump> open(const std::string& filename, DumpMode mode, size_t frames = DEFAULT_FRAMES);
+    ~FrameDump(); // writes out whatever is left
+
+    void push(const uint8_t* pixels, uint64_t number);
+    uint64_t recorded() const { return head.load(std::memory_order_relaxed); }
+
+private:
+    FrameDump(DumpMode mode, size_t frames);
+    void drain();
+
+    DumpMode mode;
+    std::vector<uint8_t> ring;
+    std::vector<uint64_t> numbers;
+    size_t mask;
+    std::ofstream file;
+    std::thread writer;
+    std::atomic<bool> stopping{ false };
+
+    alignas(64) std::atomic<uint64_t> head{ 0 }; // written by the emulator
+    alignas(64) std::atomic<uint64_t> tail{ 0 }; // written by the drain thread
+};
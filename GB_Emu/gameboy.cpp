@@ -0,0 +1,58 @@
+#include "gameboy.h"
+#include "sysInfo.h"
+#include <algorithm>
+
+
+void GameBoy::requestInterrupt(uint8_t bit)
+{
+    memory[0xFF0F] |= bit;
+    updateInterrupts();
+}
+
+void GameBoy::handleEvent(const Event& event)
+{
+    switch (event.type)
+    {
+    case EVENT_LCD: lcdEvent(event.when); break;
+    case EVENT_TIMER: timerEvent(event.when); break;
+    case EVENT_DMA: finishDMA(); break;
+    case EVENT_SERIAL: serialEvent(); break;
+    case EVENT_LINK: linkEvent(); break;
+    default: break;
+    }
+}
+
+// run the cpu flat out up to the next event, then let the event fire
+// nothing else is looked at between events
+void GameBoy::run(uint64_t target, bool stopAtFrame)
+{
+    if (profiler) return runProfiled(target, stopAtFrame);
+
+    while (sched.cycles < target && !crashed)
+    {
+        if (blocks) runBlocks(target);
+        else runInstructions(target);
+
+        Event event;
+        while (sched.popDue(event))
+            handleEvent(event);
+
+        if (stopAtFrame && frameDone) return;
+    }
+}
+
+void GameBoy::runUntil(uint64_t target)
+{
+    run(target, false);
+    endAudioFrame();
+}
+
+// runs to the start of the next vblank, or one frames worth of cycles if the lcd is off
+// limit cuts the frame short for cycle budgets
+void GameBoy::runFrame(uint64_t limit)
+{
+    frameDone = false;
+    run(std::min(sched.cycles + CYCLES_PER_FRAME, limit), true);
+    endAudioFrame();
+    if (profiler) profiler->endFrame(sched.cycles);
+}
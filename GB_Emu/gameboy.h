@@ -0,0 +1,355 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "apu.h"
+#include "audio.h"
+#include "blockcache.h"
+#include "cartridge.h"
+#include "cpu.h"
+#include "display.h"
+#include "jit.h"
+#include "link.h"
+#include "opcodes.h"
+#include "ppu.h"
+#include "profiler.h"
+#include "scheduler.h"
+#include "trace.h"
+
+
+// joypad bits, set = pressed
+enum JoypadButton : uint8_t
+{
+    BUTTON_RIGHT = 0x01,
+    BUTTON_LEFT = 0x02,
+    BUTTON_UP = 0x04,
+    BUTTON_DOWN = 0x08,
+    BUTTON_A = 0x10,
+    BUTTON_B = 0x20,
+    BUTTON_SELECT = 0x40,
+    BUTTON_START = 0x80,
+};
+
+
+enum TestStatus : uint8_t
+{
+    TEST_RUNNING, // no verdict yet
+    TEST_PASSED,
+    TEST_FAILED,
+};
+
+constexpr size_t SERIAL_LOG_MAX = 1 << 16;
+
+
+// one whole console: cpu, bus and cartridge state
+// nothing in here is shared so any number can run side by side
+class GameBoy
+{
+public:
+    Registers regs = {};
+#if GB_LAZY_FLAGS
+    LazyFlags lazy = {}; // regs.F is stale while lazy.op is set, read flags() instead
+#endif
+    uint8_t memory[0x10000]; // 64KB
+
+    // 256 byte pages, plain ram and rom are one lookup away
+    // null sends the access down the slow path: io, oam, rom writes and ram holding cached code
+    const uint8_t* readPage[256] = {};
+    uint8_t* writePage[256] = {};
+    bool dmaActive = false; // oam is cut off from the cpu while a dma runs
+
+    Scheduler sched;
+
+    bool ime = false;
+    uint8_t irqPending = 0; // IF & IE, redone by every write to either instead of every instruction
+    uint8_t eiDelay = 0; // ei takes effect after the next instruction
+    bool halted = false;
+
+    uint64_t divBase = 0;  // master clock when the DIV counter was last 0
+    uint64_t timaBase = 0; // master clock TIMA in memory is correct as of
+    uint64_t spinReadLimit = UINT64_MAX; // next change of a timer register the current spin lap read
+
+    uint8_t lcdMode = 0;
+    uint64_t frameCount = 0;
+    bool frameDone = false;
+    uint8_t windowLine = 0; // window rows drawn so far this frame
+
+    uint8_t framebuffer[SCREEN_HEIGHT][SCREEN_WIDTH] = {}; // shades, 0 = white .. 3 = black
+    TileCache tiles;
+    std::unique_ptr<TripleBuffer> display; // null = nobody is presenting
+    std::unique_ptr<FrameDump> frameDump;  // null = off
+
+    Apu apu = {};
+    std::unique_ptr<AudioOut> audio; // null = the apu keeps time but nothing is synthesised
+
+    Cartridge cart;
+
+    std::unique_ptr<BlockCache> blocks; // null = plain interpreter
+    bool blockBreak = false;
+    std::unique_ptr<Jit> jit; // null = blocks run through their handlers
+
+    uint8_t joypad = 0;
+    bool crashed = false;
+    std::string serialLog; // every byte sent out the serial port, test roms print their results here
+
+    std::unique_ptr<LinkCable> link;     // null = nothing plugged in, transfers read back 0xFF
+    uint64_t linkBase = 0;               // sched.cycles when the cable went in, link time counts from there
+    uint64_t linkIncoming = UINT64_MAX;  // link time a byte from the other end lands here
+    uint8_t linkByte = 0;                // and that byte
+    uint64_t linkSent = UINT64_MAX;      // link time our own transfer lands
+    int linkReply = -1;                  // what came back for it, -1 = nothing yet
+
+    bool skipRender = false; // frame skip, timing still runs but no pixels are drawn
+    std::unique_ptr<Trace> trace; // null = off, every instruction goes to a binary log
+    std::unique_ptr<Profiler> profiler; // null = off
+    bool singleStep = false; // every instruction through emulateCycle, for tracing and exact profiles
+
+
+    // memory.cpp
+    void initMemory();
+    void loadTestProgram();
+    uint8_t read8(uint16_t addr);
+    uint8_t peek8(uint16_t addr) const; // what read8 would return, without its side effects
+    void write8(uint16_t addr, uint8_t value);
+    void postBootSetup();
+    void mapPages();
+
+    // cpu.cpp
+    void emulateCycle();
+    void runInstructions(uint64_t stop);
+    void bootSetup();
+    uint8_t flags() const; // F as the cpu sees it
+    void syncFlags();      // brings regs.F up to date
+    void setFlags(uint8_t f);
+
+    // cartridge.cpp
+    bool loadROM(const std::string& filename);
+    void loadROM(std::shared_ptr<const RomImage> rom);
+    bool loadBattery(const std::string& path, unsigned flushMs = CartRam::DEFAULT_FLUSH_MS);
+
+    // blockcache.cpp
+    void setBlockCache(bool on);
+    // runFrame on every console, stepping them together through the rom blocks they share, see Batch
+    static void runFramesLockstep(GameBoy* const* consoles, size_t count);
+
+    // jit.cpp
+    bool setJit(bool on);
+
+    // trace.cpp
+    bool startTrace(const std::string& filename);
+    void stopTrace();
+
+    // profiler.cpp
+    void startProfile(bool exact = false);
+    void stopProfile();
+
+    // apu.cpp
+    void startAudio(AudioRing& ring, uint32_t sampleRate = AUDIO_RATE); // ring has to outlive the run
+    void stopAudio();
+
+    // timer.cpp
+    uint8_t readDIV() const;
+    uint8_t readTIMA() const;
+
+    // serial.cpp
+    TestStatus testStatus() const;
+    std::string testOutput() const;
+    void attachLink(std::unique_ptr<LinkCable> cable);
+    void detachLink();
+
+    // display.cpp
+    bool startFrameDump(const std::string& filename, DumpMode mode);
+    void stopFrameDump();
+
+    // savestate.cpp
+    size_t stateSize() const;
+    void saveState(std::vector<uint8_t>& buf) const;
+    void saveState(uint8_t* out) const;
+    bool loadState(const uint8_t* data, size_t size);
+    bool saveStateFile(const std::string& filename) const;
+    bool loadStateFile(const std::string& filename);
+    std::unique_ptr<GameBoy> clone() const;
+
+    // gameboy.cpp
+    void runUntil(uint64_t target);
+    void runFrame(uint64_t limit = UINT64_MAX);
+    void requestInterrupt(uint8_t bit);
+    void updateInterrupts() { irqPending = memory[0xFF0F] & memory[0xFFFF] & 0x1F; }
+
+private:
+    void mapPage(uint8_t page);
+    void mapCodePage(uint8_t page);
+    uint8_t readSlow(uint16_t addr);
+    uint8_t peekSlow(uint16_t addr) const;
+    void writeSlow(uint16_t addr, uint8_t value);
+    uint8_t readJoypad() const;
+    void writeIO(uint16_t addr, uint8_t value);
+    void startDMA(uint8_t page);
+    void finishDMA();
+    bool dmaBlocks(uint8_t page) const;
+    uint8_t dmaIndex() const;
+    uint8_t dmaRead(uint8_t index) const;
+
+    // cartridge.cpp
+    void mapCartPage(uint8_t page);
+    void updateBanks();
+    void writeMBC(uint16_t addr, uint8_t value);
+    uint8_t readCartRAM(uint16_t addr) const;
+    void writeCartRAM(uint16_t addr, uint8_t value);
+    void tickRTC();
+    void writeRTC(uint8_t reg, uint8_t value);
+
+    void handleEvent(const Event& event);
+    void run(uint64_t target, bool stopAtFrame);
+
+    // timer.cpp
+    uint64_t timerTicks(uint64_t from, uint64_t to) const;
+    uint64_t timerNextChange(uint16_t addr) const;
+    void syncTimer();
+    void scheduleTimer();
+    void timerEvent(uint64_t when);
+    void resetDIV();
+    void writeTIMA(uint8_t value);
+    void writeTAC(uint8_t value);
+
+    // serial.cpp
+    void writeSerialControl(uint8_t value);
+    void serialEvent();
+    void linkEvent();
+    void linkPump();
+    void linkExchange();
+
+    // ppu.cpp
+    void lcdEvent(uint64_t when);
+    void setLcdEnabled(bool on);
+    void setLcdMode(uint8_t mode);
+    void compareLYC();
+    uint64_t tileRow(uint16_t tile, int row);
+    void fetchTiles(const uint8_t* mapRow, int first, int count, int row, uint8_t* out);
+    void drawBackground(uint8_t* bg);
+    void drawSprites(uint8_t* obj, uint8_t* attr);
+    void renderLine();
+
+    // display.cpp
+    void presentFrame();
+
+    // apu.cpp
+    void syncApu();
+    void mixApu();
+    void endAudioFrame();
+    uint64_t apuNextChange() const;
+    uint8_t readAPU(uint16_t addr) const;
+    void touchAPU();
+    void writeAPU(uint16_t addr, uint8_t value);
+
+    uint32_t codeKey(uint16_t pc) const;
+    bool buildBlock(Block& b, uint32_t key, uint16_t pc);
+    Block* lookupBlock(uint16_t pc);
+    void runBlocks(uint64_t stop);
+    void runBlock(Block& b, uint64_t limit);
+    void startBlock(const Block& b, Registers& before, uint64_t& lapStart);
+    void finishBlock(Block& b, bool ranNative, const Registers& before, uint64_t lapStart, uint64_t limit);
+    Block* nextSharedBlock(uint64_t target, uint64_t& limit);
+    NativeBlock compileBlock(const Block& b);
+    void skipSpin(const Block& b, const Registers& before, uint64_t lapStart, uint64_t limit);
+    bool skipHalt(uint64_t limit);
+
+    void traceInstruction(uint8_t opcode);
+    void profileAt(bool exactStep);
+    void runProfiled(uint64_t target, bool stopAtFrame);
+
+    friend struct Ops;
+    friend struct Io; // memory.cpp io register handlers
+    friend struct Bench; // Bench/bench.cpp times the private helpers
+    friend struct Tests; // Tests/tests.cpp checks them against each other
+
+    bool serviceInterrupts();
+    uint16_t fetchOperand(const OpInfo& op);
+    bool fetchThreaded(uint64_t stop, uint8_t& opcode, uint16_t& operand);
+
+    bool getFlagZero();
+    bool getFlagSub();
+    bool getFlagHalfCarry();
+    bool getFlagCarry();
+    void setFlagZero(bool c);
+    void setFlagSub(bool c);
+    void setFlagHalfCarry(bool c);
+    void setFlagCarry(bool c);
+
+    uint8_t inc8(uint8_t x);
+    uint8_t dec8(uint8_t x);
+    void pushStack(uint8_t hi, uint8_t lo);
+    void popStack(uint8_t& hi, uint8_t& lo);
+
+    uint8_t add8(uint8_t a, uint8_t b);
+    uint8_t sub8(uint8_t a, uint8_t b);
+    uint8_t adc8(uint8_t a, uint8_t b);
+    uint8_t and8(uint8_t a, uint8_t b);
+    uint8_t or8(uint8_t a, uint8_t b);
+    uint8_t xor8(uint8_t a, uint8_t b);
+    void cp8(uint8_t a, uint8_t b);
+    uint8_t sbc8(uint8_t a, uint8_t b);
+
+    uint8_t rlc8(uint8_t x);
+    uint8_t rrc8(uint8_t x);
+    uint8_t rl8(uint8_t x);
+    uint8_t rr8(uint8_t x);
+    uint8_t sla8(uint8_t x);
+    uint8_t sra8(uint8_t x);
+    uint8_t swap8(uint8_t x);
+    uint8_t srl8(uint8_t x);
+    void bit8(uint8_t bit, uint8_t x);
+    uint16_t add16(uint16_t a, uint16_t b);
+    uint16_t addSP(uint8_t e);
+    void daa();
+
+    void error(uint8_t opcode);
+};
+
+
+inline uint8_t GameBoy::read8(uint16_t addr)
+{
+    if (const uint8_t* page = readPage[addr >> 8]) return page[addr & 0xFF];
+    return readSlow(addr);
+}
+
+inline uint8_t GameBoy::peek8(uint16_t addr) const
+{
+    if (const uint8_t* page = readPage[addr >> 8]) return page[addr & 0xFF];
+    return peekSlow(addr);
+}
+
+inline void GameBoy::write8(uint16_t addr, uint8_t value)
+{
+    if (uint8_t* page = writePage[addr >> 8]) page[addr & 0xFF] = value;
+    else writeSlow(addr, value);
+}
+
+inline void GameBoy::syncFlags()
+{
+#if GB_LAZY_FLAGS
+    if (lazy.op)
+    {
+        regs.F = flags();
+        lazy.op = LAZY_NONE;
+    }
+#endif
+}
+
+inline void GameBoy::setFlags(uint8_t f)
+{
+    regs.F = f;
+#if GB_LAZY_FLAGS
+    lazy.op = LAZY_NONE;
+#endif
+}
+
+// halted with nothing pending, the cpu cant wake before the next event
+// goes straight there in the same 4 cycle steps emulateCycle takes
+inline bool GameBoy::skipHalt(uint64_t limit)
+{
+    if (!halted || limit == UINT64_MAX || irqPending) return false;
+    sched.cycles += (limit - sched.cycles + 3) & ~uint64_t(3);
+    return true;
+}
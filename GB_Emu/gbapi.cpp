@@ -0,0 +1,180 @@
+#include "gbapi.h"
+#include "gameboy.h"
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+
+
+static_assert(sizeof(gb_registers) == sizeof(Registers), "gb_registers has to mirror Registers");
+static_assert(offsetof(gb_registers, sp) == offsetof(Registers, SP), "gb_registers has to mirror Registers");
+static_assert(offsetof(gb_registers, pc) == offsetof(Registers, PC), "gb_registers has to mirror Registers");
+
+struct gb_instance
+{
+    GameBoy gb;
+};
+
+
+gb_instance* gb_create(void)
+{
+    gb_instance* inst = new gb_instance();
+    inst->gb.initMemory();
+    return inst;
+}
+
+void gb_destroy(gb_instance* inst)
+{
+    delete inst;
+}
+
+int gb_load_rom(gb_instance* inst, const uint8_t* data, size_t size)
+{
+    std::shared_ptr<const RomImage> rom = RomImage::fromMemory(data, size);
+    if (!rom) return 0;
+
+    // a reload starts from a console that has never run, nothing of the last rom carries over.
+    // the instance stays where it is, so the pointers handed out before still work
+    GameBoy& gb = inst->gb;
+    const bool jit = gb.jit != nullptr;
+    gb = std::move(*std::make_unique<GameBoy>());
+
+    gb.initMemory();
+    gb.loadROM(rom);
+    gb.bootSetup();
+    gb.postBootSetup();
+    gb.setBlockCache(true);
+    if (jit) gb.setJit(true);
+    gb.syncFlags();
+    return 1;
+}
+
+int gb_set_jit(gb_instance* inst, int on)
+{
+    return inst->gb.setJit(on != 0) && on;
+}
+
+void gb_set_joypad(gb_instance* inst, uint8_t buttons)
+{
+    inst->gb.joypad = buttons;
+}
+
+uint32_t gb_run_frames(gb_instance* inst, uint32_t frames)
+{
+    GameBoy& gb = inst->gb;
+    uint32_t ran = 0;
+    while (ran < frames && !gb.crashed)
+    {
+        gb.runFrame();
+        ran++;
+    }
+    gb.syncFlags(); // regs.F is what gb_regs hands out
+    return ran;
+}
+
+void gb_run_cycles(gb_instance* inst, uint64_t cycles)
+{
+    GameBoy& gb = inst->gb;
+    gb.runUntil(gb.sched.cycles + cycles);
+    gb.syncFlags();
+}
+
+void gb_run_frames_batch(gb_instance* const* instances, const uint8_t* buttons, size_t count, uint32_t frames, unsigned threads)
+{
+    auto runRange = [&](size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; ++i)
+        {
+            if (buttons) instances[i]->gb.joypad = buttons[i];
+            gb_run_frames(instances[i], frames);
+        }
+    };
+
+    threads = unsigned(std::min<size_t>(std::max(threads, 1u), count));
+    if (threads <= 1)
+    {
+        runRange(0, count);
+        return;
+    }
+
+    std::vector<std::thread> pool;
+    size_t per = (count + threads - 1) / threads;
+    for (size_t first = per; first < count; first += per)
+        pool.emplace_back(runRange, first, std::min(count, first + per));
+    runRange(0, per);
+
+    for (auto& t : pool)
+        t.join();
+}
+
+const uint8_t* gb_framebuffer(const gb_instance* inst)
+{
+    return &inst->gb.framebuffer[0][0];
+}
+
+const uint8_t* gb_memory(const gb_instance* inst)
+{
+    return inst->gb.memory;
+}
+
+const uint8_t* gb_wram(const gb_instance* inst)
+{
+    return inst->gb.memory + 0xC000;
+}
+
+const uint8_t* gb_hram(const gb_instance* inst)
+{
+    return inst->gb.memory + 0xFF80;
+}
+
+const uint8_t* gb_cart_ram(const gb_instance* inst, size_t* size)
+{
+    const CartRam& ram = inst->gb.cart.ram;
+    if (size) *size = ram.size();
+    return ram.empty() ? nullptr : ram.data();
+}
+
+const gb_registers* gb_regs(const gb_instance* inst)
+{
+    return reinterpret_cast<const gb_registers*>(&inst->gb.regs);
+}
+
+uint8_t gb_peek(const gb_instance* inst, uint16_t addr)
+{
+    return inst->gb.peek8(addr);
+}
+
+uint64_t gb_cycles(const gb_instance* inst)
+{
+    return inst->gb.sched.cycles;
+}
+
+uint64_t gb_frame_count(const gb_instance* inst)
+{
+    return inst->gb.frameCount;
+}
+
+int gb_crashed(const gb_instance* inst)
+{
+    return inst->gb.crashed;
+}
+
+size_t gb_state_size(const gb_instance* inst)
+{
+    return inst->gb.stateSize();
+}
+
+int gb_save_state(const gb_instance* inst, uint8_t* out, size_t size)
+{
+    if (!out || size < inst->gb.stateSize()) return 0;
+    inst->gb.saveState(out);
+    return 1;
+}
+
+int gb_load_state(gb_instance* inst, const uint8_t* data, size_t size)
+{
+    if (!data || !inst->gb.loadState(data, size)) return 0;
+    inst->gb.syncFlags();
+    return 1;
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    plain c interface for driving the emulator from other languages
+
+    every pointer handed out points straight into the instance and stays valid
+    until gb_destroy, nothing is copied per step. read them between calls only,
+    they change under you while a step is running
+*/
+
+#if defined(_WIN32) && defined(GB_API_EXPORTS)
+#define GB_API __declspec(dllexport)
+#else
+#define GB_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct gb_instance gb_instance;
+
+// same layout as the core's Registers, f is up to date whenever a step call returns
+typedef struct gb_registers
+{
+    uint8_t a, f;
+    uint8_t b, c;
+    uint8_t d, e;
+    uint8_t h, l;
+    uint16_t sp;
+    uint16_t pc;
+} gb_registers;
+
+// joypad bits, set = pressed
+#define GB_BUTTON_RIGHT  0x01
+#define GB_BUTTON_LEFT   0x02
+#define GB_BUTTON_UP     0x04
+#define GB_BUTTON_DOWN   0x08
+#define GB_BUTTON_A      0x10
+#define GB_BUTTON_B      0x20
+#define GB_BUTTON_SELECT 0x40
+#define GB_BUTTON_START  0x80
+
+#define GB_SCREEN_WIDTH  160
+#define GB_SCREEN_HEIGHT 144
+
+GB_API gb_instance* gb_create(void);
+GB_API void gb_destroy(gb_instance* gb);
+
+// copies the rom in and boots to the cartridge entry point, 1 = ok
+// loading into an instance that has run before starts it over, only the jit setting is kept
+GB_API int gb_load_rom(gb_instance* gb, const uint8_t* data, size_t size);
+// x86-64 only, 1 if the jit is now on
+GB_API int gb_set_jit(gb_instance* gb, int on);
+
+GB_API void gb_set_joypad(gb_instance* gb, uint8_t buttons);
+
+// both stop early if the cpu hits a bad opcode, run frames returns how many it ran
+GB_API uint32_t gb_run_frames(gb_instance* gb, uint32_t frames);
+GB_API void gb_run_cycles(gb_instance* gb, uint64_t cycles);
+
+// buttons[i] (or nothing when buttons is null) then frames for every instance
+// threads > 1 splits the instances across that many threads for the call
+GB_API void gb_run_frames_batch(gb_instance* const* instances, const uint8_t* buttons, size_t count, uint32_t frames, unsigned threads);
+
+// 160x144 shades, 0 = white .. 3 = black, row by row
+GB_API const uint8_t* gb_framebuffer(const gb_instance* gb);
+// the 64KB address space as the core stores it: vram, wram, oam, io and hram are live except DIV and TIMA,
+// which are worked out when read, the rom and cartridge ram windows are banked elsewhere, use gb_peek or gb_cart_ram for those
+GB_API const uint8_t* gb_memory(const gb_instance* gb);
+GB_API const uint8_t* gb_wram(const gb_instance* gb); // 8KB at 0xC000
+GB_API const uint8_t* gb_hram(const gb_instance* gb); // 127 bytes at 0xFF80
+GB_API const uint8_t* gb_cart_ram(const gb_instance* gb, size_t* size); // null when the cart has none
+GB_API const gb_registers* gb_regs(const gb_instance* gb);
+// what the cpu would read at addr, without the side effects a real read could have
+GB_API uint8_t gb_peek(const gb_instance* gb, uint16_t addr);
+
+GB_API uint64_t gb_cycles(const gb_instance* gb);
+GB_API uint64_t gb_frame_count(const gb_instance* gb);
+GB_API int gb_crashed(const gb_instance* gb);
+
+// snapshots for resetting episodes, 1 = ok
+GB_API size_t gb_state_size(const gb_instance* gb);
+GB_API int gb_save_state(const gb_instance* gb, uint8_t* out, size_t size);
+GB_API int gb_load_state(gb_instance* gb, const uint8_t* data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
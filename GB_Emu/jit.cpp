@@ -0,0 +1,837 @@
+#include "jit.h"
+#include "gameboy.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if GB_JIT_X64
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#endif
+
+
+#if GB_JIT_X64
+
+enum HostReg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+#ifdef _WIN32
+static constexpr int ARG0 = RCX, ARG1 = RDX, ARG2 = R8;
+static constexpr uint32_t FRAME = 40; // shadow space + alignment
+#else
+static constexpr int ARG0 = RDI, ARG1 = RSI, ARG2 = RDX;
+static constexpr uint32_t FRAME = 8;
+#endif
+
+// all callee saved so calls out only need the sm83 state spilled when the callee reads it
+// pairs keep the high register (B, D, H) in bits 8-15 and zero above
+static constexpr int REG_GB = RBX, REG_F = RBP, REG_BC = R12, REG_DE = R13, REG_HL = R14, REG_A = R15;
+
+enum Cond { CC_E = 0x4, CC_NE = 0x5 };
+
+static constexpr uint8_t FLAGS_ALL = 0xF0;
+
+
+// just the handful of encodings the block compiler needs
+// memory operands are always [rbx + disp32]
+struct Emitter
+{
+    std::vector<uint8_t> buf;
+
+    void u8(uint8_t v) { buf.push_back(v); }
+    void u16(uint16_t v) { u8(v & 0xFF); u8(v >> 8); }
+    void u32(uint32_t v) { u16(v & 0xFFFF); u16(v >> 16); }
+    void u64(uint64_t v) { u32(uint32_t(v)); u32(uint32_t(v >> 32)); }
+
+    // byte ops on spl/bpl/sil/dil need an empty rex or they mean ah/ch/dh/bh
+    void rex(bool w, int reg, int rm, bool byteOp)
+    {
+        uint8_t r = 0x40 | (w << 3) | ((reg & 8) >> 1) | ((rm & 8) >> 3);
+        bool lowByte = byteOp && ((reg >= 4 && reg < 8) || (rm >= 4 && rm < 8));
+        if (r != 0x40 || lowByte) u8(r);
+    }
+
+    void op(std::initializer_list<uint8_t> bytes) { for (uint8_t b : bytes) u8(b); }
+
+    void regOp(std::initializer_list<uint8_t> bytes, int reg, int rm, bool w = false, bool byteOp = false, bool word = false)
+    {
+        if (word) u8(0x66);
+        rex(w, reg, rm, byteOp);
+        op(bytes);
+        u8(0xC0 | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    void memOp(std::initializer_list<uint8_t> bytes, int reg, int32_t disp, bool w = false, bool byteOp = false, bool word = false)
+    {
+        if (word) u8(0x66);
+        rex(w, reg, REG_GB, byteOp);
+        op(bytes);
+        u8(0x80 | ((reg & 7) << 3) | (REG_GB & 7));
+        u32(uint32_t(disp));
+    }
+
+    void mov32(int dst, int src) { regOp({ 0x89 }, src, dst); }
+    void mov64(int dst, int src) { regOp({ 0x89 }, src, dst, true); }
+    void mov8(int dst, int src) { regOp({ 0x88 }, src, dst, false, true); }
+    void movzx8(int dst, int src) { regOp({ 0x0F, 0xB6 }, dst, src, false, true); }
+    void movzx16(int dst, int src) { regOp({ 0x0F, 0xB7 }, dst, src); }
+    void movImm(int dst, uint32_t imm) { rex(false, 0, dst, false); u8(0xB8 + (dst & 7)); u32(imm); }
+    void movImm64(int dst, uint64_t imm) { rex(true, 0, dst, false); u8(0xB8 + (dst & 7)); u64(imm); }
+
+    void alu8(uint8_t opcode, int dst, int src) { regOp({ opcode }, src, dst, false, true); }
+    void or32(int dst, int src) { regOp({ 0x09 }, src, dst); }
+    void aluImm(int ext, int dst, uint32_t imm) { regOp({ 0x81 }, ext, dst); u32(imm); }
+    void aluImm64(int ext, int dst, uint32_t imm) { regOp({ 0x81 }, ext, dst, true); u32(imm); }
+    void shiftImm(int ext, int dst, uint8_t count) { regOp({ 0xC1 }, ext, dst); u8(count); }
+    void swap16(int dst) { regOp({ 0xC1 }, 0, dst, false, false, true); u8(8); } // rol r16, 8
+    void incDec8(int ext, int dst) { regOp({ 0xFE }, ext, dst, false, true); }
+    void incDec16(int ext, int dst) { regOp({ 0xFF }, ext, dst, false, false, true); }
+    void not8(int dst) { regOp({ 0xF6 }, 2, dst, false, true); }
+    void testImm(int dst, uint32_t imm) { regOp({ 0xF7 }, 0, dst); u32(imm); }
+    void testAl(uint8_t imm) { u8(0xA8); u8(imm); }
+    void bt(int dst, uint8_t bit) { regOp({ 0x0F, 0xBA }, 4, dst); u8(bit); }
+    void setcc(Cond cc, int dst) { regOp({ 0x0F, uint8_t(0x90 | cc) }, 0, dst, false, true); }
+    void lahf() { u8(0x9F); }
+    void movzxAh(int dst) { op({ 0x0F, 0xB6, uint8_t(0xC4 | (dst << 3)) }); } // dst must be eax-ebx, no rex allowed
+
+    void loadByte(int dst, int32_t disp) { memOp({ 0x0F, 0xB6 }, dst, disp); }
+    void loadWord(int dst, int32_t disp) { memOp({ 0x0F, 0xB7 }, dst, disp); }
+    void storeByte(int32_t disp, int src) { memOp({ 0x88 }, src, disp, false, true); }
+    void storeWord(int32_t disp, int src) { memOp({ 0x89 }, src, disp, false, false, true); }
+    void storeWordImm(int32_t disp, uint16_t imm) { memOp({ 0xC7 }, 0, disp, false, false, true); u16(imm); }
+    void incDecWordMem(int ext, int32_t disp) { memOp({ 0xFF }, ext, disp, false, false, true); }
+    void addQwordMem(int32_t disp, uint32_t imm) { memOp({ 0x81 }, 0, disp, true); u32(imm); }
+    void cmpByteMem(int32_t disp, uint8_t imm) { memOp({ 0x80 }, 7, disp); u8(imm); }
+
+    // page table walk: rax = [rbx + rax * 8 + disp], then bytes at [rax + rcx]
+    void loadPage(int32_t disp) { op({ 0x48, 0x8B, 0x84, 0xC3 }); u32(uint32_t(disp)); }
+    void testRax() { op({ 0x48, 0x85, 0xC0 }); }
+    void loadPageByte() { op({ 0x0F, 0xB6, 0x04, 0x08 }); }
+    void storePageByte(int src) { rex(false, src, 0, true); op({ 0x88, uint8_t(0x04 | ((src & 7) << 3)), 0x08 }); }
+
+    void push(int r) { rex(false, 0, r, false); u8(0x50 + (r & 7)); }
+    void pop(int r) { rex(false, 0, r, false); u8(0x58 + (r & 7)); }
+    void call(const void* fn) { movImm64(RAX, uint64_t(fn)); regOp({ 0xFF }, 2, RAX); }
+    void ret() { u8(0xC3); }
+
+    // forward jumps only, returns the rel32 to patch with bind
+    size_t jcc(Cond cc) { op({ 0x0F, uint8_t(0x80 | cc) }); u32(0); return buf.size() - 4; }
+    size_t jmp() { u8(0xE9); u32(0); return buf.size() - 4; }
+    void bind(size_t at)
+    {
+        uint32_t rel = uint32_t(buf.size() - (at + 4));
+        std::memcpy(&buf[at], &rel, 4);
+    }
+};
+
+
+static uint8_t jitRead(GameBoy* gb, uint32_t addr) { return gb->read8(uint16_t(addr)); }
+static void jitWrite(GameBoy* gb, uint32_t addr, uint32_t value) { gb->write8(uint16_t(addr), uint8_t(value)); }
+
+#if GB_LAZY_FLAGS
+// handlers may leave the flags lazy, native code reloads F straight after them
+static void jitHandler(GameBoy* gb, uint32_t operand, OpHandler handler)
+{
+    handler(*gb, uint16_t(operand));
+    gb->syncFlags();
+}
+#endif
+
+
+// which flags an op reads and writes, false = no native version, call its handler instead
+// handlers see gb.regs.F and anything that can leave the block early needs F up to date,
+// so both count as reading every flag
+static bool describe(const MicroOp& op, uint8_t& reads, uint8_t& writes)
+{
+    const uint8_t o = op.opcode;
+    const int x = o >> 6, y = (o >> 3) & 7, z = o & 7;
+    reads = 0;
+    writes = 0;
+
+    if (o == 0xCB)
+    {
+        const uint8_t cb = op.operand & 0xFF;
+        if ((cb >> 6) != 1 || (cb & 7) == 6) return false;
+        writes = 0xE0; // bit, carry kept
+        return true;
+    }
+
+    if (x == 1)
+    {
+        if (o == 0x76) return false;
+        if (y == 6) reads = FLAGS_ALL;
+        return true;
+    }
+    if (x == 2 || (x == 3 && z == 6))
+    {
+        writes = FLAGS_ALL;
+        if (y == 1 || y == 3) reads = 0x10;
+        return true;
+    }
+
+    switch (o)
+    {
+    case 0x00: case 0x01: case 0x11: case 0x21: case 0x31:
+    case 0x03: case 0x13: case 0x23: case 0x33: case 0x0B: case 0x1B: case 0x2B: case 0x3B:
+    case 0x0A: case 0x1A: case 0x2A: case 0x3A: case 0xF0: case 0xF2: case 0xFA:
+    case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E:
+    case 0x18: case 0xC3:
+        return true;
+    case 0x02: case 0x12: case 0x22: case 0x32: case 0x36: case 0xE0: case 0xE2: case 0xEA:
+        reads = FLAGS_ALL;
+        return true;
+    case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x3C:
+    case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x3D:
+        writes = 0xE0;
+        return true;
+    case 0x2F: writes = 0x60; return true;
+    case 0x37: writes = 0x70; return true;
+    case 0x3F: writes = 0x70; reads = 0x10; return true;
+    case 0x20: case 0x28: case 0xC2: case 0xCA: reads = 0x80; return true;
+    case 0x30: case 0x38: case 0xD2: case 0xDA: reads = 0x10; return true;
+    }
+    return false;
+}
+
+
+class BlockCompiler
+{
+public:
+    BlockCompiler(const GameBoy& gb)
+    {
+        auto offset = [&gb](const void* field) { return int32_t(reinterpret_cast<const uint8_t*>(field) - reinterpret_cast<const uint8_t*>(&gb)); };
+        offA = offset(&gb.regs.A);
+        offF = offset(&gb.regs.F);
+        offB = offset(&gb.regs.B);
+        offD = offset(&gb.regs.D);
+        offH = offset(&gb.regs.H);
+        offSP = offset(&gb.regs.SP);
+        offPC = offset(&gb.regs.PC);
+        offCycles = offset(&gb.sched.cycles);
+        offBreak = offset(&gb.blockBreak);
+        offReadPage = offset(&gb.readPage[0]);
+        offWritePage = offset(&gb.writePage[0]);
+    }
+
+    std::vector<uint8_t>& compile(const Block& b);
+
+private:
+    Emitter e;
+    int32_t offA, offF, offB, offD, offH, offSP, offPC, offCycles, offBreak, offReadPage, offWritePage;
+    uint32_t pending = 0;       // cycles charged at compile time but not yet added to sched.cycles
+    std::vector<size_t> exits;  // jumps to the epilogue, PC and cycles already stored
+
+    void loadRegs();
+    void storeRegs();
+    void flushCycles();
+    void exitIfBreak(uint16_t pc);
+    int pair(int p) const { return p == 0 ? REG_BC : p == 1 ? REG_DE : REG_HL; }
+
+    void loadR(int r, int dst);
+    void storeR(int r, int src);
+    void read(int addrReg);
+    void write(int addrReg, int valueReg);
+
+    void arithFlags(uint8_t n);
+    void zeroFlag(uint8_t extra);
+    void incDecFlags(bool dec);
+
+    void fallback(const MicroOp& op, uint16_t next, bool last);
+    bool branch(const MicroOp& op, uint16_t next);
+    void emit(const MicroOp& op, uint16_t next, bool flags);
+};
+
+
+void BlockCompiler::loadRegs()
+{
+    e.loadByte(REG_A, offA);
+    e.loadByte(REG_F, offF);
+
+    // B sits below C in memory, so the little endian word comes in byte swapped
+    e.loadWord(REG_BC, offB);
+    e.swap16(REG_BC);
+    e.loadWord(REG_DE, offD);
+    e.swap16(REG_DE);
+    e.loadWord(REG_HL, offH);
+    e.swap16(REG_HL);
+}
+
+void BlockCompiler::storeRegs()
+{
+    e.storeByte(offA, REG_A);
+    e.storeByte(offF, REG_F);
+
+    const int pairs[3] = { REG_BC, REG_DE, REG_HL };
+    const int32_t offs[3] = { offB, offD, offH };
+    for (int i = 0; i < 3; ++i)
+    {
+        e.mov32(RAX, pairs[i]);
+        e.swap16(RAX);
+        e.storeWord(offs[i], RAX);
+    }
+}
+
+void BlockCompiler::flushCycles()
+{
+    if (!pending) return;
+    e.addQwordMem(offCycles, pending);
+    pending = 0;
+}
+
+// a write hit io or cached code, hand back to runBlocks before the next op
+void BlockCompiler::exitIfBreak(uint16_t pc)
+{
+    e.cmpByteMem(offBreak, 0);
+    size_t stay = e.jcc(CC_E);
+    e.storeWordImm(offPC, pc);
+    exits.push_back(e.jmp());
+    e.bind(stay);
+}
+
+
+// r is the usual sm83 encoding, 6 = (hl) is handled by the caller
+void BlockCompiler::loadR(int r, int dst)
+{
+    switch (r)
+    {
+    case 0: case 2: case 4:
+        e.mov32(dst, pair(r >> 1));
+        e.shiftImm(5, dst, 8);
+        break;
+    case 1: case 3: case 5:
+        e.movzx8(dst, pair(r >> 1));
+        break;
+    case 7:
+        e.movzx8(dst, REG_A);
+        break;
+    }
+}
+
+// src is clobbered
+void BlockCompiler::storeR(int r, int src)
+{
+    switch (r)
+    {
+    case 0: case 2: case 4:
+        e.movzx8(src, src);
+        e.shiftImm(4, src, 8);
+        e.aluImm(4, pair(r >> 1), 0xFF);
+        e.or32(pair(r >> 1), src);
+        break;
+    case 1: case 3: case 5:
+        e.mov8(pair(r >> 1), src);
+        break;
+    case 7:
+        e.mov8(REG_A, src);
+        break;
+    }
+}
+
+// same fast path as read8/write8, only pages without a pointer call out
+// result in al
+void BlockCompiler::read(int addrReg)
+{
+    flushCycles();
+    if (addrReg != ARG1) e.movzx16(ARG1, addrReg);
+    e.mov32(RAX, ARG1);
+    e.shiftImm(5, RAX, 8);
+    e.loadPage(offReadPage);
+    e.testRax();
+    size_t slow = e.jcc(CC_E);
+    e.movzx8(RCX, ARG1);
+    e.loadPageByte();
+    size_t done = e.jmp();
+
+    e.bind(slow);
+    e.mov64(ARG0, REG_GB);
+    e.call(reinterpret_cast<const void*>(&jitRead));
+    e.bind(done);
+}
+
+void BlockCompiler::write(int addrReg, int valueReg)
+{
+    flushCycles();
+    if (addrReg != ARG1) e.movzx16(ARG1, addrReg);
+    if (valueReg != ARG2) e.movzx8(ARG2, valueReg);
+    e.mov32(RAX, ARG1);
+    e.shiftImm(5, RAX, 8);
+    e.loadPage(offWritePage);
+    e.testRax();
+    size_t slow = e.jcc(CC_E);
+    e.movzx8(RCX, ARG1);
+    e.storePageByte(ARG2);
+    size_t done = e.jmp();
+
+    e.bind(slow);
+    e.mov64(ARG0, REG_GB);
+    e.call(reinterpret_cast<const void*>(&jitWrite));
+    e.bind(done);
+}
+
+
+// lahf gives SF ZF - AF - PF - CF, sm83 wants Z N H C in the top nibble
+void BlockCompiler::arithFlags(uint8_t n)
+{
+    e.lahf();
+    e.movzxAh(RAX);
+    e.mov32(RCX, RAX);
+    e.aluImm(4, RCX, 0x40);
+    e.shiftImm(4, RCX, 1);
+    e.mov32(RDX, RAX);
+    e.aluImm(4, RDX, 0x10);
+    e.shiftImm(4, RDX, 1);
+    e.aluImm(4, RAX, 0x01);
+    e.shiftImm(4, RAX, 4);
+    e.or32(RAX, RCX);
+    e.or32(RAX, RDX);
+    if (n) e.aluImm(1, RAX, n);
+    e.mov32(REG_F, RAX);
+}
+
+void BlockCompiler::zeroFlag(uint8_t extra)
+{
+    e.setcc(CC_E, RAX);
+    e.movzx8(RAX, RAX);
+    e.shiftImm(4, RAX, 7);
+    if (extra) e.aluImm(1, RAX, extra);
+    e.mov32(REG_F, RAX);
+}
+
+// x86 inc/dec leave CF alone just like the sm83, al still holds the result afterwards
+void BlockCompiler::incDecFlags(bool dec)
+{
+    e.lahf();
+    e.movzxAh(RCX);
+    e.mov32(RDX, RCX);
+    e.aluImm(4, RDX, 0x40);
+    e.shiftImm(4, RDX, 1);
+    e.aluImm(4, RCX, 0x10);
+    e.shiftImm(4, RCX, 1);
+    e.or32(RDX, RCX);
+    e.aluImm(4, REG_F, 0x10);
+    e.or32(REG_F, RDX);
+    if (dec) e.aluImm(1, REG_F, 0x40);
+}
+
+
+// anything without a native version runs its interpreter handler against gb.regs
+void BlockCompiler::fallback(const MicroOp& op, uint16_t next, bool last)
+{
+    storeRegs();
+    e.storeWordImm(offPC, next);
+    flushCycles();
+
+    e.mov64(ARG0, REG_GB);
+    e.movImm(ARG1, op.operand);
+#if GB_LAZY_FLAGS
+    e.movImm64(ARG2, uint64_t(op.handler));
+    e.call(reinterpret_cast<const void*>(&jitHandler));
+#else
+    e.call(reinterpret_cast<const void*>(op.handler));
+#endif
+    loadRegs();
+
+    // the handler owns PC from here, it may have jumped
+    if (!last)
+    {
+        e.cmpByteMem(offBreak, 0);
+        exits.push_back(e.jcc(CC_NE));
+    }
+}
+
+// jr/jp, always the last op, returns false if op isnt one
+bool BlockCompiler::branch(const MicroOp& op, uint16_t next)
+{
+    uint16_t target;
+    switch (op.opcode)
+    {
+    case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+        target = uint16_t(next + int8_t(op.operand & 0xFF));
+        break;
+    case 0xC3: case 0xC2: case 0xCA: case 0xD2: case 0xDA:
+        target = op.operand;
+        break;
+    default:
+        return false;
+    }
+
+    if (op.opcode == 0x18 || op.opcode == 0xC3)
+    {
+        flushCycles();
+        e.storeWordImm(offPC, target);
+        exits.push_back(e.jmp());
+        return true;
+    }
+
+    // cc is NZ Z NC C for both families
+    const int cc = (op.opcode >> 3) & 3;
+    e.testImm(REG_F, cc < 2 ? 0x80 : 0x10);
+    size_t notTaken = e.jcc((cc & 1) ? CC_E : CC_NE);
+
+    e.addQwordMem(offCycles, pending + opTable[op.opcode].takenCycles);
+    e.storeWordImm(offPC, target);
+    exits.push_back(e.jmp());
+
+    e.bind(notTaken);
+    flushCycles();
+    e.storeWordImm(offPC, next);
+    exits.push_back(e.jmp());
+    return true;
+}
+
+void BlockCompiler::emit(const MicroOp& op, uint16_t next, bool flags)
+{
+    const uint8_t o = op.opcode;
+    const int x = o >> 6, y = (o >> 3) & 7, z = o & 7;
+    const uint8_t n = op.operand & 0xFF;
+
+    if (o == 0xCB)
+    {
+        // bit b, r: only flags change
+        if (!flags) return;
+        loadR(n & 7, RAX);
+        e.testAl(uint8_t(1 << ((n >> 3) & 7)));
+        e.setcc(CC_E, RCX);
+        e.movzx8(RCX, RCX);
+        e.shiftImm(4, RCX, 7);
+        e.aluImm(4, REG_F, 0x10);
+        e.aluImm(1, REG_F, 0x20);
+        e.or32(REG_F, RCX);
+        return;
+    }
+
+    if (x == 1)
+    {
+        if (z == 6)
+        {
+            read(REG_HL);
+            storeR(y, RAX);
+        }
+        else if (y == 6)
+        {
+            loadR(z, ARG2);
+            write(REG_HL, ARG2);
+            exitIfBreak(next);
+        }
+        else if (y != z)
+        {
+            loadR(z, RAX);
+            storeR(y, RAX);
+        }
+        return;
+    }
+
+    if (x == 2 || (x == 3 && z == 6))
+    {
+        if (x == 3) e.movImm(RCX, n);
+        else if (z == 6)
+        {
+            read(REG_HL);
+            e.mov32(RCX, RAX);
+        }
+        else loadR(z, RCX);
+
+        static const uint8_t aluOps[8] = { 0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38 };
+        if (y == 1 || y == 3) e.bt(REG_F, 4);
+        e.alu8(aluOps[y], REG_A, RCX);
+
+        if (!flags) return;
+        if (y == 4) zeroFlag(0x20);
+        else if (y == 5 || y == 6) zeroFlag(0);
+        else arithFlags(y >= 2 ? 0x40 : 0);
+        return;
+    }
+
+    switch (o)
+    {
+    case 0x00:
+        return;
+
+    case 0x01: case 0x11: case 0x21:
+        e.movImm(pair(y >> 1), op.operand);
+        return;
+    case 0x31:
+        e.storeWordImm(offSP, op.operand);
+        return;
+
+    case 0x03: case 0x13: case 0x23:
+        e.incDec16(0, pair(y >> 1));
+        return;
+    case 0x0B: case 0x1B: case 0x2B:
+        e.incDec16(1, pair(y >> 1));
+        return;
+    case 0x33:
+        e.incDecWordMem(0, offSP);
+        return;
+    case 0x3B:
+        e.incDecWordMem(1, offSP);
+        return;
+
+    case 0x02: case 0x12:
+        write(pair(y >> 1), REG_A);
+        exitIfBreak(next);
+        return;
+    case 0x22: case 0x32:
+        write(REG_HL, REG_A);
+        e.incDec16(o == 0x32, REG_HL);
+        exitIfBreak(next);
+        return;
+    case 0x0A: case 0x1A:
+        read(pair(y >> 1));
+        e.mov8(REG_A, RAX);
+        return;
+    case 0x2A: case 0x3A:
+        read(REG_HL);
+        e.mov8(REG_A, RAX);
+        e.incDec16(o == 0x3A, REG_HL);
+        return;
+
+    case 0xE0: case 0xEA:
+        e.movImm(ARG1, o == 0xE0 ? 0xFF00 | n : op.operand);
+        write(ARG1, REG_A);
+        exitIfBreak(next);
+        return;
+    case 0xE2:
+        e.movzx8(ARG1, REG_BC);
+        e.aluImm(0, ARG1, 0xFF00);
+        write(ARG1, REG_A);
+        exitIfBreak(next);
+        return;
+    case 0xF0: case 0xFA:
+        e.movImm(ARG1, o == 0xF0 ? 0xFF00 | n : op.operand);
+        read(ARG1);
+        e.mov8(REG_A, RAX);
+        return;
+    case 0xF2:
+        e.movzx8(ARG1, REG_BC);
+        e.aluImm(0, ARG1, 0xFF00);
+        read(ARG1);
+        e.mov8(REG_A, RAX);
+        return;
+
+    case 0x36:
+        e.movImm(ARG2, n);
+        write(REG_HL, ARG2);
+        exitIfBreak(next);
+        return;
+    case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E:
+        e.movImm(RAX, n);
+        storeR(y, RAX);
+        return;
+
+    case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x3C:
+    case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x3D:
+        loadR(y, RAX);
+        e.incDec8(z == 5, RAX);
+        if (flags) incDecFlags(z == 5);
+        storeR(y, RAX);
+        return;
+
+    case 0x2F:
+        e.not8(REG_A);
+        if (flags) e.aluImm(1, REG_F, 0x60);
+        return;
+    case 0x37:
+        if (!flags) return;
+        e.aluImm(4, REG_F, 0x80);
+        e.aluImm(1, REG_F, 0x10);
+        return;
+    case 0x3F:
+        if (!flags) return;
+        e.aluImm(4, REG_F, 0x90);
+        e.aluImm(6, REG_F, 0x10);
+        return;
+    }
+}
+
+
+std::vector<uint8_t>& BlockCompiler::compile(const Block& b)
+{
+    // backwards pass: which flags are still needed after each op
+    // everything is live at the block exit since the next block could read any of it
+    uint8_t live[Block::MAX_OPS + 1];
+    uint8_t writes[Block::MAX_OPS];
+    bool native[Block::MAX_OPS];
+    live[b.count] = FLAGS_ALL;
+    for (int i = b.count - 1; i >= 0; --i)
+    {
+        uint8_t reads;
+        native[i] = describe(b.ops[i], reads, writes[i]);
+        if (!native[i]) reads = FLAGS_ALL;
+        live[i] = (live[i + 1] & ~writes[i]) | reads;
+    }
+
+    // prologue, 6 pushes + FRAME keeps rsp 16 byte aligned for calls out
+    const int saved[6] = { RBX, RBP, R12, R13, R14, R15 };
+    for (int r : saved) e.push(r);
+    e.aluImm64(5, RSP, FRAME);
+    e.mov64(REG_GB, ARG0);
+    loadRegs();
+
+    uint16_t pc = b.start;
+    bool pcStored = false;
+    for (int i = 0; i < b.count; ++i)
+    {
+        const MicroOp& op = b.ops[i];
+        const uint16_t next = pc + op.length;
+        const bool last = i + 1 == b.count;
+        pending += op.cycles;
+
+        if (!native[i])
+        {
+            fallback(op, next, last);
+            pcStored = true;
+        }
+        else if (last && branch(op, next))
+        {
+            pcStored = true;
+        }
+        else
+        {
+            emit(op, next, (live[i + 1] & writes[i]) != 0);
+            pcStored = false;
+        }
+        pc = next;
+    }
+
+    if (!pcStored) e.storeWordImm(offPC, b.end);
+    flushCycles();
+
+    for (size_t at : exits) e.bind(at);
+    storeRegs();
+    e.aluImm64(0, RSP, FRAME);
+    for (int i = 5; i >= 0; --i) e.pop(saved[i]);
+    e.ret();
+    return e.buf;
+}
+
+
+static size_t pageSize()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    return size_t(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+// mapped writable, then flipped to read/execute before anything runs from it
+Jit::Jit()
+{
+#ifdef _WIN32
+    code = static_cast<uint8_t*>(VirtualAlloc(nullptr, CODE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+#else
+    void* p = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    code = p == MAP_FAILED ? nullptr : static_cast<uint8_t*>(p);
+#endif
+    if (code && !protect(0, CODE_SIZE, false)) release();
+}
+
+Jit::~Jit()
+{
+    release();
+}
+
+void Jit::release()
+{
+    if (!code) return;
+#ifdef _WIN32
+    VirtualFree(code, 0, MEM_RELEASE);
+#else
+    munmap(code, CODE_SIZE);
+#endif
+    code = nullptr;
+    used = 0;
+}
+
+// whole pages around [from, to)
+bool Jit::protect(size_t from, size_t to, bool writable)
+{
+    const size_t page = pageSize();
+    const size_t first = from / page * page;
+    const size_t last = std::min(CODE_SIZE, (to + page - 1) / page * page);
+#ifdef _WIN32
+    DWORD old;
+    return VirtualProtect(code + first, last - first, writable ? PAGE_READWRITE : PAGE_EXECUTE_READ, &old) != 0;
+#else
+    return mprotect(code + first, last - first, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+#endif
+}
+
+NativeBlock Jit::compile(const GameBoy& gb, const Block& b)
+{
+    if (!code) return nullptr;
+
+    BlockCompiler compiler(gb);
+    const std::vector<uint8_t>& out = compiler.compile(b);
+    if (used + out.size() > CODE_SIZE) return nullptr;
+
+    uint8_t* at = code + used;
+    if (!protect(used, used + out.size(), true))
+    {
+        release();
+        return nullptr;
+    }
+    std::memcpy(at, out.data(), out.size());
+    if (!protect(used, used + out.size(), false))
+    {
+        release();
+        return nullptr;
+    }
+#ifdef _WIN32
+    FlushInstructionCache(GetCurrentProcess(), at, out.size());
+#endif
+
+    used = (used + out.size() + 15) & ~size_t(15);
+    return reinterpret_cast<NativeBlock>(at);
+}
+
+#else
+
+Jit::Jit() {}
+Jit::~Jit() {}
+NativeBlock Jit::compile(const GameBoy&, const Block&) { return nullptr; }
+
+#endif
+
+
+bool GameBoy::setJit(bool on)
+{
+    if (!on)
+    {
+        jit.reset();
+        if (blocks) blocks->dropNative();
+        return true;
+    }
+    if (jit) return true;
+
+    auto j = std::make_unique<Jit>();
+    if (!j->ok()) return false;
+
+    setBlockCache(true);
+    jit = std::move(j);
+    return true;
+}
+
+NativeBlock GameBoy::compileBlock(const Block& b)
+{
+    if (NativeBlock fn = jit->compile(*this, b)) return fn;
+
+    // the host stopped letting the code buffer change protection, carry on interpreting blocks
+    if (!jit->ok())
+    {
+        setJit(false);
+        return nullptr;
+    }
+
+    // code buffer is full, throw all of it away and start again with this block
+    blocks->dropNative();
+    jit->flush();
+    return jit->compile(*this, b);
+}
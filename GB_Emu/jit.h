@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "blockcache.h"
+
+// the recompiler only knows how to emit x86-64, everywhere else blocks stay interpreted
+#if defined(__x86_64__) || defined(_M_X64)
+#define GB_JIT_X64 1
+#else
+#define GB_JIT_X64 0
+#endif
+
+
+// turns hot cached blocks into native code
+// a, f, bc, de and hl live in host registers while a block runs and only go back to
+// gb.regs around calls out, flags are only worked out when something later reads them
+// blocks still only run when they finish before the next event, so interrupts and events
+// are checked on block exits exactly like the interpreted blocks
+class Jit
+{
+public:
+    static constexpr uint16_t HOT_THRESHOLD = 8; // interpreted runs before a block gets compiled
+    static constexpr size_t CODE_SIZE = 1 << 20;
+
+    Jit();
+    ~Jit();
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    // false when the host wont hand out executable memory, or stopped letting its protection change
+    bool ok() const { return code != nullptr; }
+
+    // null when the code buffer is full, flush and drop every block's native pointer then retry.
+    // if the buffer cant be made writable and back it is freed, ok() turns false and
+    // every native pointer handed out so far is dead
+    NativeBlock compile(const GameBoy& gb, const Block& b);
+    void flush() { used = 0; }
+
+private:
+    // the buffer is never writable and executable at once, it is read/execute except
+    // for the pages a new block is being copied into
+    bool protect(size_t from, size_t to, bool writable);
+    void release();
+
+    uint8_t* code = nullptr;
+    size_t used = 0;
+};
@@ -0,0 +1,196 @@
+#include "link.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static constexpr std::chrono::milliseconds PEER_CHECK(100); // how often a waiting end looks for the other end's process
+
+
+static uint32_t thisProcess()
+{
+#ifdef _WIN32
+    return uint32_t(GetCurrentProcessId());
+#else
+    return uint32_t(getpid());
+#endif
+}
+
+// an end that has not said who it is yet counts as there
+static bool processAlive(uint32_t pid)
+{
+    if (pid == 0) return true;
+#ifdef _WIN32
+    HANDLE h = OpenProcess(SYNCHRONIZE, FALSE, DWORD(pid));
+    if (!h) return GetLastError() == ERROR_ACCESS_DENIED;
+    bool alive = WaitForSingleObject(h, 0) == WAIT_TIMEOUT;
+    CloseHandle(h);
+    return alive;
+#else
+    return kill(pid_t(pid), 0) == 0 || errno == EPERM;
+#endif
+}
+
+#ifndef _WIN32
+// a name left behind by ends that died without unplugging, nobody is coming back for it
+static bool stale(const LinkShared& shared)
+{
+    const uint32_t ends = std::min(shared.ends.load(), 2u);
+    for (uint32_t i = 0; i < ends; ++i)
+    {
+        if (processAlive(shared.clock[i].owner.load())) return false;
+    }
+    return ends != 0;
+}
+#endif
+
+
+std::pair<std::unique_ptr<LinkCable>, std::unique_ptr<LinkCable>> LinkCable::pair()
+{
+    auto shared = std::make_shared<LinkShared>();
+    shared->ends = 2;
+    shared->clock[0].owner = thisProcess();
+    shared->clock[1].owner = thisProcess();
+
+    std::unique_ptr<LinkCable> a(new LinkCable(shared.get(), 0));
+    std::unique_ptr<LinkCable> b(new LinkCable(shared.get(), 1));
+    a->local = shared;
+    b->local = shared;
+    return { std::move(a), std::move(b) };
+}
+
+// fresh shared memory comes zeroed, which is an empty cable with both clocks at 0
+std::unique_ptr<LinkCable> LinkCable::open(const std::string& name)
+{
+    const std::string path = "gbemu-link-" + name;
+    void* p = nullptr;
+
+#ifdef _WIN32
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(LinkShared), ("Local\\" + path).c_str());
+    if (mapping) p = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(LinkShared));
+    if (!p)
+    {
+        if (mapping) CloseHandle(mapping);
+        std::cerr << "link " << name << " couldnt be opened!" << "\n";
+        return nullptr;
+    }
+#else
+    // windows drops a mapping with its last handle, here the name outlives a crashed end
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        int fd = shm_open(("/" + path).c_str(), O_RDWR | O_CREAT, 0600);
+        if (fd >= 0 && ftruncate(fd, sizeof(LinkShared)) == 0)
+        {
+            p = mmap(nullptr, sizeof(LinkShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) p = nullptr;
+        }
+        if (fd >= 0) close(fd);
+        if (!p || !stale(*static_cast<LinkShared*>(p))) break;
+
+        munmap(p, sizeof(LinkShared));
+        p = nullptr;
+        shm_unlink(("/" + path).c_str());
+    }
+    if (!p)
+    {
+        std::cerr << "link " << name << " couldnt be opened!" << "\n";
+        return nullptr;
+    }
+#endif
+
+    LinkShared* shared = static_cast<LinkShared*>(p);
+    int self = int(shared->ends.fetch_add(1));
+    if (self <= 1) shared->clock[self].owner.store(thisProcess());
+    std::unique_ptr<LinkCable> cable(new LinkCable(shared, self));
+    cable->name = path;
+#ifdef _WIN32
+    cable->mapping = mapping;
+#endif
+
+    if (self > 1)
+    {
+        std::cerr << "link " << name << " already has both ends plugged in\n";
+        return nullptr;
+    }
+#ifndef _WIN32
+    // both ends are in, the mapping lives on without its name
+    if (self == 1) shm_unlink(("/" + path).c_str());
+#endif
+    return cable;
+}
+
+LinkCable::~LinkCable()
+{
+    if (self <= 1) shared->clock[self].cycles.store(GONE, std::memory_order_release);
+    if (local) return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(shared);
+    CloseHandle(mapping);
+#else
+    // nobody ever came for the other end, take the name back
+    if (self == 0 && shared->ends.load() == 1) shm_unlink(("/" + name).c_str());
+    munmap(shared, sizeof(LinkShared));
+#endif
+}
+
+void LinkCable::publish(uint64_t cycles)
+{
+    shared->clock[self].cycles.store(cycles, std::memory_order_release);
+}
+
+uint64_t LinkCable::peerTime() const
+{
+    return shared->clock[self ^ 1].cycles.load(std::memory_order_acquire);
+}
+
+void LinkCable::send(const LinkMessage& message)
+{
+    LinkShared::Queue& q = shared->toEnd[self ^ 1];
+    const uint64_t h = q.head.load(std::memory_order_relaxed);
+    unsigned spins = 0;
+    while (h - q.tail.load(std::memory_order_acquire) >= LinkShared::QUEUE)
+    {
+        if (peerTime() == GONE) return;
+        wait(spins);
+    }
+    q.slots[h % LinkShared::QUEUE] = message;
+    q.head.store(h + 1, std::memory_order_release);
+}
+
+bool LinkCable::receive(LinkMessage& message)
+{
+    LinkShared::Queue& q = shared->toEnd[self];
+    const uint64_t t = q.tail.load(std::memory_order_relaxed);
+    if (t == q.head.load(std::memory_order_acquire)) return false;
+
+    message = q.slots[t % LinkShared::QUEUE];
+    q.tail.store(t + 1, std::memory_order_release);
+    return true;
+}
+
+void LinkCable::wait(unsigned& spins)
+{
+    if (++spins < 256) return;
+    std::this_thread::yield();
+
+    // by the clock rather than by spins, a loaded machine yields for a long time
+    if (spins % 256 != 0) return;
+    const auto now = std::chrono::steady_clock::now();
+    if (now - peerChecked < PEER_CHECK) return;
+    peerChecked = now;
+
+    LinkShared::Clock& peer = shared->clock[self ^ 1];
+    if (!processAlive(peer.owner.load())) peer.cycles.store(GONE, std::memory_order_release);
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+
+enum LinkKind : uint8_t
+{
+    LINK_TRANSFER, // the sending end's clock started shifting byte out, it lands at when
+    LINK_REPLY,    // what came back for the transfer landing at when, 0xFF if nobody was listening
+};
+
+// times are t-cycles since each end plugged in
+struct LinkMessage
+{
+    uint64_t when;
+    LinkKind kind;
+    uint8_t byte;
+};
+
+// both ends' clocks and a queue of messages each way
+// only atomics and plain data, so it works the same between threads and mapped into two processes
+struct LinkShared
+{
+    static constexpr uint32_t QUEUE = 16; // a transfer waits for its reply, so a handful ever queue up
+
+    struct Clock
+    {
+        alignas(64) std::atomic<uint64_t> cycles;
+        std::atomic<uint32_t> owner; // process id of the end, 0 until it has plugged in
+    };
+
+    struct Queue
+    {
+        alignas(64) std::atomic<uint64_t> head; // written by the sending end
+        alignas(64) std::atomic<uint64_t> tail; // written by the receiving end
+        LinkMessage slots[QUEUE];
+    };
+
+    std::atomic<uint32_t> ends; // how many ends have plugged in so far
+    Clock clock[2];
+    Queue toEnd[2];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the link clocks have to work across processes");
+
+
+// one end of a link cable
+// each end publishes how far it has run and may run up to a byte's time past the other,
+// nothing the other end starts can land any earlier than that
+class LinkCable
+{
+public:
+    static constexpr uint64_t GONE = UINT64_MAX; // clock of an end that has unplugged
+
+    // both ends of one cable, for two consoles on two threads of this process
+    static std::pair<std::unique_ptr<LinkCable>, std::unique_ptr<LinkCable>> pair();
+    // one end of a cable in shared memory, the first process to open a name gets end 0
+    static std::unique_ptr<LinkCable> open(const std::string& name);
+    ~LinkCable(); // tells the other end nobody is here anymore
+
+    int end() const { return self; }
+
+    void publish(uint64_t cycles);
+    uint64_t peerTime() const; // how far the other end has run, GONE once it has unplugged
+
+    void send(const LinkMessage& message);
+    bool receive(LinkMessage& message);
+
+    // spin a little for an end on another core, then give up the core in case it is on this one.
+    // every so often checks the other end's process is still there, one that died without
+    // unplugging reads as GONE from then on
+    void wait(unsigned& spins);
+
+private:
+    LinkCable(LinkShared* shared, int self) : shared(shared), self(self) {}
+
+    LinkShared* shared;
+    int self;
+    std::shared_ptr<LinkShared> local; // pair() keeps the cable here, open() maps it
+
+    std::string name;
+    std::chrono::steady_clock::time_point peerChecked; // last time wait looked for the other end's process
+#ifdef _WIN32
+    void* mapping = nullptr;
+#endif
+};
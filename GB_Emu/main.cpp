@@ -1,32 +1,404 @@
+#include <algorithm>
+#include <filesystem>
 #include <iostream>
-#include "cpu.h"
-#include "memory.h"
+#include <memory>
+#include <string>
+#include "gameboy.h"
+#include "movie.h"
+#include "rewind.h"
+#include "runner.h"
+#include "sysInfo.h"
 
 #include <thread>
 #include <chrono>
 
 
-int main(int argc, char* argv[])
+struct RunOptions
 {
-    if (argc < 2)
+    std::string romPath;
+    uint64_t frames = 0;    // 0 = no limit
+    uint64_t cycles = 0;    // 0 = no limit
+    unsigned frameSkip = 0; // draw 1 frame in every frameSkip + 1
+    bool paced = false;     // lock to 59.73 hz instead of running flat out
+    bool interpret = false; // skip the block cache
+    bool jit = false;       // compile hot blocks to native code
+    std::string loadState;  // start from this snapshot instead of booting
+    std::string saveState;  // written on exit
+    size_t rewindMB = 0;    // 0 = no rewind history
+    std::string trace;      // binary instruction log, decode it with TraceDump
+    std::string profile;    // json profile written on exit
+    std::string flame;      // collapsed stacks written on exit
+    bool profileExact = false;
+    std::string audio;      // .wav or raw s16 stereo at 48khz
+    std::string dumpFrames; // raw shades, 160x144 bytes per frame
+    std::string dumpHashes; // one hash line per frame
+    bool test = false;      // stop when a test rom reports, exit code says how it went
+    std::string record;     // input movie written on exit
+    std::string play;       // input movie to replay instead of the joypad
+    uint64_t seek = 0;      // movie frame to start playing from
+    std::string link;       // shared memory link cable to another GB_Emu
+    std::string battery;    // save file for battery backed ram, empty = the rom's name with .sav
+    bool noBattery = false; // keep cartridge ram in memory only
+    unsigned batteryFlushMs = CartRam::DEFAULT_FLUSH_MS;
+};
+
+// longest any blargg or mooneye rom needs, in frames of emulated time
+constexpr uint64_t TEST_TIMEOUT_FRAMES = 120 * 60;
+
+
+static void printUsage()
+{
+    std::cerr << "usage: GB_Emu [options] rom.gb\n"
+        << "       GB_Emu --batch jobs.txt [--jit]\n"
+        << "       GB_Emu --test-dir dir [--jit]\n"
+        << "  --frames N     stop after N frames\n"
+        << "  --cycles N     stop after N t-cycles\n"
+        << "  --frameskip N  only draw every N+1th frame\n"
+        << "  --paced        run at real hardware speed\n"
+        << "  --interpret    decode every instruction, no block cache\n"
+        << "  --jit          compile hot blocks to x86-64\n"
+        << "  --load-state F start from a save state instead of booting\n"
+        << "  --save-state F write a save state on exit\n"
+        << "  --rewind MB    keep up to MB of per frame rewind history\n"
+        << "  --trace F      log every instruction to F\n"
+        << "  --profile F    write a json profile to F on exit\n"
+        << "  --flame F      write collapsed stacks for flamegraph tools to F on exit\n"
+        << "  --profile-exact  count every instruction instead of sampling\n"
+        << "  --audio F      record sound to F, a .wav or raw 16 bit stereo at 48khz\n"
+        << "  --dump-frames F  write every drawn frame to F, one byte per pixel\n"
+        << "  --dump-hashes F  write a hash of every drawn frame to F, one line each\n"
+        << "  --test         stop as soon as a test rom passes or fails, exit code 0 = passed\n"
+        << "  --record F     write every frame's input and a keyframe every 10 seconds to F on exit\n"
+        << "  --play F       replay the input movie F, stops at its end unless --frames says otherwise\n"
+        << "  --seek N       with --play, jump straight to frame N of the movie\n"
+        << "  --link NAME    plug into link cable NAME, another GB_Emu started with the same NAME is the other end\n"
+        << "  --battery F    keep battery backed cartridge ram in F instead of the rom's name with .sav\n"
+        << "  --battery-flush MS  write the save back every MS milliseconds, 0 = only on exit\n"
+        << "  --no-battery   dont touch the save file, --test and --play never do\n";
+}
+
+static bool parseArgs(int argc, char* argv[], RunOptions& opts)
+{
+    bool seeking = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        bool ok = true; // false once a value doesnt parse
+
+        if (arg == "--frames" && hasValue) ok = parseNumber(argv[++i], opts.frames);
+        else if (arg == "--cycles" && hasValue) ok = parseNumber(argv[++i], opts.cycles);
+        else if (arg == "--frameskip" && hasValue) ok = parseNumber(argv[++i], opts.frameSkip);
+        else if (arg == "--paced") opts.paced = true;
+        else if (arg == "--interpret") opts.interpret = true;
+        else if (arg == "--jit") opts.jit = true;
+        else if (arg == "--load-state" && hasValue) opts.loadState = argv[++i];
+        else if (arg == "--save-state" && hasValue) opts.saveState = argv[++i];
+        else if (arg == "--rewind" && hasValue) ok = parseNumber(argv[++i], opts.rewindMB);
+        else if (arg == "--trace" && hasValue) opts.trace = argv[++i];
+        else if (arg == "--profile" && hasValue) opts.profile = argv[++i];
+        else if (arg == "--flame" && hasValue) opts.flame = argv[++i];
+        else if (arg == "--profile-exact") opts.profileExact = true;
+        else if (arg == "--audio" && hasValue) opts.audio = argv[++i];
+        else if (arg == "--dump-frames" && hasValue) opts.dumpFrames = argv[++i];
+        else if (arg == "--dump-hashes" && hasValue) opts.dumpHashes = argv[++i];
+        else if (arg == "--test") opts.test = true;
+        else if (arg == "--record" && hasValue) opts.record = argv[++i];
+        else if (arg == "--play" && hasValue) opts.play = argv[++i];
+        else if (arg == "--seek" && hasValue) ok = seeking = parseNumber(argv[++i], opts.seek);
+        else if (arg == "--link" && hasValue) opts.link = argv[++i];
+        else if (arg == "--battery" && hasValue) opts.battery = argv[++i];
+        else if (arg == "--battery-flush" && hasValue) ok = parseNumber(argv[++i], opts.batteryFlushMs);
+        else if (arg == "--no-battery") opts.noBattery = true;
+        else if (arg[0] != '-' && opts.romPath.empty()) opts.romPath = arg;
+        else
+        {
+            std::cerr << "bad argument: " << arg << "\n";
+            return false;
+        }
+
+        if (!ok)
+        {
+            std::cerr << "bad argument: " << arg << " " << argv[i] << "\n";
+            return false;
+        }
+    }
+
+    if (opts.romPath.empty())
+    {
+        std::cerr << "no rom entered\n";
+        return false;
+    }
+    if (seeking && opts.play.empty())
+    {
+        std::cerr << "--seek only works with --play\n";
+        return false;
+    }
+    if (opts.test && !opts.frames) opts.frames = TEST_TIMEOUT_FRAMES;
+    // runs that have to come out the same every time start from a blank cartridge ram
+    if (opts.test || !opts.play.empty()) opts.noBattery = true;
+    if (opts.battery.empty()) opts.battery = std::filesystem::path(opts.romPath).replace_extension(".sav").string();
+    return true;
+}
+
+static int runBatch(const std::string& jobFile, bool jit)
+{
+    std::vector<Job> jobs;
+    if (!loadJobFile(jobFile, jobs)) return 1;
+    for (Job& job : jobs) job.jit = jit;
+
+    std::vector<JobResult> results = runJobs(jobs);
+
+    int failed = 0;
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const JobResult& r = results[i];
+        std::cout << jobs[i].romPath << ": "
+            << (!r.loaded ? "load failed" : r.crashed ? "crashed" : "ok")
+            << " after " << std::dec << r.framesRun << " frames (" << r.cycles << " cycles), PC=0x" << std::hex << r.regs.PC << "\n";
+        if (!r.loaded || r.crashed) failed++;
+    }
+
+    return failed ? 1 : 0;
+}
+
+// last non empty line of what a test printed, usually the verdict
+static std::string lastLine(const std::string& text)
+{
+    size_t end = text.find_last_not_of("\r\n ");
+    if (end == std::string::npos) return "";
+    size_t start = text.find_last_of('\n', end);
+    return text.substr(start == std::string::npos ? 0 : start + 1, end - (start == std::string::npos ? 0 : start + 1) + 1);
+}
+
+// every .gb and .gbc under dir, one core each, done as soon as each reports
+static int runTests(const std::string& dir, bool jit)
+{
+    using clock = std::chrono::steady_clock;
+
+    std::vector<Job> jobs;
+    std::error_code err;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(dir, err))
     {
-        std::cerr << "no rom entered";
+        std::string ext = entry.path().extension().string();
+        if (!entry.is_regular_file() || (ext != ".gb" && ext != ".gbc")) continue;
+
+        Job job;
+        job.romPath = entry.path().string();
+        job.frames = TEST_TIMEOUT_FRAMES;
+        job.jit = jit;
+        job.untilResult = true;
+        jobs.push_back(job);
+    }
+    if (err)
+    {
+        std::cerr << dir << " couldnt be opened!" << "\n";
         return 1;
     }
+    std::sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) { return a.romPath < b.romPath; });
 
-    initMemory();
-    if (!loadROM(argv[1])) return 1;
+    const auto start = clock::now();
+    std::vector<JobResult> results = runJobs(jobs);
+    double seconds = std::chrono::duration<double>(clock::now() - start).count();
 
-    bootSetup();
-    postBootSetup();
+    int passed = 0, failed = 0, timedOut = 0;
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const JobResult& r = results[i];
+        const char* verdict = "timed out";
+        if (!r.loaded) verdict = "load failed";
+        else if (r.status == TEST_PASSED) verdict = "passed";
+        else if (r.status == TEST_FAILED || r.crashed) verdict = "FAILED";
+
+        std::cout << jobs[i].romPath << ": " << verdict << " after " << r.framesRun << " frames";
+        if (r.status != TEST_PASSED && !r.output.empty()) std::cout << " (" << lastLine(r.output) << ")";
+        std::cout << "\n";
 
+        if (r.loaded && r.status == TEST_PASSED) passed++;
+        else if (r.loaded && r.status == TEST_RUNNING && !r.crashed) timedOut++;
+        else failed++;
+    }
 
+    std::cout << passed << " passed, " << failed << " failed, " << timedOut << " timed out in " << seconds << "s\n";
+    return (failed || timedOut) ? 1 : 0;
+}
 
-    for (int i = 0; i < 3; ++i) {
-        emulateCycle();
-        std::this_thread::sleep_for(std::chrono::milliseconds(5000));
+static int runSingle(const RunOptions& opts)
+{
+    using clock = std::chrono::steady_clock;
+
+    auto gb = std::make_unique<GameBoy>();
+    gb->initMemory();
+    if (!gb->loadROM(opts.romPath)) return 1;
+    if (!opts.noBattery && !gb->loadBattery(opts.battery, opts.batteryFlushMs)) return 1;
+
+    if (!opts.loadState.empty())
+    {
+        if (!gb->loadStateFile(opts.loadState)) return 1;
+    }
+    else
+    {
+        gb->bootSetup();
+        gb->postBootSetup();
     }
+    gb->setBlockCache(!opts.interpret);
+    if (opts.jit && !gb->setJit(true)) std::cerr << "no jit on this host, running the block cache\n";
+    if (!opts.trace.empty() && !gb->startTrace(opts.trace)) return 1;
+    if (!opts.profile.empty() || !opts.flame.empty()) gb->startProfile(opts.profileExact);
+    if (!opts.dumpFrames.empty() && !gb->startFrameDump(opts.dumpFrames, DUMP_FRAMES)) return 1;
+    if (!opts.dumpHashes.empty() && !gb->startFrameDump(opts.dumpHashes, DUMP_HASHES)) return 1;
 
+    std::unique_ptr<AudioSink> audio;
+    if (!opts.audio.empty())
+    {
+        audio = AudioSink::open(opts.audio);
+        if (!audio) return 1;
+        gb->startAudio(audio->ring);
+    }
 
+    // playing a movie starts from its keyframes, whatever state the console booted into
+    std::unique_ptr<Movie> playing;
+    uint64_t movieFrame = opts.seek;
+    if (!opts.play.empty())
+    {
+        playing = Movie::open(opts.play);
+        if (!playing) return 1;
+
+        const auto seekStart = clock::now();
+        if (!playing->seek(*gb, opts.seek))
+        {
+            std::cerr << "couldnt seek to frame " << opts.seek << " of " << playing->frames() << "\n";
+            return 1;
+        }
+        std::cout << "seeked to frame " << opts.seek << " in " << std::chrono::duration<double>(clock::now() - seekStart).count() << "s\n";
+    }
+    std::unique_ptr<Movie> recording;
+    if (!opts.record.empty()) recording = std::make_unique<Movie>();
+
+    if (!opts.link.empty())
+    {
+        std::unique_ptr<LinkCable> cable = LinkCable::open(opts.link);
+        if (!cable) return 1;
+        std::cout << "link " << opts.link << ": end " << cable->end() << ", runs once the other end is in\n";
+        gb->attachLink(std::move(cable));
+    }
+
+    const uint64_t cycleLimit = opts.cycles ? gb->sched.cycles + opts.cycles : UINT64_MAX;
+    const uint64_t startCycles = gb->sched.cycles;
+    const auto framePeriod = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / FRAME_RATE));
+
+    std::unique_ptr<Rewind> rewind;
+    if (opts.rewindMB) rewind = std::make_unique<Rewind>(opts.rewindMB << 20);
+
+    const auto start = clock::now();
+    auto deadline = start;
+    uint64_t frames = 0;
+
+    while (!gb->crashed && gb->sched.cycles < cycleLimit)
+    {
+        if (opts.frames && frames >= opts.frames) break;
+        if (opts.test && gb->testStatus() != TEST_RUNNING) break;
+        if (playing && !opts.frames && movieFrame >= playing->frames()) break;
+
+        if (playing) gb->joypad = playing->buttons(movieFrame++);
+        if (recording) recording->record(*gb);
+
+        gb->skipRender = opts.frameSkip && (frames % (opts.frameSkip + 1)) != 0;
+        gb->runFrame(cycleLimit);
+        frames++;
+        if (rewind) rewind->record(*gb);
+
+        if (!opts.paced) continue;
+
+        // deadlines advance by the exact frame period so rounding never drifts
+        // more than a few frames behind means we stalled, so resync instead of racing
+        deadline += framePeriod;
+        auto now = clock::now();
+        if (now > deadline + framePeriod * 4)
+        {
+            deadline = now;
+            continue;
+        }
+
+        // sleep most of the way, then spin off the last bit the os cant time
+        auto spinFrom = deadline - std::chrono::milliseconds(2);
+        if (now < spinFrom) std::this_thread::sleep_until(spinFrom);
+        while (clock::now() < deadline) {}
+    }
+
+    double seconds = std::chrono::duration<double>(clock::now() - start).count();
+    double emulated = double(gb->sched.cycles - startCycles) / CLOCK_HZ;
+    std::cout << std::dec << frames << " frames in " << seconds << "s: "
+        << (seconds > 0 ? frames / seconds : 0) << " fps, "
+        << (seconds > 0 ? emulated / seconds : 0) << "x realtime\n";
+
+    gb->detachLink(); // the other end carries on alone
+
+    if (rewind) std::cout << "rewind: " << rewind->frames() << " frames in " << rewind->bytesUsed() << " bytes\n";
+    if (gb->trace) std::cout << "trace: " << gb->trace->recorded() << " instructions\n";
+    if (gb->frameDump) std::cout << "frames dumped: " << gb->frameDump->recorded() << "\n";
+    if (audio)
+    {
+        gb->stopAudio();
+        audio.reset();
+        std::cout << "audio: " << emulated << "s recorded\n";
+    }
+
+    if (!opts.saveState.empty() && !gb->saveStateFile(opts.saveState)) return 1;
+    if (recording && !recording->write(opts.record)) return 1;
+    if (!opts.profile.empty() && !gb->profiler->writeJSON(opts.profile)) return 1;
+    if (!opts.flame.empty() && !gb->profiler->writeCollapsed(opts.flame)) return 1;
+
+    if (gb->crashed)
+    {
+        std::cerr << "stopped at PC=0x" << std::hex << gb->regs.PC << "\n";
+        return 1;
+    }
+
+    if (opts.test)
+    {
+        TestStatus status = gb->testStatus();
+        std::cout << gb->testOutput() << "\n"
+            << (status == TEST_PASSED ? "passed" : status == TEST_FAILED ? "FAILED" : "no result") << "\n";
+        return status == TEST_PASSED ? 0 : 1;
+    }
     return 0;
-}
\ No newline at end of file
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        printUsage();
+        return 1;
+    }
+
+    if (std::string(argv[1]) == "--batch")
+    {
+        if (argc < 3)
+        {
+            std::cerr << "no job file entered";
+            return 1;
+        }
+        return runBatch(argv[2], argc > 3 && std::string(argv[3]) == "--jit");
+    }
+
+    if (std::string(argv[1]) == "--test-dir")
+    {
+        if (argc < 3)
+        {
+            std::cerr << "no test directory entered";
+            return 1;
+        }
+        return runTests(argv[2], argc > 3 && std::string(argv[3]) == "--jit");
+    }
+
+    RunOptions opts;
+    if (!parseArgs(argc, argv, opts))
+    {
+        printUsage();
+        return 1;
+    }
+    return runSingle(opts);
+}
@@ -1,41 +1,86 @@
-#include "memory.h"
-#include <fstream>
-#include <vector>
+#include "gameboy.h"
+#include "sysInfo.h"
+#include <algorithm>
+#include <array>
 #include <iostream>
 
 
-uint8_t memory[0x10000]; // 64KB
-
-
-void initMemory()
+void GameBoy::initMemory()
 {
     for (int i = 0; i < 0x10000; ++i)
         memory[i] = 0;
+    updateInterrupts();
+    mapPages();
+
+    apu = {};
+    apu.cycles = sched.cycles;
+    apu.nextStep = sched.cycles + CYCLES_SEQUENCER;
+}
+
+void GameBoy::mapPages()
+{
+    for (int page = 0; page < 0x100; ++page)
+        mapPage(page);
+}
+
+void GameBoy::mapPage(uint8_t page)
+{
+    if (dmaActive && dmaBlocks(page))
+    {
+        readPage[page] = nullptr;
+        writePage[page] = nullptr;
+        return;
+    }
+
+    if (cart.rom && (page < 0x80 || (page >= 0xA0 && page < 0xC0)))
+    {
+        mapCartPage(page);
+        return;
+    }
+
+    // e000-fdff echoes c000-ddff, so both point at the same bytes
+    uint8_t backing = (page >= 0xE0 && page < 0xFE) ? page - 0x20 : page;
+    uint8_t* data = &memory[backing << 8];
+
+    readPage[page] = page < 0xFE ? data : nullptr;
+
+    // tile data writes go the slow way so they can mark decoded tiles stale
+    bool code = blocks && blocks->pageHasCode(backing);
+    writePage[page] = (page >= 0x98 && page < 0xFE && !code) ? data : nullptr;
 }
 
-void postBootSetup()
+// ram page gained or lost cached code, its echo has to follow
+void GameBoy::mapCodePage(uint8_t page)
 {
+    mapPage(page);
+    if (page >= 0xC0 && page < 0xDE) mapPage(page + 0x20);
+}
+
+void GameBoy::postBootSetup()
+{
+    write8(0xFF04, 0x00); // DIV, any write starts the divider
     write8(0xFF05, 0x00); // TIMA
     write8(0xFF06, 0x00); // TMA
     write8(0xFF07, 0x00); // TAC
+    write8(0xFF26, 0xF1); // NR52 first, the other sound registers ignore writes while it is off
     write8(0xFF10, 0x80); // NR10
     write8(0xFF11, 0xBF); // NR11
     write8(0xFF12, 0xF3); // NR12
-    write8(0xFF14, 0xBF); // NR14
+    write8(0xFF14, 0x3F); // NR14, bit 7 would retrigger and reads back as 1 anyway
     write8(0xFF16, 0x3F); // NR21
     write8(0xFF17, 0x00); // NR22
-    write8(0xFF19, 0xBF); // NR24
+    write8(0xFF19, 0x3F); // NR24
     write8(0xFF1A, 0x7F); // NR30
     write8(0xFF1B, 0xFF); // NR31
     write8(0xFF1C, 0x9F); // NR32
-    write8(0xFF1E, 0xBF); // NR34
+    write8(0xFF1E, 0x3F); // NR34
     write8(0xFF20, 0xFF); // NR41
     write8(0xFF21, 0x00); // NR42
     write8(0xFF22, 0x00); // NR43
-    write8(0xFF23, 0xBF); // NR44
+    write8(0xFF23, 0x3F); // NR44
     write8(0xFF24, 0x77); // NR50
     write8(0xFF25, 0xF3); // NR51
-    write8(0xFF26, 0xF1); // NR52
+    apu.ch[0].enabled = true; // the boot chime has died away but channel 1 still reads as on
     write8(0xFF40, 0x91); // LCDC
     write8(0xFF42, 0x00); // SCY
     write8(0xFF43, 0x00); // SCX
@@ -48,7 +93,7 @@ void postBootSetup()
     write8(0xFFFF, 0x00); // IE
 }
 
-void loadTestProgram()
+void GameBoy::loadTestProgram()
 {
     memory[0x0100] = 0x3E; // LD A, 0x42
     memory[0x0101] = 0x42;
@@ -59,25 +104,232 @@ void loadTestProgram()
     memory[0x0104] = 0x00; // NOP
 }
 
-bool loadROM(const std::string &filename)
+uint8_t GameBoy::readJoypad() const
+{
+    // p14 low selects the dpad, p15 low selects the buttons
+    uint8_t select = memory[0xFF00] & 0x30;
+    uint8_t pressed = 0;
+    if (!(select & 0x10)) pressed |= joypad & 0x0F;
+    if (!(select & 0x20)) pressed |= joypad >> 4;
+    return 0xC0 | select | (~pressed & 0x0F);
+}
+
+using IoRead = uint8_t (*)(const GameBoy& gb, uint16_t addr);
+using IoWrite = void (*)(GameBoy& gb, uint16_t addr, uint8_t value);
+using IoTouch = void (*)(GameBoy& gb, uint16_t addr);
+
+// null = plain storage, no call at all
+// reads only work the value out, anything a cpu read sets off goes in touch so peeks can skip it
+struct IoHandler
+{
+    IoRead read;
+    IoWrite write;
+    IoTouch touch;
+};
+
+// handlers for the registers at 0xFF00-0xFF7F that do more than hold a byte
+struct Io
 {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file)
+    static uint8_t unused(const GameBoy&, uint16_t) { return 0xFF; }
+    static void ignore(GameBoy&, uint16_t, uint8_t) {}
+
+    static uint8_t readJOYP(const GameBoy& gb, uint16_t) { return gb.readJoypad(); }
+    static uint8_t readSC(const GameBoy& gb, uint16_t addr) { return gb.memory[addr] | 0x7E; }
+    static void writeSC(GameBoy& gb, uint16_t, uint8_t value) { gb.writeSerialControl(value); }
+    static void writeDIV(GameBoy& gb, uint16_t, uint8_t) { gb.resetDIV(); }
+    static void writeTAC(GameBoy& gb, uint16_t, uint8_t value) { gb.writeTAC(value); }
+    static uint8_t readIF(const GameBoy& gb, uint16_t addr) { return gb.memory[addr] | 0xE0; } // unused bits read 1
+    static void writeIF(GameBoy& gb, uint16_t addr, uint8_t value) { gb.memory[addr] = value & 0x1F; gb.updateInterrupts(); }
+    static uint8_t readDIV(const GameBoy& gb, uint16_t) { return gb.readDIV(); }
+    static uint8_t readTIMA(const GameBoy& gb, uint16_t) { return gb.readTIMA(); }
+    static void writeTIMA(GameBoy& gb, uint16_t, uint8_t value) { gb.writeTIMA(value); }
+    static void touchTimer(GameBoy& gb, uint16_t addr) { gb.spinReadLimit = std::min(gb.spinReadLimit, gb.timerNextChange(addr)); }
+    static uint8_t readAPU(const GameBoy& gb, uint16_t addr) { return gb.readAPU(addr); }
+    static void writeAPU(GameBoy& gb, uint16_t addr, uint8_t value) { gb.writeAPU(addr, value); }
+    static void touchNR52(GameBoy& gb, uint16_t) { gb.touchAPU(); }
+    static uint8_t readSTAT(const GameBoy& gb, uint16_t addr) { return gb.memory[addr] | 0x80; }
+    static void writeDMA(GameBoy& gb, uint16_t, uint8_t value) { gb.startDMA(value); }
+
+    static void writeLCDC(GameBoy& gb, uint16_t addr, uint8_t value)
+    {
+        bool wasOn = gb.memory[addr] & 0x80;
+        gb.memory[addr] = value;
+        if (wasOn != bool(value & 0x80)) gb.setLcdEnabled(value & 0x80);
+    }
+
+    // mode and coincidence are read only
+    static void writeSTAT(GameBoy& gb, uint16_t addr, uint8_t value)
+    {
+        gb.memory[addr] = (gb.memory[addr] & 0x07) | (value & 0x78);
+    }
+
+    static void writeLYC(GameBoy& gb, uint16_t addr, uint8_t value)
+    {
+        gb.memory[addr] = value;
+        if (gb.memory[0xFF40] & 0x80) gb.compareLYC();
+    }
+
+    static constexpr std::array<IoHandler, 0x80> table()
     {
-        std::cerr << "rom.gb couldnt be opened!" << "\n";
-        return false;
+        std::array<IoHandler, 0x80> t = {};
+        // nothing is wired up behind these on a dmg
+        for (int r : { 0x03, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E })
+            t[r] = { unused, ignore, nullptr };
+        for (int r = 0x4C; r < 0x80; ++r)
+            t[r] = { unused, ignore, nullptr };
+        for (int r = 0x10; r < 0x40; ++r)
+            t[r] = { readAPU, writeAPU, nullptr };
+
+        t[0x00].read = readJOYP;
+        t[0x02] = { readSC, writeSC, nullptr };
+        t[0x04] = { readDIV, writeDIV, touchTimer };
+        t[0x05] = { readTIMA, writeTIMA, touchTimer };
+        t[0x07].write = writeTAC;
+        t[0x0F] = { readIF, writeIF, nullptr };
+        t[0x26].touch = touchNR52;
+        t[0x40].write = writeLCDC;
+        t[0x41] = { readSTAT, writeSTAT, nullptr };
+        t[0x44].write = ignore; // LY is read only
+        t[0x45].write = writeLYC;
+        t[0x46].write = writeDMA;
+        return t;
     }
+};
+
+static constexpr std::array<IoHandler, 0x80> ioHandlers = Io::table();
 
-    file.read(reinterpret_cast<char*>(memory), 0x8000);
-    return true;
+
+// only cartridge ram that isnt mapped, oam, the unusable gap, io and whatever a running dma holds get here
+uint8_t GameBoy::readSlow(uint16_t addr)
+{
+    if (addr >= 0xFF00 && addr < 0xFF80)
+    {
+        const IoHandler& io = ioHandlers[addr & 0x7F];
+        if (io.touch) io.touch(*this, addr);
+    }
+    return peekSlow(addr);
 }
 
-uint8_t read8(uint16_t addr)
+// what a read of a slow path address returns, with nothing a real read would set off
+uint8_t GameBoy::peekSlow(uint16_t addr) const
 {
-    return memory[addr];
+    if (dmaActive && dmaBlocks(addr >> 8)) return dmaRead(dmaIndex());
+    if (addr < 0xC000) return readCartRAM(addr);
+    if (addr < 0xFF00)
+    {
+        if (addr >= 0xFEA0) return 0x00;
+        return dmaActive ? 0xFF : memory[addr];
+    }
+    if (addr >= 0xFF80) return memory[addr];
+
+    const IoHandler& io = ioHandlers[addr & 0x7F];
+    return io.read ? io.read(*this, addr) : memory[addr];
 }
 
-void write8(uint16_t addr, uint8_t value)
+void GameBoy::writeSlow(uint16_t addr, uint8_t value)
 {
+    if (dmaActive && dmaBlocks(addr >> 8)) return; // the dma has the bus, the write goes nowhere
+    if (addr < 0x8000)
+    {
+        if (cart.rom) writeMBC(addr, value);
+        return;
+    }
+    if (addr >= 0xE000 && addr < 0xFE00) addr -= 0x2000; // echo ram
+    if (addr < 0x9800) tiles.dirty[(addr - 0x8000) >> 4] = true;
+
+    if (blocks && blocks->isCode(addr) && blocks->invalidate(addr))
+    {
+        blockBreak = true; // self modifying code
+        if (addr < 0xFE00 && !blocks->pageHasCode(addr >> 8)) mapCodePage(addr >> 8);
+    }
+
+    if (addr >= 0xA000 && addr < 0xC000 && cart.rom)
+    {
+        writeCartRAM(addr, value);
+        return;
+    }
+    if (addr >= 0xFF00)
+    {
+        writeIO(addr, value);
+        return;
+    }
+    if (addr >= 0xFE00)
+    {
+        if (addr < 0xFEA0 && !dmaActive) memory[addr] = value;
+        return;
+    }
     memory[addr] = value;
-}
\ No newline at end of file
+}
+
+void GameBoy::writeIO(uint16_t addr, uint8_t value)
+{
+    if (addr >= 0xFF80)
+    {
+        memory[addr] = value;
+        if (addr == 0xFFFF)
+        {
+            updateInterrupts();
+            blockBreak = true; // IE can let a pending interrupt in
+        }
+        return;
+    }
+
+    const IoHandler& io = ioHandlers[addr & 0x7F];
+    if (!io.write)
+    {
+        memory[addr] = value;
+        return;
+    }
+
+    // handlers can move events or raise interrupts, let the cpu look again before going on
+    blockBreak = true;
+    io.write(*this, addr, value);
+}
+
+// vram has a bus of its own, rom, cartridge ram and wram share the external one
+static bool onVramBus(uint8_t page)
+{
+    return page >= 0x80 && page < 0xA0;
+}
+
+// the cpu cant reach anything on the bus the dma is reading from, only io and hram stay open
+bool GameBoy::dmaBlocks(uint8_t page) const
+{
+    return page < 0xFE && onVramBus(page) == onVramBus(memory[0xFF46]);
+}
+
+// byte the dma is moving right now, one per m-cycle
+uint8_t GameBoy::dmaIndex() const
+{
+    uint64_t start = sched.when(EVENT_DMA) - CYCLES_OAM_DMA;
+    return uint8_t(std::min<uint64_t>((sched.cycles - start) / 4, 0x9F));
+}
+
+// source byte straight off its bus, nothing in the way
+uint8_t GameBoy::dmaRead(uint8_t index) const
+{
+    uint16_t addr = (memory[0xFF46] << 8) + index;
+    if (addr >= 0xE000) addr -= 0x2000; // past c000 a dmg dma always lands in wram
+    if (cart.rom && addr < 0x8000) return cart.rom->data()[(addr < 0x4000 ? cart.romBank0 : cart.romBank) * 0x4000 + (addr & 0x3FFF)];
+    if (cart.rom && addr >= 0xA000 && addr < 0xC000) return readCartRAM(addr);
+    return memory[addr];
+}
+
+// pages on the bus the dma uses drop to the slow path until it finishes
+void GameBoy::startDMA(uint8_t page)
+{
+    memory[0xFF46] = page;
+    dmaActive = true;
+    sched.schedule(EVENT_DMA, sched.cycles + CYCLES_OAM_DMA);
+    mapPages();
+}
+
+// the whole 160 byte transfer lands at once when the dma window closes
+// nothing can write the source while the dma holds its bus, so this is what a byte at a time would copy
+void GameBoy::finishDMA()
+{
+    for (uint8_t i = 0; i < 0xA0; ++i)
+        memory[0xFE00 + i] = dmaRead(i);
+    dmaActive = false;
+    mapPages();
+}
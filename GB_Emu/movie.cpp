@@ -0,0 +1,204 @@
+#include "movie.h"
+#include "gameboy.h"
+#include "rewind.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+
+// packDelta writes up to size * 2 + 16 bytes, buffers read back keep the same slack
+constexpr size_t PACK_SLACK = 16;
+
+
+Movie::Movie(uint32_t interval) : interval(std::max<uint32_t>(interval, 1))
+{
+}
+
+void Movie::record(const GameBoy& gb)
+{
+    if (input.size() % interval == 0)
+    {
+        gb.saveState(state);
+        stateSize = uint32_t(state.size());
+        zeros.assign(state.size(), 0);
+
+        // most of a state is zero or unchanged filler, packing against nothing squeezes that out
+        packed.resize(state.size() * 2 + PACK_SLACK);
+        size_t size = packDelta(zeros.data(), state.data(), state.size(), packed.data());
+        index.push_back({ recorded.size(), size });
+        recorded.insert(recorded.end(), packed.begin(), packed.begin() + size);
+    }
+    input.push_back(gb.joypad);
+}
+
+bool Movie::write(const std::string& filename) const
+{
+    std::ofstream out(filename, std::ios::binary);
+    if (!out)
+    {
+        std::cerr << filename << " couldnt be written!" << "\n";
+        return false;
+    }
+
+    // input changes a few times a second at most, so runs of one value are short to store
+    std::vector<uint8_t> runs;
+    uint8_t buf[16];
+    for (size_t i = 0; i < input.size();)
+    {
+        size_t end = i;
+        while (end < input.size() && input[end] == input[i]) end++;
+        uint8_t* p = putVarint(buf, end - i);
+        *p++ = input[i];
+        runs.insert(runs.end(), buf, p);
+        i = end;
+    }
+
+    MovieHeader h = {};
+    h.magic = MovieHeader::MAGIC;
+    h.version = MovieHeader::VERSION;
+    h.headerSize = sizeof(MovieHeader);
+    h.interval = interval;
+    h.stateSize = stateSize;
+    h.frames = input.size();
+    h.keyframes = uint32_t(index.size());
+    h.inputSize = uint32_t(runs.size());
+
+    const uint64_t start = sizeof(h) + runs.size() + index.size() * sizeof(KeyframeEntry);
+    std::vector<KeyframeEntry> fileIndex(index);
+    for (KeyframeEntry& e : fileIndex) e.offset += start;
+
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    out.write(reinterpret_cast<const char*>(runs.data()), runs.size());
+    out.write(reinterpret_cast<const char*>(fileIndex.data()), fileIndex.size() * sizeof(KeyframeEntry));
+    out.write(reinterpret_cast<const char*>(recorded.data()), recorded.size());
+    if (!out)
+    {
+        std::cerr << filename << " couldnt be written!" << "\n";
+        return false;
+    }
+    return true;
+}
+
+// reads the input and the index, keyframes stay in the file until a seek needs one
+std::unique_ptr<Movie> Movie::open(const std::string& filename)
+{
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    if (!in)
+    {
+        std::cerr << filename << " couldnt be opened!" << "\n";
+        return nullptr;
+    }
+    const uint64_t fileSize = uint64_t(in.tellg());
+    in.seekg(0);
+
+    MovieHeader h = {};
+    if (!in.read(reinterpret_cast<char*>(&h), sizeof(h)) || h.magic != MovieHeader::MAGIC
+        || h.version != MovieHeader::VERSION || h.headerSize != sizeof(MovieHeader) || h.interval == 0)
+    {
+        std::cerr << filename << " is not a movie from this version\n";
+        return nullptr;
+    }
+
+    // the tables have to fit in the file, that also keeps junk frame counts from allocating the world
+    const uint64_t tableSize = uint64_t(h.inputSize) + uint64_t(h.keyframes) * sizeof(KeyframeEntry);
+    if (tableSize > fileSize - sizeof(h) || h.keyframes != (h.frames + h.interval - 1) / h.interval)
+    {
+        std::cerr << filename << " is truncated\n";
+        return nullptr;
+    }
+
+    std::unique_ptr<Movie> movie(new Movie(h.interval));
+    movie->stateSize = h.stateSize;
+    movie->filename = filename;
+
+    std::vector<uint8_t> runs(h.inputSize + PACK_SLACK, 0);
+    movie->index.resize(h.keyframes);
+    in.read(reinterpret_cast<char*>(runs.data()), h.inputSize);
+    in.read(reinterpret_cast<char*>(movie->index.data()), h.keyframes * sizeof(KeyframeEntry));
+
+    const uint8_t* p = runs.data();
+    const uint8_t* end = runs.data() + h.inputSize;
+    while (p < end && movie->input.size() < h.frames)
+    {
+        size_t length;
+        p = getVarint(p, end, length);
+        if (!p || p >= end || length > h.frames - movie->input.size()) break;
+        movie->input.insert(movie->input.end(), length, *p++);
+    }
+
+    bool indexOk = true;
+    for (const KeyframeEntry& e : movie->index)
+        indexOk = indexOk && e.offset <= fileSize && e.size <= fileSize - e.offset;
+    if (!in || movie->input.size() != h.frames || !indexOk)
+    {
+        std::cerr << filename << " is corrupt\n";
+        return nullptr;
+    }
+
+    movie->file = std::move(in);
+    return movie;
+}
+
+// keyframe n into state
+bool Movie::unpackKeyframe(size_t n)
+{
+    const KeyframeEntry& e = index[n];
+    packed.assign(e.size + PACK_SLACK, 0);
+    if (file.is_open())
+    {
+        file.clear();
+        file.seekg(std::streamoff(e.offset));
+        file.read(reinterpret_cast<char*>(packed.data()), std::streamsize(e.size));
+        if (!file)
+        {
+            std::cerr << filename << " couldnt be read!" << "\n";
+            return false;
+        }
+    }
+    else
+    {
+        std::memcpy(packed.data(), recorded.data() + e.offset, e.size);
+    }
+
+    state.assign(stateSize, 0);
+    if (!applyDelta(packed.data(), e.size, state.data(), state.size()))
+    {
+        std::cerr << "movie keyframe " << n << " is corrupt\n";
+        return false;
+    }
+    return true;
+}
+
+// the replay runs headless: nothing drawn but the last frame, no sound or frame dump
+// the same input from the same state always lands on the same state, so this is bit exact
+bool Movie::seek(GameBoy& gb, uint64_t frame)
+{
+    if (frame > input.size() || index.empty()) return false;
+
+    size_t n = std::min<size_t>(frame / interval, index.size() - 1);
+    if (!unpackKeyframe(n) || !gb.loadState(state.data(), state.size())) return false;
+
+    std::unique_ptr<AudioOut> audio = std::move(gb.audio);
+    std::unique_ptr<FrameDump> dump = std::move(gb.frameDump);
+    const bool skipRender = gb.skipRender;
+
+    for (uint64_t f = uint64_t(n) * interval; f < frame && !gb.crashed; ++f)
+    {
+        gb.skipRender = f + 1 < frame;
+        gb.joypad = input[f];
+        gb.runFrame();
+    }
+
+    // a keyframe holds its frame's input already, leave every other frame the same way
+    if (frame < input.size()) gb.joypad = input[frame];
+    gb.skipRender = skipRender;
+    gb.frameDump = std::move(dump);
+    if (audio)
+    {
+        // a round trip through a save state restarts the sound output from where the replay left off
+        gb.audio = std::move(audio);
+        gb.saveState(state);
+        gb.loadState(state.data(), state.size());
+    }
+    return true;
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+class GameBoy;
+
+
+// fixed size header at the front of every movie file, host byte order
+// then inputSize bytes of joypad runs (varint length, buttons), then the keyframe
+// index, then the keyframes themselves, each a save state packed against all zeros
+struct MovieHeader
+{
+    static constexpr uint32_t MAGIC = 0x564D4247; // "GBMV"
+    static constexpr uint16_t VERSION = 1;
+
+    uint32_t magic;
+    uint16_t version;
+    uint16_t headerSize; // sizeof(MovieHeader) when written
+    uint32_t interval;   // frames between keyframes
+    uint32_t stateSize;  // every keyframe unpacks to this many bytes
+    uint64_t frames;
+    uint32_t keyframes;
+    uint32_t inputSize;
+};
+
+// where keyframe n (taken before frame n * interval) sits in the file
+struct KeyframeEntry
+{
+    uint64_t offset;
+    uint64_t size;
+};
+
+
+// joypad input for every frame plus a save state every interval frames
+// seeking loads the nearest keyframe at or before the target and replays only the frames after it
+class Movie
+{
+public:
+    static constexpr uint32_t DEFAULT_INTERVAL = 600; // 10 seconds
+
+    explicit Movie(uint32_t interval = DEFAULT_INTERVAL);
+    static std::unique_ptr<Movie> open(const std::string& filename);
+
+    // call before every frame once its input is set, gb.joypad is taken as that input
+    void record(const GameBoy& gb);
+    bool write(const std::string& filename) const;
+
+    // gb as it was just before frame ran, with that frame's input set
+    // the rom has to be loaded already
+    bool seek(GameBoy& gb, uint64_t frame);
+
+    uint64_t frames() const { return input.size(); }
+    uint8_t buttons(uint64_t frame) const { return frame < input.size() ? input[frame] : 0; }
+    size_t keyframes() const { return index.size(); }
+
+private:
+    bool unpackKeyframe(size_t n);
+
+    uint32_t interval;
+    uint32_t stateSize = 0;
+    std::vector<uint8_t> input; // one byte per frame
+    std::vector<KeyframeEntry> index;
+
+    std::vector<uint8_t> recorded; // packed keyframes of a movie being recorded, index offsets point in here
+    std::ifstream file;            // an opened movie reads its keyframes on demand, offsets are into the file
+    std::string filename;
+
+    std::vector<uint8_t> state;
+    std::vector<uint8_t> zeros;
+    std::vector<uint8_t> packed;
+};
@@ -0,0 +1,29 @@
+#pragma once
+#include <array>
+#include <cstdint>
+
+class GameBoy;
+
+
+// operand is the immediate that follows the opcode (0, 1 or 2 bytes, little endian)
+// PC already points past the whole instruction when a handler runs
+typedef void (*OpHandler)(GameBoy& gb, uint16_t operand);
+
+struct OpInfo
+{
+    OpHandler handler;
+    uint8_t cycles;      // t-cycles, not taken cost for conditional branches
+    uint8_t takenCycles; // extra t-cycles a handler adds when its branch is taken
+    uint8_t length;      // bytes including the opcode
+    bool endsBlock;      // branches, halt/stop, di/ei and invalid opcodes
+};
+
+// both pages are generated at compile time from the opcode bit fields
+// cb entries hold the cost after the 4 cycle 0xCB prefix, their operand is the cb opcode
+extern const std::array<OpInfo, 256> opTable;
+extern const std::array<OpInfo, 256> cbTable;
+
+// 1 = replicate the dispatch into every handler with computed goto (gcc/clang only)
+#ifndef GB_THREADED_DISPATCH
+#define GB_THREADED_DISPATCH 0
+#endif
@@ -0,0 +1,304 @@
+#include "gameboy.h"
+#include "sysInfo.h"
+#include <array>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define GB_SSE2 1
+#else
+#define GB_SSE2 0
+#endif
+
+
+// STAT bits 0-1 mirror the mode, bits 3-5 enable the mode interrupts
+void GameBoy::setLcdMode(uint8_t mode)
+{
+    lcdMode = mode;
+    memory[0xFF41] = (memory[0xFF41] & ~0x03) | mode;
+
+    uint8_t stat = memory[0xFF41];
+    if ((mode == 0 && (stat & 0x08)) || (mode == 1 && (stat & 0x10)) || (mode == 2 && (stat & 0x20)))
+        requestInterrupt(INT_STAT);
+}
+
+void GameBoy::compareLYC()
+{
+    if (memory[0xFF44] == memory[0xFF45])
+    {
+        memory[0xFF41] |= 0x04;
+        if (memory[0xFF41] & 0x40) requestInterrupt(INT_STAT);
+    }
+    else
+    {
+        memory[0xFF41] &= ~0x04;
+    }
+}
+
+void GameBoy::setLcdEnabled(bool on)
+{
+    if (on)
+    {
+        memory[0xFF44] = 0;
+        windowLine = 0;
+        compareLYC();
+        setLcdMode(2);
+        sched.schedule(EVENT_LCD, sched.cycles + CYCLES_OAM_SCAN);
+    }
+    else
+    {
+        // lcd off parks at LY 0 in hblank and stops generating events
+        sched.cancel(EVENT_LCD);
+        memory[0xFF44] = 0;
+        lcdMode = 0;
+        memory[0xFF41] &= ~0x03;
+    }
+}
+
+// one event per mode change, 2 -> 3 -> 0 per line then 1 for the 10 vblank lines
+void GameBoy::lcdEvent(uint64_t when)
+{
+    uint8_t& ly = memory[0xFF44];
+
+    switch (lcdMode)
+    {
+    case 2:
+        setLcdMode(3);
+        sched.schedule(EVENT_LCD, when + CYCLES_DRAWING);
+        break;
+
+    case 3:
+        renderLine();
+        setLcdMode(0);
+        sched.schedule(EVENT_LCD, when + CYCLES_HBLANK);
+        break;
+
+    case 0:
+        ly++;
+        compareLYC();
+        if (ly == 144)
+        {
+            setLcdMode(1);
+            requestInterrupt(INT_VBLANK);
+            frameCount++;
+            frameDone = true;
+            presentFrame();
+            sched.schedule(EVENT_LCD, when + CYCLES_PER_LINE);
+        }
+        else
+        {
+            setLcdMode(2);
+            sched.schedule(EVENT_LCD, when + CYCLES_OAM_SCAN);
+        }
+        break;
+
+    case 1:
+        if (++ly == LINES_PER_FRAME)
+        {
+            ly = 0;
+            windowLine = 0;
+            compareLYC();
+            setLcdMode(2);
+            sched.schedule(EVENT_LCD, when + CYCLES_OAM_SCAN);
+        }
+        else
+        {
+            compareLYC();
+            sched.schedule(EVENT_LCD, when + CYCLES_PER_LINE);
+        }
+        break;
+    }
+}
+
+
+// byte i of spread[b] is bit 7 - i of b, so the two bit planes of a tile row
+// interleave into 8 colour indices with one shift and an or
+static constexpr std::array<uint64_t, 256> makeSpread()
+{
+    std::array<uint64_t, 256> table = {};
+    for (int b = 0; b < 256; ++b)
+        for (int i = 0; i < 8; ++i)
+            if (b & (0x80 >> i)) table[b] |= uint64_t(1) << (i * 8);
+    return table;
+}
+
+static constexpr std::array<uint64_t, 256> spread = makeSpread();
+
+uint64_t GameBoy::tileRow(uint16_t tile, int row)
+{
+    if (tiles.dirty[tile])
+    {
+        const uint8_t* src = &memory[0x8000 + tile * 16];
+        for (int r = 0; r < 8; ++r)
+            tiles.rows[tile][r] = spread[src[r * 2]] | (spread[src[r * 2 + 1]] << 1);
+        tiles.dirty[tile] = false;
+    }
+    return tiles.rows[tile][row];
+}
+
+// count whole tiles from one map row, 8 bytes out per tile
+void GameBoy::fetchTiles(const uint8_t* mapRow, int first, int count, int row, uint8_t* out)
+{
+    const bool unsignedData = memory[0xFF40] & 0x10; // 0x8000 indexing, else 0x8800 signed
+    for (int i = 0; i < count; ++i)
+    {
+        uint8_t index = mapRow[(first + i) & 31];
+        uint16_t tile = unsignedData ? index : 256 + int8_t(index);
+        uint64_t pixels = tileRow(tile, row);
+        std::memcpy(out + i * 8, &pixels, 8);
+    }
+}
+
+// background then window colour indices for the current line, all 0 when both are off
+void GameBoy::drawBackground(uint8_t* bg)
+{
+    const uint8_t lcdc = memory[0xFF40];
+    const uint8_t ly = memory[0xFF44];
+    if (!(lcdc & 0x01))
+    {
+        std::memset(bg, 0, SCREEN_WIDTH);
+        return;
+    }
+
+    uint8_t buffer[(SCREEN_WIDTH / 8 + 1) * 8];
+
+    const uint8_t scx = memory[0xFF43];
+    const uint8_t y = memory[0xFF42] + ly;
+    const uint8_t* bgMap = &memory[(lcdc & 0x08 ? 0x9C00 : 0x9800) + (y >> 3) * 32];
+    fetchTiles(bgMap, scx >> 3, SCREEN_WIDTH / 8 + 1, y & 7, buffer);
+    std::memcpy(bg, buffer + (scx & 7), SCREEN_WIDTH);
+
+    // the window keeps its own line counter, lines it skips dont count
+    const int wx = memory[0xFF4B] - 7;
+    if ((lcdc & 0x20) && memory[0xFF4A] <= ly && wx < SCREEN_WIDTH)
+    {
+        const int start = wx < 0 ? 0 : wx;
+        const uint8_t* winMap = &memory[(lcdc & 0x40 ? 0x9C00 : 0x9800) + (windowLine >> 3) * 32];
+        fetchTiles(winMap, 0, (SCREEN_WIDTH - wx + 7) / 8, windowLine & 7, buffer);
+        std::memcpy(bg + start, buffer + (start - wx), SCREEN_WIDTH - start);
+        windowLine++;
+    }
+}
+
+// colour index and attributes of the winning sprite per pixel, 0 = no sprite
+void GameBoy::drawSprites(uint8_t* obj, uint8_t* attr)
+{
+    std::memset(obj, 0, SCREEN_WIDTH);
+    std::memset(attr, 0, SCREEN_WIDTH);
+
+    const uint8_t lcdc = memory[0xFF40];
+    if (!(lcdc & 0x02)) return;
+
+    const int ly = memory[0xFF44];
+    const int height = (lcdc & 0x04) ? 16 : 8;
+
+    // the first 10 in oam order that cover this line
+    const uint8_t* picked[10];
+    int count = 0;
+    for (int i = 0; i < 40 && count < 10; ++i)
+    {
+        const uint8_t* sprite = &memory[0xFE00 + i * 4];
+        int top = sprite[0] - 16;
+        if (ly >= top && ly < top + height) picked[count++] = sprite;
+    }
+
+    // lower x wins, oam order breaks ties, so a stable sort by x gives drawing priority
+    for (int i = 1; i < count; ++i)
+        for (int j = i; j > 0 && picked[j - 1][1] > picked[j][1]; --j)
+            std::swap(picked[j - 1], picked[j]);
+
+    for (int i = 0; i < count; ++i)
+    {
+        const uint8_t* sprite = picked[i];
+        const uint8_t flags = sprite[3];
+
+        int row = ly - (sprite[0] - 16);
+        if (flags & 0x40) row = height - 1 - row;
+        uint16_t tile = height == 16 ? (sprite[2] & 0xFE) + (row >> 3) : sprite[2];
+
+        uint8_t pixels[8];
+        uint64_t bits = tileRow(tile, row & 7);
+        std::memcpy(pixels, &bits, 8);
+
+        const int x = sprite[1] - 8;
+        for (int p = 0; p < 8; ++p)
+        {
+            int sx = x + p;
+            uint8_t colour = pixels[(flags & 0x20) ? 7 - p : p];
+            if (sx < 0 || sx >= SCREEN_WIDTH || !colour || obj[sx]) continue;
+            obj[sx] = colour;
+            attr[sx] = flags;
+        }
+    }
+}
+
+
+#if GB_SSE2
+static inline __m128i applyPalette(__m128i index, uint8_t palette)
+{
+    __m128i out = _mm_setzero_si128();
+    for (int c = 0; c < 4; ++c)
+    {
+        __m128i hit = _mm_cmpeq_epi8(index, _mm_set1_epi8(char(c)));
+        out = _mm_or_si128(out, _mm_and_si128(hit, _mm_set1_epi8(char((palette >> (c * 2)) & 3))));
+    }
+    return out;
+}
+#endif
+
+// palettes and sprite priority for the whole line, 16 pixels at a time
+static void composeLine(const uint8_t* bg, const uint8_t* obj, const uint8_t* attr, uint8_t bgp, uint8_t obp0, uint8_t obp1, uint8_t* out)
+{
+#if GB_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (int x = 0; x < SCREEN_WIDTH; x += 16)
+    {
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bg + x));
+        __m128i o = _mm_loadu_si128(reinterpret_cast<const __m128i*>(obj + x));
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(attr + x));
+
+        __m128i usePal1 = _mm_cmpeq_epi8(_mm_and_si128(a, _mm_set1_epi8(0x10)), _mm_set1_epi8(0x10));
+        __m128i objShade = _mm_or_si128(_mm_and_si128(usePal1, applyPalette(o, obp1)), _mm_andnot_si128(usePal1, applyPalette(o, obp0)));
+
+        // sprites with the priority bit only show over background colour 0
+        __m128i behind = _mm_cmpeq_epi8(_mm_and_si128(a, _mm_set1_epi8(char(0x80))), _mm_set1_epi8(char(0x80)));
+        __m128i bgOpaque = _mm_andnot_si128(_mm_cmpeq_epi8(b, zero), _mm_set1_epi8(char(0xFF)));
+        __m128i hidden = _mm_or_si128(_mm_cmpeq_epi8(o, zero), _mm_and_si128(behind, bgOpaque));
+
+        __m128i shade = _mm_or_si128(_mm_and_si128(hidden, applyPalette(b, bgp)), _mm_andnot_si128(hidden, objShade));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), shade);
+    }
+#else
+    for (int x = 0; x < SCREEN_WIDTH; ++x)
+    {
+        bool hidden = !obj[x] || ((attr[x] & 0x80) && bg[x]);
+        uint8_t palette = hidden ? bgp : (attr[x] & 0x10) ? obp1 : obp0;
+        uint8_t index = hidden ? bg[x] : obj[x];
+        out[x] = (palette >> (index * 2)) & 3;
+    }
+#endif
+}
+
+// runs as mode 3 ends, so the line sees the registers as they were while it was drawn
+void GameBoy::renderLine()
+{
+    const uint8_t ly = memory[0xFF44];
+    if (ly >= SCREEN_HEIGHT) return;
+
+    alignas(16) uint8_t bg[SCREEN_WIDTH];
+    alignas(16) uint8_t obj[SCREEN_WIDTH];
+    alignas(16) uint8_t attr[SCREEN_WIDTH];
+
+    if (skipRender)
+    {
+        // the window line counter still has to move on skipped frames
+        const int wx = memory[0xFF4B] - 7;
+        const uint8_t lcdc = memory[0xFF40];
+        if ((lcdc & 0x21) == 0x21 && memory[0xFF4A] <= ly && wx < SCREEN_WIDTH) windowLine++;
+        return;
+    }
+
+    drawBackground(bg);
+    drawSprites(obj, attr);
+    composeLine(bg, obj, attr, memory[0xFF47], memory[0xFF48], memory[0xFF49], framebuffer[ly]);
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstdint>
+#include "sysInfo.h"
+
+
+// 0x8000-0x97FF decoded to one colour index per byte, a tile row is 8 pixels in one
+// uint64 with the leftmost pixel in the low byte
+// writes to tile data through the bus mark the tile dirty, it is decoded again the next
+// time a line needs it
+struct TileCache
+{
+    static constexpr int TILES = 384;
+
+    uint64_t rows[TILES][8];
+    bool dirty[TILES];
+
+    TileCache() { invalidate(); }
+    void invalidate()
+    {
+        for (bool& d : dirty) d = true;
+    }
+};
@@ -0,0 +1,224 @@
+#include "profiler.h"
+#include "gameboy.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+
+static const char* const sectionNames[EVENT_COUNT] = { "ppu", "timer", "dma", "serial", "link" };
+
+Profiler::Profiler(bool exact) : exact(exact)
+{
+}
+
+Profiler::Spot& Profiler::spot(uint32_t key)
+{
+    size_t page = key >> 8;
+    if (page >= pages.size()) pages.resize(page + 1);
+    if (!pages[page]) pages[page].reset(new Spot[256]);
+    return pages[page][key & 0xFF];
+}
+
+void Profiler::count(uint32_t key, uint8_t opcode, bool cb)
+{
+    spot(key).count++;
+    if (cb) cbOpcodes[opcode]++;
+    else opcodes[opcode]++;
+}
+
+void Profiler::begin(uint64_t cycles)
+{
+    frameStart = lastCycles = cycles;
+    current = FrameProfile();
+    started = false;
+}
+
+void Profiler::instruction(uint32_t key, uint8_t opcode, bool cb, uint64_t cycles)
+{
+    if (started) spot(lastKey).cycles += cycles - lastCycles;
+    started = true;
+    lastKey = key;
+    lastCycles = cycles;
+    count(key, opcode, cb);
+}
+
+void Profiler::sample(uint32_t key, uint8_t opcode, bool cb, uint64_t cycles)
+{
+    spot(key).cycles += cycles - lastCycles;
+    lastCycles = cycles;
+    count(key, opcode, cb);
+}
+
+void Profiler::endFrame(uint64_t cycles)
+{
+    current.cycles = cycles - frameStart;
+    frames.push_back(current);
+    current = FrameProfile();
+    frameStart = cycles;
+}
+
+std::vector<std::pair<uint32_t, Profiler::Spot>> Profiler::hotSpots() const
+{
+    std::vector<std::pair<uint32_t, Spot>> out;
+    for (size_t page = 0; page < pages.size(); ++page)
+    {
+        if (!pages[page]) continue;
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            const Spot& s = pages[page][i];
+            if (s.count) out.push_back({ uint32_t(page << 8) | i, s });
+        }
+    }
+    std::sort(out.begin(), out.end(), [](const auto& a, const auto& b) { return a.second.cycles > b.second.cycles; });
+    return out;
+}
+
+
+static void writeArray(std::ostream& out, const uint64_t* values, size_t count)
+{
+    out << "[";
+    for (size_t i = 0; i < count; ++i)
+        out << (i ? "," : "") << values[i];
+    out << "]";
+}
+
+bool Profiler::writeJSON(const std::string& filename) const
+{
+    std::ofstream out(filename);
+    if (!out)
+    {
+        std::cerr << filename << " couldnt be written!" << "\n";
+        return false;
+    }
+
+    out << "{\n  \"mode\": \"" << (exact ? "exact" : "sampled") << "\",\n";
+
+    out << "  \"frames\": [";
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        const FrameProfile& f = frames[i];
+        out << (i ? ",\n" : "\n") << "    {\"cycles\": " << f.cycles << ", \"cpuNs\": " << f.cpuNanos << ", \"apuNs\": " << f.apuNanos;
+        for (int e = 0; e < EVENT_COUNT; ++e)
+            out << ", \"" << sectionNames[e] << "Ns\": " << f.eventNanos[e];
+        out << "}";
+    }
+    out << "\n  ],\n";
+
+    out << "  \"hot\": [";
+    std::vector<std::pair<uint32_t, Spot>> hot = hotSpots();
+    for (size_t i = 0; i < hot.size(); ++i)
+    {
+        out << (i ? ",\n" : "\n") << "    {\"bank\": " << (hot[i].first >> 16) << ", \"pc\": " << (hot[i].first & 0xFFFF)
+            << ", \"count\": " << hot[i].second.count << ", \"cycles\": " << hot[i].second.cycles << "}";
+    }
+    out << "\n  ],\n";
+
+    out << "  \"opcodes\": ";
+    writeArray(out, opcodes, 256);
+    out << ",\n  \"cbOpcodes\": ";
+    writeArray(out, cbOpcodes, 256);
+    out << "\n}\n";
+    return bool(out);
+}
+
+bool Profiler::writeCollapsed(const std::string& filename) const
+{
+    std::ofstream out(filename);
+    if (!out)
+    {
+        std::cerr << filename << " couldnt be written!" << "\n";
+        return false;
+    }
+
+    uint64_t cpuNanos = 0, apuNanos = 0;
+    uint64_t eventNanos[EVENT_COUNT] = {};
+    for (const FrameProfile& f : frames)
+    {
+        cpuNanos += f.cpuNanos;
+        apuNanos += f.apuNanos;
+        for (int e = 0; e < EVENT_COUNT; ++e) eventNanos[e] += f.eventNanos[e];
+    }
+
+    if (apuNanos) out << "GB_Emu;apu " << apuNanos << "\n";
+    for (int e = 0; e < EVENT_COUNT; ++e)
+    {
+        if (eventNanos[e]) out << "GB_Emu;" << sectionNames[e] << " " << eventNanos[e] << "\n";
+    }
+
+    std::vector<std::pair<uint32_t, Spot>> hot = hotSpots();
+    uint64_t totalCycles = 0;
+    for (const auto& h : hot) totalCycles += h.second.cycles;
+    if (!totalCycles) return bool(out);
+
+    char name[32];
+    for (const auto& h : hot)
+    {
+        uint64_t weight = uint64_t(double(cpuNanos) * h.second.cycles / totalCycles);
+        if (!weight) continue;
+        std::snprintf(name, sizeof(name), "bank%02X:%04X", h.first >> 16, h.first & 0xFFFF);
+        out << "GB_Emu;cpu;" << name << " " << weight << "\n";
+    }
+    return bool(out);
+}
+
+
+void GameBoy::startProfile(bool exact)
+{
+    profiler = std::make_unique<Profiler>(exact);
+    profiler->begin(sched.cycles);
+    singleStep = trace || exact;
+}
+
+void GameBoy::stopProfile()
+{
+    profiler.reset();
+    singleStep = trace != nullptr;
+}
+
+// the opcode at pc without going near io, cb ops report the byte after the prefix
+void GameBoy::profileAt(bool exactStep)
+{
+    uint16_t pc = regs.PC;
+    const uint8_t* page = readPage[pc >> 8];
+    uint8_t opcode = page ? page[pc & 0xFF] : memory[pc];
+    bool cb = opcode == 0xCB;
+    if (cb)
+    {
+        uint16_t next = pc + 1;
+        page = readPage[next >> 8];
+        opcode = page ? page[next & 0xFF] : memory[next];
+    }
+
+    if (exactStep) profiler->instruction(codeKey(pc), opcode, cb, sched.cycles);
+    else profiler->sample(codeKey(pc), opcode, cb, sched.cycles);
+}
+
+// run() with every stretch of cpu and every event timed, kept apart so the
+// normal loop has nothing extra in it
+void GameBoy::runProfiled(uint64_t target, bool stopAtFrame)
+{
+    using clock = std::chrono::steady_clock;
+
+    while (sched.cycles < target && !crashed)
+    {
+        auto start = clock::now();
+        const uint64_t apuBefore = profiler->apuTime();
+        if (blocks) runBlocks(target);
+        else runInstructions(target);
+        auto end = clock::now();
+        profiler->addCpuTime(end - start, profiler->apuTime() - apuBefore);
+
+        Event event;
+        while (sched.popDue(event))
+        {
+            if (!profiler->exact) profileAt(false);
+            start = end;
+            handleEvent(event);
+            end = clock::now();
+            profiler->addEventTime(event.type, end - start);
+        }
+
+        if (stopAtFrame && frameDone) return;
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "scheduler.h"
+
+
+// host time and emulated cycles for one frame
+// cpu is everything between events but the apu, the rest is split by the event that ran
+// the apu has no event, it catches up when its registers are touched and at frame ends
+struct FrameProfile
+{
+    uint64_t cycles = 0;
+    uint64_t cpuNanos = 0;
+    uint64_t apuNanos = 0;
+    uint64_t eventNanos[EVENT_COUNT] = {};
+};
+
+// where the emulated cpu spends its time, keyed like the block cache: bank << 16 | address
+// sampling (the default) looks at the pc every time an event fires, so it costs
+// nothing per instruction and works with blocks and the jit
+// exact counts every instruction but sends them all through the interpreter
+class Profiler
+{
+public:
+    struct Spot
+    {
+        uint64_t count = 0;  // executions, or samples when not exact
+        uint64_t cycles = 0;
+    };
+
+    explicit Profiler(bool exact);
+
+    const bool exact;
+
+    uint64_t opcodes[256] = {};
+    uint64_t cbOpcodes[256] = {};
+    std::vector<FrameProfile> frames;
+
+    void begin(uint64_t cycles);
+
+    // exact mode, called before each instruction, the cycles since the previous call
+    // belong to the previous instruction
+    void instruction(uint32_t key, uint8_t opcode, bool cb, uint64_t cycles);
+    // sampling mode, the cycles since the last sample are charged to where the cpu is now
+    void sample(uint32_t key, uint8_t opcode, bool cb, uint64_t cycles);
+
+    // apuNanos of it went to apu calls made from the cpu and are already counted there
+    void addCpuTime(std::chrono::steady_clock::duration d, uint64_t apuNanos)
+    {
+        current.cpuNanos += nanos(d) - std::min(nanos(d), apuNanos);
+    }
+    void addApuTime(std::chrono::steady_clock::duration d) { current.apuNanos += nanos(d); }
+    uint64_t apuTime() const { return current.apuNanos; }
+    void addEventTime(EventType type, std::chrono::steady_clock::duration d) { current.eventNanos[type] += nanos(d); }
+    void endFrame(uint64_t cycles);
+
+    // hottest spots first, frames and opcode histograms in full
+    bool writeJSON(const std::string& filename) const;
+    // one line per stack with host nanoseconds as the weight, cpu time split over
+    // the spots by emulated cycles, for flamegraph.pl and speedscope
+    bool writeCollapsed(const std::string& filename) const;
+
+private:
+    static uint64_t nanos(std::chrono::steady_clock::duration d)
+    {
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+    }
+
+    Spot& spot(uint32_t key);
+    void count(uint32_t key, uint8_t opcode, bool cb);
+    std::vector<std::pair<uint32_t, Spot>> hotSpots() const;
+
+    // 256 address pages per bank, allocated the first time anything runs in them
+    std::vector<std::unique_ptr<Spot[]>> pages;
+
+    FrameProfile current;
+    uint64_t frameStart = 0;
+    uint64_t lastCycles = 0;
+    uint32_t lastKey = 0;
+    bool started = false; // lastKey is valid
+};
@@ -0,0 +1,163 @@
+#include "rewind.h"
+#include "gameboy.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+
+// unsigned leb128
+uint8_t* putVarint(uint8_t* out, size_t value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = uint8_t(value) | 0x80;
+        value >>= 7;
+    }
+    *out++ = uint8_t(value);
+    return out;
+}
+
+// null if it runs into end or past what a size_t holds, only junk read back from a file does either
+const uint8_t* getVarint(const uint8_t* in, const uint8_t* end, size_t& value)
+{
+    value = 0;
+    for (int shift = 0; in < end && shift < int(sizeof(size_t) * 8); shift += 7)
+    {
+        const uint8_t b = *in++;
+        if (size_t(b & 0x7F) > (SIZE_MAX >> shift)) return nullptr;
+        value |= size_t(b & 0x7F) << shift;
+        if (!(b & 0x80)) return in;
+    }
+    return nullptr;
+}
+
+// a ^ b as pairs of (zero run, literal run, literal bytes)
+// runs of unchanged bytes are skipped 8 at a time, they are most of every frame
+size_t packDelta(const uint8_t* a, const uint8_t* b, size_t size, uint8_t* out)
+{
+    uint8_t* start = out;
+    size_t pos = 0;
+    while (pos < size)
+    {
+        size_t zeros = pos;
+        while (zeros + 8 <= size)
+        {
+            uint64_t x, y;
+            std::memcpy(&x, a + zeros, 8);
+            std::memcpy(&y, b + zeros, 8);
+            if (x != y) break;
+            zeros += 8;
+        }
+        while (zeros < size && a[zeros] == b[zeros]) zeros++;
+
+        // a literal run ends at the first 2 unchanged bytes in a row
+        size_t end = zeros;
+        while (end < size && (a[end] != b[end] || (end + 1 < size && a[end + 1] != b[end + 1]))) end++;
+
+        out = putVarint(out, zeros - pos);
+        out = putVarint(out, end - zeros);
+        for (size_t i = zeros; i < end; ++i)
+            *out++ = a[i] ^ b[i];
+        pos = end;
+    }
+    return out - start;
+}
+
+// false if the runs dont fit in size bytes, packed data read back from a file can be junk
+bool applyDelta(const uint8_t* in, size_t packedSize, uint8_t* state, size_t size)
+{
+    const uint8_t* endIn = in + packedSize;
+    size_t pos = 0;
+    while (in < endIn)
+    {
+        size_t zeros, literals;
+        in = getVarint(in, endIn, zeros);
+        if (in) in = getVarint(in, endIn, literals);
+        if (!in) return false;
+        if (zeros > size - pos || literals > size - pos - zeros || literals > size_t(endIn - in)) return false;
+        pos += zeros;
+        for (size_t i = 0; i < literals; ++i)
+            state[pos++] ^= *in++;
+    }
+    return true;
+}
+
+
+Rewind::Rewind(size_t bytes, size_t maxFrames) : ring(bytes), sizes(maxFrames)
+{
+}
+
+void Rewind::clear()
+{
+    head = 0;
+    used = 0;
+    first = 0;
+    count = 0;
+    current.clear();
+}
+
+void Rewind::dropOldest()
+{
+    used -= sizes[first];
+    first = (first + 1) % sizes.size();
+    count--;
+}
+
+// entries wrap around the end of the ring, stepBack copies them back out
+void Rewind::push(const uint8_t* data, size_t size)
+{
+    if (size > ring.size())
+    {
+        // one frame changed more than the whole budget, history before it is useless
+        head = used = first = count = 0;
+        return;
+    }
+    while (count && (ring.size() - used < size || count == sizes.size())) dropOldest();
+
+    size_t tail = std::min(size, ring.size() - head);
+    std::memcpy(&ring[head], data, tail);
+    std::memcpy(&ring[0], data + tail, size - tail);
+    head = (head + size) % ring.size();
+    used += size;
+
+    sizes[(first + count) % sizes.size()] = uint32_t(size);
+    count++;
+}
+
+void Rewind::record(const GameBoy& gb)
+{
+    gb.saveState(next);
+    if (current.size() != next.size())
+    {
+        clear();
+        current.swap(next);
+        return;
+    }
+
+    // worst case every other byte changed, 2 varints per changed byte plus the byte
+    packed.resize(current.size() * 2 + 16);
+    size_t size = packDelta(current.data(), next.data(), current.size(), packed.data());
+    push(packed.data(), size);
+    current.swap(next);
+}
+
+bool Rewind::stepBack(GameBoy& gb)
+{
+    if (!count) return false;
+
+    size_t newest = (first + count - 1) % sizes.size();
+    size_t size = sizes[newest];
+    size_t start = (head + ring.size() - size) % ring.size();
+
+    packed.resize(size);
+    size_t tail = std::min(size, ring.size() - start);
+    std::memcpy(packed.data(), &ring[start], tail);
+    std::memcpy(packed.data() + tail, &ring[0], size - tail);
+
+    applyDelta(packed.data(), size, current.data(), current.size());
+    head = start;
+    used -= size;
+    count--;
+
+    return gb.loadState(current.data(), current.size());
+}
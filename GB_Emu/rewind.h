@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class GameBoy;
+
+// a ^ b run length encoded, out needs room for size * 2 + 16 bytes
+// movie.cpp packs its keyframes with these too
+size_t packDelta(const uint8_t* a, const uint8_t* b, size_t size, uint8_t* out);
+bool applyDelta(const uint8_t* in, size_t packedSize, uint8_t* state, size_t size);
+uint8_t* putVarint(uint8_t* out, size_t value);
+const uint8_t* getVarint(const uint8_t* in, const uint8_t* end, size_t& value); // null when cut off or too long
+
+// per frame save states kept as xor deltas against the next newer one, run length
+// encoded into a fixed size byte ring
+// only the newest state is kept whole, stepping back xors the newest delta into it
+// when the ring is full the oldest deltas fall off the far end
+class Rewind
+{
+public:
+    static constexpr size_t DEFAULT_BYTES = 4 << 20;
+    static constexpr size_t DEFAULT_FRAMES = 3600; // 60 seconds
+
+    explicit Rewind(size_t bytes = DEFAULT_BYTES, size_t maxFrames = DEFAULT_FRAMES);
+
+    // call once per frame
+    void record(const GameBoy& gb);
+
+    // restores the frame recorded before the newest one, false once history runs out
+    bool stepBack(GameBoy& gb);
+
+    void clear();
+    size_t frames() const { return count; }
+    size_t bytesUsed() const { return used; }
+
+private:
+    void push(const uint8_t* data, size_t size);
+    void dropOldest();
+
+    std::vector<uint8_t> ring;
+    size_t head = 0; // next write position
+    size_t used = 0;
+
+    std::vector<uint32_t> sizes; // entry sizes, oldest at first
+    size_t first = 0;
+    size_t count = 0;
+
+    std::vector<uint8_t> current; // newest state, whole
+    std::vector<uint8_t> next;
+    std::vector<uint8_t> packed;
+};
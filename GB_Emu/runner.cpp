@@ -0,0 +1,192 @@
+#include "runner.h"
+#include "batch.h"
+#include "gameboy.h"
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+
+struct WorkQueue
+{
+    std::mutex lock;
+    std::deque<size_t> jobs;
+};
+
+static JobResult laneResult(const GameBoy& gb, uint64_t framesRun)
+{
+    JobResult result;
+    result.loaded = true;
+    result.crashed = gb.crashed;
+    result.framesRun = framesRun;
+    result.cycles = gb.sched.cycles;
+    result.regs = gb.regs;
+    result.regs.F = gb.flags();
+    result.status = gb.testStatus();
+    result.output = gb.testOutput();
+    return result;
+}
+
+// jobs on one rom run as lanes of a Batch, input they have in common is only emulated once
+static void runBatch(const std::vector<Job>& jobs, const std::vector<size_t>& lanes, std::vector<JobResult>& results)
+{
+    const Job& first = jobs[lanes[0]];
+    Batch batch;
+    if (!batch.load(first.romPath, lanes.size(), first.jit)) return;
+
+    std::vector<uint16_t> buttons(lanes.size(), 0);
+    std::vector<size_t> nextInput(lanes.size(), 0);
+    size_t active = lanes.size();
+
+    for (uint64_t frame = 0; active; ++frame)
+    {
+        for (size_t i = 0; i < lanes.size(); ++i)
+        {
+            if (buttons[i] == Batch::IDLE) continue;
+            const Job& job = jobs[lanes[i]];
+
+            // done lanes report now, their console may run on for the rest
+            const GameBoy& gb = batch.lane(i);
+            if (frame >= job.frames || gb.crashed || (job.untilResult && gb.testStatus() != TEST_RUNNING))
+            {
+                results[lanes[i]] = laneResult(gb, frame);
+                buttons[i] = Batch::IDLE;
+                active--;
+                continue;
+            }
+
+            while (nextInput[i] < job.input.size() && job.input[nextInput[i]].at <= frame)
+                buttons[i] = job.input[nextInput[i]++].buttons;
+        }
+
+        if (active) batch.runFrame(buttons.data());
+    }
+}
+
+// same rom and same jit setting share a batch, batches are kept small enough that every thread gets one
+static std::vector<std::vector<size_t>> makeBatches(const std::vector<Job>& jobs, unsigned threads)
+{
+    const size_t lanes = std::min(Batch::LANES, std::max<size_t>(1, (jobs.size() + threads - 1) / threads));
+
+    std::vector<std::vector<size_t>> batches;
+    std::map<std::pair<std::string, bool>, size_t> filling;
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        auto key = std::make_pair(jobs[i].romPath, jobs[i].jit);
+        auto open = filling.find(key);
+        if (open == filling.end() || batches[open->second].size() == lanes)
+        {
+            filling[key] = batches.size();
+            batches.emplace_back();
+            open = filling.find(key);
+        }
+        batches[open->second].push_back(i);
+    }
+    return batches;
+}
+
+// own queue from the back, steal from everyone elses front
+static bool takeJob(std::vector<WorkQueue>& queues, size_t self, size_t& index)
+{
+    {
+        std::lock_guard<std::mutex> guard(queues[self].lock);
+        if (!queues[self].jobs.empty())
+        {
+            index = queues[self].jobs.back();
+            queues[self].jobs.pop_back();
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < queues.size(); ++i)
+    {
+        WorkQueue& victim = queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.jobs.empty())
+        {
+            index = victim.jobs.front();
+            victim.jobs.pop_front();
+            return true;
+        }
+    }
+
+    // jobs never spawn more jobs so empty everywhere means done
+    return false;
+}
+
+
+
+std::vector<JobResult> runJobs(const std::vector<Job>& jobs, unsigned threads)
+{
+    std::vector<JobResult> results(jobs.size());
+    if (jobs.empty()) return results;
+
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+
+    const std::vector<std::vector<size_t>> batches = makeBatches(jobs, threads);
+    if (threads > batches.size()) threads = static_cast<unsigned>(batches.size());
+
+    std::vector<WorkQueue> queues(threads);
+    for (size_t i = 0; i < batches.size(); ++i)
+        queues[i % threads].jobs.push_back(i);
+
+    auto worker = [&](size_t self)
+    {
+        size_t index;
+        while (takeJob(queues, self, index))
+            runBatch(jobs, batches[index], results);
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; ++i)
+        pool.emplace_back(worker, i);
+    worker(0);
+
+    for (auto& t : pool)
+        t.join();
+
+    return results;
+}
+
+bool loadJobFile(const std::string& filename, std::vector<Job>& jobs)
+{
+    std::ifstream file(filename);
+    if (!file)
+    {
+        std::cerr << filename << " couldnt be opened!" << "\n";
+        return false;
+    }
+
+    std::string line;
+    for (size_t lineNumber = 1; std::getline(file, line); ++lineNumber)
+    {
+        std::istringstream in(line);
+        Job job;
+        if (!(in >> job.romPath >> job.frames)) continue; // blank or junk line
+
+        std::string event;
+        while (in >> event)
+        {
+            size_t colon = event.find(':');
+            if (colon == std::string::npos) continue;
+
+            InputEvent e;
+            if (!parseNumber(event.substr(0, colon), e.at) || !parseNumber(event.substr(colon + 1), e.buttons, 16))
+            {
+                std::cerr << filename << " line " << lineNumber << ": bad input " << event << "\n";
+                return false;
+            }
+            job.input.push_back(e);
+        }
+
+        jobs.push_back(job);
+    }
+
+    return true;
+}
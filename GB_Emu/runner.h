@@ -0,0 +1,52 @@
+#pragma once
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "gameboy.h"
+
+
+// joypad state change, applies from frame `at` onwards
+struct InputEvent
+{
+    uint64_t at;
+    uint8_t buttons;
+};
+
+struct Job
+{
+    std::string romPath;
+    uint64_t frames = 0;
+    bool jit = false;              // falls back to the block cache on hosts without one
+    std::vector<InputEvent> input; // sorted by at
+    bool untilResult = false;      // stop early once a test rom reports pass or fail
+};
+
+struct JobResult
+{
+    bool loaded = false;
+    bool crashed = false;
+    uint64_t framesRun = 0;
+    uint64_t cycles = 0;
+    Registers regs = {};
+    TestStatus status = TEST_RUNNING;
+    std::string output; // serial log or blargg's result text
+};
+
+
+// runs every job across a work stealing pool, jobs on the same rom go in lockstep
+// batches so stretches of identical input are only emulated once
+// threads = 0 uses every core, results come back in job order
+std::vector<JobResult> runJobs(const std::vector<Job>& jobs, unsigned threads = 0);
+
+// one job per line: rom frames [at:buttons ...], buttons in hex
+bool loadJobFile(const std::string& filename, std::vector<Job>& jobs);
+
+// all of text as a number that fits in value, no sign, spaces or junk after it
+template<typename T>
+bool parseNumber(const std::string& text, T& value, int base = 10)
+{
+    const char* end = text.data() + text.size();
+    std::from_chars_result r = std::from_chars(text.data(), end, value, base);
+    return !text.empty() && r.ec == std::errc() && r.ptr == end;
+}
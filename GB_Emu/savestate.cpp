@@ -0,0 +1,204 @@
+#include "savestate.h"
+#include "gameboy.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+
+static uint16_t romChecksum(const Cartridge& cart)
+{
+    if (!cart.rom) return 0;
+    return (cart.rom->data()[0x014E] << 8) | cart.rom->data()[0x014F];
+}
+
+size_t GameBoy::stateSize() const
+{
+    return sizeof(StateHeader) + sizeof(memory) + cart.ram.size();
+}
+
+// buf is reused between calls so snapshots in a loop never allocate
+void GameBoy::saveState(std::vector<uint8_t>& buf) const
+{
+    buf.resize(stateSize());
+    saveState(buf.data());
+}
+
+// out has room for stateSize() bytes
+void GameBoy::saveState(uint8_t* out) const
+{
+    StateHeader h = {};
+    h.magic = StateHeader::MAGIC;
+    h.version = StateHeader::VERSION;
+    h.headerSize = sizeof(StateHeader);
+    h.ramSize = uint32_t(cart.ram.size());
+    h.romChecksum = romChecksum(cart);
+
+    h.regs = regs;
+    h.regs.F = flags();
+    h.ime = ime;
+    h.eiDelay = eiDelay;
+    h.halted = halted;
+    h.crashed = crashed;
+    h.joypad = joypad;
+
+    h.lcdMode = lcdMode;
+    h.windowLine = windowLine;
+    h.dmaActive = dmaActive;
+    h.frameCount = frameCount;
+
+    h.divBase = divBase;
+    h.timaBase = timaBase;
+    h.sched = sched;
+    h.apu = apu;
+
+    h.ramEnabled = cart.ramEnabled;
+    h.bankLow = cart.bankLow;
+    h.bankHigh = cart.bankHigh;
+    h.ramSelect = cart.ramSelect;
+    h.mode = cart.mode;
+    h.latchWrite = cart.latchWrite;
+    std::memcpy(h.rtc, cart.rtc, sizeof(h.rtc));
+    std::memcpy(h.rtcLatched, cart.rtcLatched, sizeof(h.rtcLatched));
+    h.rtcCycles = cart.rtcCycles;
+
+    std::memcpy(out, &h, sizeof(h));
+    std::memcpy(out + sizeof(h), memory, sizeof(memory));
+    if (!cart.ram.empty()) std::memcpy(out + sizeof(h) + sizeof(memory), cart.ram.data(), cart.ram.size());
+}
+
+// the rom has to be loaded already, boot setup is not needed
+bool GameBoy::loadState(const uint8_t* data, size_t size)
+{
+    StateHeader h;
+    if (size < sizeof(h))
+    {
+        std::cerr << "save state is truncated\n";
+        return false;
+    }
+    std::memcpy(&h, data, sizeof(h));
+    const uint64_t linkNow = sched.cycles - linkBase;
+
+    if (h.magic != StateHeader::MAGIC || h.version != StateHeader::VERSION || h.headerSize != sizeof(StateHeader))
+    {
+        std::cerr << "save state is from another version\n";
+        return false;
+    }
+    if (h.romChecksum != romChecksum(cart) || h.ramSize != cart.ram.size())
+    {
+        std::cerr << "save state is for another cartridge\n";
+        return false;
+    }
+    if (size != stateSize())
+    {
+        std::cerr << (size < stateSize() ? "save state is truncated\n" : "save state has junk at the end\n");
+        return false;
+    }
+
+    regs = h.regs;
+    setFlags(h.regs.F);
+    ime = h.ime;
+    eiDelay = h.eiDelay;
+    halted = h.halted;
+    crashed = h.crashed;
+    joypad = h.joypad;
+
+    lcdMode = h.lcdMode;
+    windowLine = h.windowLine;
+    dmaActive = h.dmaActive;
+    frameCount = h.frameCount;
+    frameDone = false;
+
+    divBase = h.divBase;
+    timaBase = h.timaBase;
+    sched = h.sched;
+    apu = h.apu;
+
+    // the other end of a cable never sees our clock jump, link time carries on from where it was
+    if (link)
+    {
+        linkBase = sched.cycles - linkNow;
+        sched.schedule(EVENT_LINK, sched.cycles);
+    }
+
+    cart.ramEnabled = h.ramEnabled;
+    cart.bankLow = h.bankLow;
+    cart.bankHigh = h.bankHigh;
+    cart.ramSelect = h.ramSelect;
+    cart.mode = h.mode;
+    cart.latchWrite = h.latchWrite;
+    std::memcpy(cart.rtc, h.rtc, sizeof(h.rtc));
+    std::memcpy(cart.rtcLatched, h.rtcLatched, sizeof(h.rtcLatched));
+    cart.rtcCycles = h.rtcCycles;
+
+    std::memcpy(memory, data + sizeof(h), sizeof(memory));
+    updateInterrupts();
+    if (!cart.ram.empty()) std::memcpy(cart.ram.data(), data + sizeof(h) + sizeof(memory), cart.ram.size());
+
+    // rom blocks are still good, anything decoded from ram may not be
+    if (blocks) blocks->dropRam();
+    tiles.invalidate();
+    if (cart.rom) updateBanks();
+    mapPages();
+
+    // the loaded apu may be behind, catch it up quietly so the output carries on from now
+    if (audio)
+    {
+        std::unique_ptr<AudioOut> out = std::move(audio);
+        syncApu();
+        out->restart(apu.cycles);
+        audio = std::move(out);
+        mixApu();
+    }
+    return true;
+}
+
+// a second console in exactly this state, sharing the rom mapping
+// decoded blocks come along, jit output, sinks and profilers dont
+std::unique_ptr<GameBoy> GameBoy::clone() const
+{
+    auto gb = std::make_unique<GameBoy>();
+    gb->initMemory();
+    gb->cart = cart;
+
+    std::vector<uint8_t> state;
+    saveState(state);
+    gb->loadState(state.data(), state.size());
+    std::memcpy(gb->framebuffer, framebuffer, sizeof(framebuffer));
+    gb->skipRender = skipRender;
+
+    if (blocks)
+    {
+        gb->blocks = std::make_unique<BlockCache>(*blocks);
+        gb->blocks->dropNative();
+        gb->mapPages();
+    }
+    if (jit) gb->setJit(true);
+    return gb;
+}
+
+bool GameBoy::saveStateFile(const std::string& filename) const
+{
+    std::vector<uint8_t> buf;
+    saveState(buf);
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.write(reinterpret_cast<const char*>(buf.data()), buf.size()))
+    {
+        std::cerr << filename << " couldnt be written!" << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool GameBoy::loadStateFile(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file)
+    {
+        std::cerr << filename << " couldnt be opened!" << "\n";
+        return false;
+    }
+
+    std::vector<uint8_t> buf((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return loadState(buf.data(), buf.size());
+}
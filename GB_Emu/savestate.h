@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include "apu.h"
+#include "cpu.h"
+#include "scheduler.h"
+
+
+// fixed size header at the front of every save state, host byte order
+// the whole 64KB address space follows it, then ramSize bytes of cartridge ram
+// anything derived (page tables, decoded tiles, cached blocks) is rebuilt on restore
+struct StateHeader
+{
+    static constexpr uint32_t MAGIC = 0x54534247; // "GBST"
+    static constexpr uint16_t VERSION = 5;
+
+    uint32_t magic;
+    uint16_t version;
+    uint16_t headerSize; // sizeof(StateHeader) when written, catches layout changes
+    uint32_t ramSize;
+    uint16_t romChecksum; // header bytes 0x014E-0x014F, restore refuses another game
+
+    // cpu
+    Registers regs;
+    uint8_t ime;
+    uint8_t eiDelay;
+    uint8_t halted;
+    uint8_t crashed;
+    uint8_t joypad;
+
+    // ppu and dma
+    uint8_t lcdMode;
+    uint8_t windowLine;
+    uint8_t dmaActive;
+    uint64_t frameCount;
+
+    // div and tima count from these, everything else pending lives in the queue
+    uint64_t divBase;
+    uint64_t timaBase;
+    Scheduler sched;
+
+    // apu channels, the sound registers and wave ram are in the address space
+    Apu apu;
+
+    // mbc registers
+    uint8_t ramEnabled;
+    uint8_t bankLow;
+    uint8_t bankHigh;
+    uint8_t ramSelect;
+    uint8_t mode;
+    uint8_t latchWrite;
+    uint8_t rtc[5];
+    uint8_t rtcLatched[5];
+    uint64_t rtcCycles;
+};
@@ -0,0 +1,50 @@
+#include "scheduler.h"
+
+
+void Scheduler::schedule(EventType type, uint64_t when)
+{
+    cancel(type);
+
+    // insertion sort, the queue is a handful of entries
+    uint8_t i = count;
+    while (i > 0 && queue[i - 1].when > when)
+    {
+        queue[i] = queue[i - 1];
+        i--;
+    }
+    queue[i] = { when, type };
+    count++;
+}
+
+void Scheduler::cancel(EventType type)
+{
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        if (queue[i].type != type) continue;
+
+        for (uint8_t j = i + 1; j < count; ++j)
+            queue[j - 1] = queue[j];
+        count--;
+        return;
+    }
+}
+
+uint64_t Scheduler::when(EventType type) const
+{
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        if (queue[i].type == type) return queue[i].when;
+    }
+    return UINT64_MAX;
+}
+
+bool Scheduler::popDue(Event& event)
+{
+    if (count == 0 || queue[0].when > cycles) return false;
+
+    event = queue[0];
+    for (uint8_t j = 1; j < count; ++j)
+        queue[j - 1] = queue[j];
+    count--;
+    return true;
+}
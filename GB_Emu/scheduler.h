@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+
+
+enum EventType : uint8_t
+{
+    EVENT_LCD,   // next lcd mode transition
+    EVENT_TIMER, // tima overflow, div and tima themselves are worked out when read
+    EVENT_DMA,   // oam dma finished
+    EVENT_SERIAL, // serial byte shifted out
+    EVENT_LINK,  // link cable sync point, or a byte from the other end landing
+    EVENT_COUNT
+};
+
+struct Event
+{
+    uint64_t when;
+    EventType type;
+};
+
+
+// future events kept sorted by timestamp, soonest first
+// at most one pending event per type so the queue never grows
+// plain data on purpose, copying it copies the whole schedule
+struct Scheduler
+{
+    uint64_t cycles = 0; // master clock, t-cycles since power on
+    Event queue[EVENT_COUNT] = {};
+    uint8_t count = 0;
+
+    void schedule(EventType type, uint64_t when);
+    void cancel(EventType type);
+
+    // timestamp of the soonest event, or never
+    uint64_t nextEvent() const { return count ? queue[0].when : UINT64_MAX; }
+
+    // timestamp of the pending event of this type, or never
+    uint64_t when(EventType type) const;
+
+    // removes and returns the soonest event if it is due
+    bool popDue(Event& event);
+};
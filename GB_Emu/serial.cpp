@@ -0,0 +1,166 @@
+#include "gameboy.h"
+#include "sysInfo.h"
+#include <algorithm>
+
+
+// an internal clock shifts the byte out on its own, down the cable if there is one
+// an external clock only ever ticks when the other end of a cable starts a transfer
+void GameBoy::writeSerialControl(uint8_t value)
+{
+    memory[0xFF02] = value & 0x81;
+    if ((value & 0x81) == 0x81)
+    {
+        if (serialLog.size() < SERIAL_LOG_MAX) serialLog += char(memory[0xFF01]);
+        sched.schedule(EVENT_SERIAL, sched.cycles + CYCLES_SERIAL_BYTE);
+        if (link)
+        {
+            linkSent = sched.cycles + CYCLES_SERIAL_BYTE - linkBase;
+            linkReply = -1;
+            link->send({ linkSent, LINK_TRANSFER, memory[0xFF01] });
+        }
+    }
+    else
+    {
+        sched.cancel(EVENT_SERIAL);
+    }
+}
+
+// with nobody on the other end the byte shifted in is all ones
+// with a cable the other end has to get this far before its byte is known
+void GameBoy::serialEvent()
+{
+    uint8_t in = 0xFF;
+    if (link)
+    {
+        const uint64_t now = sched.cycles - linkBase;
+        link->publish(now);
+
+        unsigned spins = 0;
+        for (;;)
+        {
+            bool gone = link->peerTime() == LinkCable::GONE;
+            linkPump();
+            if (linkIncoming <= now) linkExchange(); // both ends started a transfer at once
+            if (linkReply >= 0 || gone) break;
+            link->wait(spins);
+        }
+        if (linkReply >= 0) in = uint8_t(linkReply);
+        linkSent = UINT64_MAX;
+        linkReply = -1;
+    }
+
+    memory[0xFF01] = in;
+    memory[0xFF02] &= 0x7F;
+    requestInterrupt(INT_SERIAL);
+}
+
+// link time starts at 0 on both ends whatever either console has run before
+void GameBoy::attachLink(std::unique_ptr<LinkCable> cable)
+{
+    link = std::move(cable);
+    linkBase = sched.cycles;
+    linkIncoming = UINT64_MAX;
+    linkSent = UINT64_MAX;
+    linkReply = -1;
+    sched.schedule(EVENT_LINK, sched.cycles);
+}
+
+void GameBoy::detachLink()
+{
+    link.reset();
+    sched.cancel(EVENT_LINK);
+}
+
+// takes everything the other end has sent so far
+void GameBoy::linkPump()
+{
+    LinkMessage m;
+    while (link->receive(m))
+    {
+        if (m.kind == LINK_TRANSFER)
+        {
+            linkIncoming = m.when;
+            linkByte = m.byte;
+        }
+        else if (m.when == linkSent)
+        {
+            linkReply = m.byte; // replies to a transfer cancelled since are dropped
+        }
+    }
+}
+
+// the other end's clock shifted its byte in and ours out, whether or not we were listening
+void GameBoy::linkExchange()
+{
+    const bool listening = (memory[0xFF02] & 0x81) == 0x80;
+    link->send({ linkIncoming, LINK_REPLY, listening ? memory[0xFF01] : uint8_t(0xFF) });
+    linkIncoming = UINT64_MAX;
+    if (!listening) return;
+
+    if (serialLog.size() < SERIAL_LOG_MAX) serialLog += char(memory[0xFF01]);
+    memory[0xFF01] = linkByte;
+    memory[0xFF02] &= 0x7F;
+    requestInterrupt(INT_SERIAL);
+}
+
+// keeps this end at most a byte's time ahead of the other, so a transfer the other end
+// starts can never land in our past. each end only waits when it gets that far ahead
+void GameBoy::linkEvent()
+{
+    if (!link) return; // a state saved while linked, loaded without
+    const uint64_t now = sched.cycles - linkBase;
+    link->publish(now);
+
+    uint64_t peer;
+    unsigned spins = 0;
+    for (;;)
+    {
+        // the clock first, anything sent before it moved is in the queue by the time we pump
+        peer = link->peerTime();
+        linkPump();
+        if (linkIncoming <= now) linkExchange();
+        if (peer == LinkCable::GONE || peer + CYCLES_SERIAL_BYTE > now) break;
+        link->wait(spins);
+    }
+
+    uint64_t next = std::min(linkIncoming, peer == LinkCable::GONE ? UINT64_MAX : peer + CYCLES_SERIAL_BYTE);
+    if (next != UINT64_MAX) sched.schedule(EVENT_LINK, linkBase + next);
+}
+
+// the verdict counts once its line is finished, so the rest of it makes it into the log
+static bool printed(const std::string& log, const char* word)
+{
+    size_t at = log.find(word);
+    return at != std::string::npos && log.find('\n', at) != std::string::npos;
+}
+
+// blargg roms print Passed or Failed, the newer ones also leave a signature and a result code
+// at 0xA000. mooneye roms load the fibonacci numbers into b c d e h l to pass, 0x42 into all six to fail
+TestStatus GameBoy::testStatus() const
+{
+    if (printed(serialLog, "Passed")) return TEST_PASSED;
+    if (printed(serialLog, "Failed")) return TEST_FAILED;
+
+    const CartRam& ram = cart.ram;
+    if (ram.size() >= 4 && ram[1] == 0xDE && ram[2] == 0xB0 && ram[3] == 0x61 && ram[0] != 0x80)
+        return ram[0] == 0 ? TEST_PASSED : TEST_FAILED;
+
+    if (regs.B == 3 && regs.C == 5 && regs.D == 8 && regs.E == 13 && regs.H == 21 && regs.L == 34) return TEST_PASSED;
+    if (regs.B == 0x42 && regs.C == 0x42 && regs.D == 0x42 && regs.E == 0x42 && regs.H == 0x42 && regs.L == 0x42) return TEST_FAILED;
+    return TEST_RUNNING;
+}
+
+// what the rom had to say: the serial log, or the text blargg roms leave after the signature
+std::string GameBoy::testOutput() const
+{
+    if (!serialLog.empty()) return serialLog;
+
+    const CartRam& ram = cart.ram;
+    std::string text;
+    if (ram.size() >= 4 && ram[1] == 0xDE && ram[2] == 0xB0 && ram[3] == 0x61)
+    {
+        for (size_t i = 4; i < ram.size() && ram[i]; ++i)
+            text += char(ram[i]);
+    }
+    return text;
+}
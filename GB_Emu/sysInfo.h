@@ -1,3 +1,5 @@
+#pragma once
+#include <cstdint>
 /*
 
 	gameboy (revision 1?)
@@ -20,4 +22,30 @@
 
 
 
-*/
\ No newline at end of file
+*/
+
+constexpr int SCREEN_WIDTH = 160;
+constexpr int SCREEN_HEIGHT = 144;
+
+constexpr uint32_t CLOCK_HZ = 4194304;          // t-cycles per second
+constexpr uint32_t CYCLES_PER_LINE = 456;       // 4194304 / 456 = 9.198 khz hsync
+constexpr uint32_t LINES_PER_FRAME = 154;       // 144 visible + 10 vblank
+constexpr uint32_t CYCLES_PER_FRAME = CYCLES_PER_LINE * LINES_PER_FRAME; // 70224, 59.73 hz vsync
+constexpr double FRAME_RATE = double(CLOCK_HZ) / CYCLES_PER_FRAME;
+
+// mode lengths within one visible line
+constexpr uint32_t CYCLES_OAM_SCAN = 80;  // mode 2
+constexpr uint32_t CYCLES_DRAWING = 172;  // mode 3
+constexpr uint32_t CYCLES_HBLANK = CYCLES_PER_LINE - CYCLES_OAM_SCAN - CYCLES_DRAWING; // mode 0
+
+constexpr uint32_t CYCLES_DIV = 256;      // div ticks at 16384 hz
+constexpr uint32_t CYCLES_OAM_DMA = 640;  // 160 bytes, one per m-cycle
+constexpr uint32_t CYCLES_SEQUENCER = 8192; // apu frame sequencer at 512 hz
+constexpr uint32_t CYCLES_SERIAL_BYTE = 4096; // internal clock, 8 bits at 8192 hz
+
+// IF / IE bits
+constexpr uint8_t INT_VBLANK = 0x01;
+constexpr uint8_t INT_STAT = 0x02;
+constexpr uint8_t INT_TIMER = 0x04;
+constexpr uint8_t INT_SERIAL = 0x08;
+constexpr uint8_t INT_JOYPAD = 0x10;
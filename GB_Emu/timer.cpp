@@ -0,0 +1,93 @@
+#include "gameboy.h"
+#include "sysInfo.h"
+
+
+// t-cycles per tima increment for each TAC clock select
+static const uint32_t timerPeriods[4] = { 1024, 16, 64, 256 };
+
+
+// DIV and TIMA are never stepped, they are worked out from the master clock when read
+// the only timer event left is the tick that takes TIMA past 0xFF
+
+// DIV is the top byte of a counter that started at divBase
+uint8_t GameBoy::readDIV() const
+{
+    return uint8_t((sched.cycles - divBase) / CYCLES_DIV);
+}
+
+// tima clock edges in (from, to], they run off the DIV counter so a DIV reset moves them too
+uint64_t GameBoy::timerTicks(uint64_t from, uint64_t to) const
+{
+    const uint32_t period = timerPeriods[memory[0xFF07] & 0x03];
+    return (to - divBase) / period - (from - divBase) / period;
+}
+
+// the next time the timer register at addr reads differently, a spin loop polling it cant be skipped past it
+// DIV always steps every CYCLES_DIV, TIMA at its own rate while it runs
+uint64_t GameBoy::timerNextChange(uint16_t addr) const
+{
+    uint32_t period = CYCLES_DIV;
+    if (addr == 0xFF05 && (memory[0xFF07] & 0x04)) period = timerPeriods[memory[0xFF07] & 0x03];
+    return divBase + ((sched.cycles - divBase) / period + 1) * period;
+}
+
+// memory[0xFF05] holds TIMA as of timaBase
+uint8_t GameBoy::readTIMA() const
+{
+    const uint8_t tima = memory[0xFF05];
+    if (!(memory[0xFF07] & 0x04)) return tima;
+
+    const uint64_t ticks = timerTicks(timaBase, sched.cycles);
+    if (ticks < 256u - tima) return uint8_t(tima + ticks);
+    return uint8_t(memory[0xFF06] + ticks - (256u - tima)); // read mid instruction, the reload event hasnt run yet
+}
+
+// folds the ticks so far into TIMA, before anything that changes how it counts
+void GameBoy::syncTimer()
+{
+    memory[0xFF05] = readTIMA();
+    timaBase = sched.cycles;
+}
+
+void GameBoy::scheduleTimer()
+{
+    if (!(memory[0xFF07] & 0x04))
+    {
+        sched.cancel(EVENT_TIMER);
+        return;
+    }
+
+    const uint32_t period = timerPeriods[memory[0xFF07] & 0x03];
+    const uint64_t edges = (timaBase - divBase) / period + (256u - memory[0xFF05]);
+    sched.schedule(EVENT_TIMER, divBase + edges * period);
+}
+
+void GameBoy::timerEvent(uint64_t when)
+{
+    memory[0xFF05] = memory[0xFF06]; // reload from TMA
+    timaBase = when;
+    requestInterrupt(INT_TIMER);
+    scheduleTimer();
+}
+
+// any write to DIV clears the whole counter
+void GameBoy::resetDIV()
+{
+    syncTimer();
+    divBase = sched.cycles;
+    scheduleTimer();
+}
+
+void GameBoy::writeTIMA(uint8_t value)
+{
+    syncTimer();
+    memory[0xFF05] = value;
+    scheduleTimer();
+}
+
+void GameBoy::writeTAC(uint8_t value)
+{
+    syncTimer();
+    memory[0xFF07] = 0xF8 | (value & 0x07);
+    scheduleTimer();
+}
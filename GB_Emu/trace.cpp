@@ -0,0 +1,105 @@
+#include "trace.h"
+#include "gameboy.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+
+std::unique_ptr<Trace> Trace::open(const std::string& filename, size_t records)
+{
+    std::unique_ptr<Trace> t(new Trace(records));
+    t->file.open(filename, std::ios::binary);
+
+    TraceFileHeader h = { TraceFileHeader::MAGIC, TraceFileHeader::VERSION, sizeof(TraceRecord) };
+    if (!t->file.write(reinterpret_cast<const char*>(&h), sizeof(h)))
+    {
+        std::cerr << filename << " couldnt be written!" << "\n";
+        return nullptr;
+    }
+
+    t->writer = std::thread(&Trace::drain, t.get());
+    return t;
+}
+
+Trace::Trace(size_t records)
+{
+    size_t size = 1;
+    while (size < records) size <<= 1;
+    ring.resize(size);
+    mask = size - 1;
+}
+
+Trace::~Trace()
+{
+    stopping.store(true, std::memory_order_release);
+    if (writer.joinable()) writer.join();
+}
+
+// writes everything the producer has published, up to the end of the ring then from the start
+void Trace::drain()
+{
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    while (true)
+    {
+        bool last = stopping.load(std::memory_order_acquire);
+        uint64_t h = head.load(std::memory_order_acquire);
+        if (h == t)
+        {
+            if (last) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        while (t != h)
+        {
+            size_t start = size_t(t & mask);
+            size_t count = size_t(std::min<uint64_t>(h - t, ring.size() - start));
+            file.write(reinterpret_cast<const char*>(&ring[start]), count * sizeof(TraceRecord));
+            t += count;
+            tail.store(t, std::memory_order_release);
+        }
+    }
+    file.flush();
+}
+
+
+bool GameBoy::startTrace(const std::string& filename)
+{
+    trace.reset(); // finish the old file first
+    trace = Trace::open(filename);
+    singleStep = trace || (profiler && profiler->exact);
+    return trace != nullptr;
+}
+
+void GameBoy::stopTrace()
+{
+    trace.reset();
+    singleStep = profiler && profiler->exact;
+}
+
+void GameBoy::traceInstruction(uint8_t opcode)
+{
+    TraceRecord r;
+    r.cycles = sched.cycles;
+    r.pc = regs.PC;
+    r.sp = regs.SP;
+    r.a = regs.A;
+    r.f = flags();
+    r.b = regs.B;
+    r.c = regs.C;
+    r.d = regs.D;
+    r.e = regs.E;
+    r.h = regs.H;
+    r.l = regs.L;
+    r.opcode = opcode;
+    r.flags = ime ? TRACE_IME : 0;
+    r.pad[0] = r.pad[1] = 0;
+
+    // the prefix byte alone says nothing, record the real opcode
+    if (opcode == 0xCB)
+    {
+        r.opcode = read8(regs.PC + 1);
+        r.flags |= TRACE_CB;
+    }
+    trace->push(r);
+}
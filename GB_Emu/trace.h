@@ -0,0 +1,89 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// trace file layout: TraceFileHeader then TraceRecords back to back, host byte order
+struct TraceFileHeader
+{
+    static constexpr uint32_t MAGIC = 0x52544247; // "GBTR"
+    static constexpr uint16_t VERSION = 1;
+
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize; // sizeof(TraceRecord) when written
+};
+
+enum TraceFlags : uint8_t
+{
+    TRACE_IME = 0x01,
+    TRACE_CB = 0x02, // opcode is the byte after a 0xCB prefix
+};
+
+// cpu state just before one instruction runs
+struct TraceRecord
+{
+    uint64_t cycles;
+    uint16_t pc;
+    uint16_t sp;
+    uint8_t a, f, b, c, d, e, h, l;
+    uint8_t opcode;
+    uint8_t flags;
+    uint8_t pad[2];
+};
+static_assert(sizeof(TraceRecord) == 24, "trace records are a fixed 24 bytes");
+
+
+// single producer, single consumer ring of records
+// the emulator thread pushes, a background thread drains to disk in big writes
+// the producer only waits if the disk falls a whole ring behind, records are never dropped
+class Trace
+{
+public:
+    static constexpr size_t DEFAULT_RECORDS = 1 << 16; // 1.5MB, power of 2
+
+    // null when the file cant be created
+    static std::unique_ptr<Trace> open(const std::string& filename, size_t records = DEFAULT_RECORDS);
+    ~Trace(); // writes out whatever is left
+
+    void push(const TraceRecord& r);
+    uint64_t recorded() const { return head.load(std::memory_order_relaxed); }
+
+private:
+    Trace(size_t records);
+    void drain();
+
+    std::vector<TraceRecord> ring;
+    size_t mask;
+    std::ofstream file;
+    std::thread writer;
+    std::atomic<bool> stopping{ false };
+
+    // each side on its own cache line so they dont fight over it
+    alignas(64) std::atomic<uint64_t> head{ 0 }; // written by the emulator
+    uint64_t tailSeen = 0;                        // producer's last look at tail
+    alignas(64) std::atomic<uint64_t> tail{ 0 }; // written by the drain thread
+};
+
+
+inline void Trace::push(const TraceRecord& r)
+{
+    uint64_t h = head.load(std::memory_order_relaxed);
+    if (h - tailSeen == ring.size())
+    {
+        tailSeen = tail.load(std::memory_order_acquire);
+        while (h - tailSeen == ring.size())
+        {
+            std::this_thread::yield();
+            tailSeen = tail.load(std::memory_order_acquire);
+        }
+    }
+    ring[h & mask] = r;
+    head.store(h + 1, std::memory_order_release);
+}
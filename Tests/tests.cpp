@@ -0,0 +1,761 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#include "batch.h"
+#include "gameboy.h"
+#include "gbapi.h"
+#include "link.h"
+#include "movie.h"
+#include "rewind.h"
+#include "runner.h"
+
+// usage: GB_Tests [--rom F] [--frames N] [--blocks N] [check ...]
+// with no checks named every one runs, exit code 0 = all passed
+
+#ifndef GB_TEST_ROM
+#define GB_TEST_ROM "Tests/Tetris.gb"
+#endif
+
+
+struct Options
+{
+    std::string rom = GB_TEST_ROM;
+    uint64_t frames = 3600;
+    uint64_t blocks = 20000; // random blocks for jit.fuzz
+};
+
+// fnv-1a over a whole save state, two consoles that agree here agree on everything
+static uint64_t stateHash(const GameBoy& gb)
+{
+    std::vector<uint8_t> state;
+    gb.saveState(state);
+    uint64_t h = 1469598103934665603ULL;
+    for (uint8_t b : state)
+    {
+        h ^= b;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// a file name in the temp directory nobody else is using, ctest may run the threaded
+// build's copy of a check at the same time
+static std::string tempPath(const std::string& name)
+{
+    const std::string unique = std::to_string(std::random_device()()) + "_" + name;
+    return (std::filesystem::temp_directory_path() / unique).string();
+}
+
+static std::unique_ptr<GameBoy> bootTetris(const std::string& rom)
+{
+    auto gb = std::make_unique<GameBoy>();
+    gb->initMemory();
+    if (!gb->loadROM(rom)) return nullptr;
+    gb->bootSetup();
+    gb->postBootSetup();
+    return gb;
+}
+
+// title screen, press start, then let the demo play
+static uint8_t tetrisInput(uint64_t frame)
+{
+    return (frame >= 500 && frame < 510) ? BUTTON_START : 0;
+}
+
+
+// the interpreter, the block cache and the jit all end a long run in the same state
+static bool modesTetris(const Options& opts)
+{
+    const char* names[] = { "interpreter", "blocks", "jit" };
+    uint64_t expected = 0;
+    bool ok = true;
+
+    for (int mode = 0; mode < 3; ++mode)
+    {
+        auto gb = bootTetris(opts.rom);
+        if (!gb) return false;
+        gb->setBlockCache(mode > 0);
+        if (mode == 2 && !gb->setJit(true))
+        {
+            std::cout << "  no jit on this host, skipped\n";
+            continue;
+        }
+
+        for (uint64_t f = 0; f < opts.frames && !gb->crashed; ++f)
+        {
+            gb->joypad = tetrisInput(f);
+            gb->runFrame();
+        }
+
+        const uint64_t hash = stateHash(*gb);
+        std::printf("  %-12s %016llx after %llu frames\n", names[mode], (unsigned long long)hash, (unsigned long long)opts.frames);
+        if (mode == 0) expected = hash;
+        else if (hash != expected) ok = false;
+        if (gb->crashed) ok = false;
+    }
+    return ok;
+}
+
+
+// reaches the private parts of the core
+struct Tests
+{
+    // a console with random work ram, hram and registers and prog at 0xD000
+    // pointers land in ram so most loads and stores hit something that can differ
+    static std::unique_ptr<GameBoy> fuzzConsole(uint32_t seed, const uint8_t* prog, size_t size)
+    {
+        std::mt19937 rng(seed);
+        auto gb = std::make_unique<GameBoy>();
+        gb->initMemory();
+        gb->bootSetup();
+        gb->postBootSetup();
+        for (int i = 0xC000; i < 0xE000; ++i) gb->memory[i] = uint8_t(rng());
+        for (int i = 0xFF80; i < 0xFFFF; ++i) gb->memory[i] = uint8_t(rng());
+        std::memcpy(gb->memory + 0xD000, prog, size);
+
+        gb->regs.A = uint8_t(rng());
+        gb->setFlags(uint8_t(rng()) & 0xF0);
+        gb->regs.setBC(0xC000 | (rng() & 0x1FFF));
+        gb->regs.setDE(0xC000 | (rng() & 0x1FFF));
+        gb->regs.setHL((rng() & 1) ? 0xC000 | (rng() & 0x1FFF) : 0xFF80 + rng() % 0x70);
+        gb->regs.SP = 0xDFF0;
+        gb->regs.PC = 0xD000;
+        gb->ime = false;
+        gb->setBlockCache(true);
+        return gb;
+    }
+
+    // the same random block run as native code on one console and through its handlers
+    // on a twin, registers, cycles and all of memory have to come out the same
+    static bool jitFuzz(const Options& opts)
+    {
+        // ops the compiler emits itself, the rest fall back to handlers and are less interesting
+        static const uint8_t native[] = {
+            0x00, 0x01, 0x11, 0x21, 0x31, 0x03, 0x13, 0x23, 0x33, 0x0B, 0x1B, 0x2B, 0x3B,
+            0x0A, 0x1A, 0x2A, 0x3A, 0x02, 0x12, 0x22, 0x32, 0x36, 0xE0, 0xE2, 0xF0, 0xF2,
+            0x04, 0x0C, 0x14, 0x1C, 0x24, 0x2C, 0x3C, 0x05, 0x0D, 0x15, 0x1D, 0x25, 0x2D, 0x3D,
+            0x2F, 0x37, 0x3F, 0x06, 0x0E, 0x16, 0x1E, 0x26, 0x2E, 0x3E,
+            0x20, 0x28, 0x30, 0x38, 0xC2, 0xCA, 0xD2, 0xDA, 0x18, 0xC3, 0xCB, 0xCB,
+        };
+
+        if (!std::make_unique<Jit>()->ok())
+        {
+            std::cout << "  no jit on this host, skipped\n";
+            return true;
+        }
+
+        std::mt19937 rng(1234);
+        uint64_t compiled = 0, mismatches = 0;
+        for (uint64_t t = 0; t < opts.blocks; ++t)
+        {
+            uint8_t prog[64];
+            for (uint8_t& b : prog)
+            {
+                b = uint8_t(rng());
+                if (rng() % 3 == 0) continue;
+                b = (rng() & 1) ? native[rng() % sizeof(native)] : uint8_t(0x40 + rng() % 0x80);
+            }
+            // halt would leave the native side waiting on nothing, the holes in the table just crash
+            static const uint8_t skip[] = { 0x76, 0xD3, 0xDB, 0xDD, 0xE3, 0xE4, 0xEB, 0xEC, 0xED, 0xF4, 0xFC, 0xFD };
+            for (size_t pc = 0; pc < sizeof(prog); pc += opTable[prog[pc]].length)
+                if (std::memchr(skip, prog[pc], sizeof(skip))) prog[pc] = 0x00;
+
+            const uint32_t seed = rng();
+            auto a = fuzzConsole(seed, prog, sizeof(prog));
+            auto b = fuzzConsole(seed, prog, sizeof(prog));
+            Block* ba = a->lookupBlock(0xD000);
+            Block* bb = b->lookupBlock(0xD000);
+            if (!ba || !bb) continue;
+
+            a->setJit(true);
+            NativeBlock fn = a->compileBlock(*ba);
+            if (!fn) continue;
+            compiled++;
+
+            a->blockBreak = false;
+            fn(a.get());
+
+            b->blockBreak = false;
+            for (int i = 0; i < bb->count; ++i)
+            {
+                const MicroOp& op = bb->ops[i];
+                b->regs.PC += op.length;
+                b->sched.cycles += op.cycles;
+                op.handler(*b, op.operand);
+                if (b->blockBreak) break;
+            }
+
+            a->syncFlags();
+            b->syncFlags();
+            const bool same = std::memcmp(&a->regs, &b->regs, sizeof(Registers)) == 0
+                && a->sched.cycles == b->sched.cycles && a->ime == b->ime && a->halted == b->halted
+                && std::memcmp(a->memory, b->memory, sizeof(a->memory)) == 0;
+            if (same) continue;
+
+            if (mismatches++ < 5)
+            {
+                std::printf("  block %llu:", (unsigned long long)t);
+                for (int i = 0; i < bb->count; ++i) std::printf(" %02x:%04x", bb->ops[i].opcode, bb->ops[i].operand);
+                std::printf("\n    native  AF %02x%02x BC %04x DE %04x HL %04x SP %04x PC %04x cycles %llu\n",
+                    a->regs.A, a->regs.F, a->regs.BC(), a->regs.DE(), a->regs.HL(), a->regs.SP, a->regs.PC, (unsigned long long)a->sched.cycles);
+                std::printf("    handler AF %02x%02x BC %04x DE %04x HL %04x SP %04x PC %04x cycles %llu\n",
+                    b->regs.A, b->regs.F, b->regs.BC(), b->regs.DE(), b->regs.HL(), b->regs.SP, b->regs.PC, (unsigned long long)b->sched.cycles);
+            }
+        }
+
+        std::printf("  %llu blocks compiled, %llu mismatches\n", (unsigned long long)compiled, (unsigned long long)mismatches);
+        return compiled > 0 && mismatches == 0;
+    }
+};
+
+
+// with blocks compiled nothing in the process is writable and executable at once
+static bool jitNoWx(const Options& opts)
+{
+    auto gb = bootTetris(opts.rom);
+    if (!gb) return false;
+    if (!gb->setJit(true))
+    {
+        std::cout << "  no jit on this host, skipped\n";
+        return true;
+    }
+    for (uint64_t f = 0; f < 600; ++f)
+    {
+        gb->joypad = tetrisInput(f);
+        gb->runFrame();
+    }
+
+    std::ifstream maps("/proc/self/maps");
+    if (!maps)
+    {
+        std::cout << "  no /proc/self/maps, skipped\n";
+        return true;
+    }
+    int writableCode = 0;
+    for (std::string line; std::getline(maps, line);)
+    {
+        const size_t perms = line.find(' ') + 1;
+        if (line.compare(perms, 3, "rwx") == 0 && writableCode++ < 5) std::printf("  %s\n", line.c_str());
+    }
+    return gb->jit && writableCode == 0;
+}
+
+
+// 16 lanes pressing different buttons from the first frame on, run as one batch in lockstep
+// and each on a console of its own, every lane has to end in the same state either way
+static bool batchLockstep(const Options& opts)
+{
+    const uint64_t frames = 800;
+    const size_t lanes = Batch::LANES;
+    auto buttonsFor = [](size_t lane, uint64_t f) {
+        const uint8_t mix = uint8_t((lane ^ (f / 16)) & 15);
+        return uint16_t(tetrisInput(f) | (mix & 3) | (mix & 12) << 2);
+    };
+
+    std::vector<uint64_t> expected;
+    for (size_t lane = 0; lane < lanes; ++lane)
+    {
+        auto gb = bootTetris(opts.rom);
+        if (!gb) return false;
+        gb->setBlockCache(true);
+        for (uint64_t f = 0; f < frames; ++f)
+        {
+            gb->joypad = uint8_t(buttonsFor(lane, f));
+            gb->runFrame();
+        }
+        expected.push_back(stateHash(*gb));
+    }
+
+    bool ok = true;
+    for (int jit = 0; jit < 2; ++jit)
+    {
+        Batch batch;
+        if (!batch.load(opts.rom, lanes, jit != 0)) return false;
+        std::vector<uint16_t> buttons(lanes);
+        for (uint64_t f = 0; f < frames; ++f)
+        {
+            for (size_t lane = 0; lane < lanes; ++lane) buttons[lane] = buttonsFor(lane, f);
+            batch.runFrame(buttons.data());
+        }
+
+        size_t differ = 0;
+        for (size_t lane = 0; lane < lanes; ++lane)
+            if (stateHash(batch.lane(lane)) != expected[lane]) differ++;
+        std::printf("  %-7s %zu consoles, %zu lanes differ from running alone\n", jit ? "jit" : "blocks", batch.running(), differ);
+        ok = ok && differ == 0;
+    }
+    return ok;
+}
+
+
+// a rom+ram cart with no mapper: the ram answers without being enabled first,
+// and the 0x0A enable write games do anyway does nothing to it
+static bool cartRomRam(const Options&)
+{
+    std::vector<uint8_t> rom(0x8000, 0x00);
+    static const uint8_t program[] = {
+        0x3E, 0x0A,       // ld a, 0x0a
+        0xEA, 0x00, 0x00, // ld (0x0000), a
+        0x3E, 0x5A,       // ld a, 0x5a
+        0xEA, 0x00, 0xA0, // ld (0xa000), a
+        0xAF,             // xor a
+        0xFA, 0x00, 0xA0, // ld a, (0xa000)
+        0xEA, 0x00, 0xC0, // ld (0xc000), a
+        0x18, 0xFE,       // jr -2
+    };
+    std::copy(std::begin(program), std::end(program), rom.begin() + 0x0100);
+    rom[0x0147] = 0x08; // rom+ram
+    rom[0x0149] = 0x02; // 8KB
+
+    bool ok = true;
+    for (int mode = 0; mode < 2; ++mode)
+    {
+        std::shared_ptr<const RomImage> image = RomImage::fromMemory(rom.data(), rom.size());
+        auto gb = std::make_unique<GameBoy>();
+        gb->initMemory();
+        gb->loadROM(image);
+        gb->bootSetup();
+        gb->postBootSetup();
+        gb->setBlockCache(mode > 0);
+        gb->runUntil(gb->sched.cycles + 1000);
+
+        std::printf("  %-12s read back %02x, cart ram %02x\n", mode ? "blocks" : "interpreter", gb->memory[0xC000], gb->cart.ram[0]);
+        ok = ok && gb->memory[0xC000] == 0x5A && gb->cart.ram[0] == 0x5A;
+    }
+    return ok;
+}
+
+
+// a loop polling DIV with the slow tima clock running, the block cache may skip the laps
+// in between but never past a DIV step, so it sees the same values as the interpreter
+static bool divSpin(const Options&)
+{
+    std::vector<uint8_t> rom(0x8000, 0x00);
+    static const uint8_t program[] = {
+        0x3E, 0x04,       // ld a, 0x04       tima on, 1024 cycles a tick
+        0xE0, 0x07,       // ldh (TAC), a
+        0xAF,             // xor a
+        0xE0, 0x40,       // ldh (LCDC), a    lcd off, nothing else to wake the loop
+        0x21, 0x00, 0xC0, // ld hl, 0xc000
+        0x77,             // ld (hl), a
+        0xF0, 0x04,       // wait: ldh a, (DIV)
+        0xFE, 0x13,       // cp 0x13          not a multiple of 4, a tima tick never lands on it
+        0x20, 0xFA,       // jr nz, wait
+        0x34,             // inc (hl)
+        0xF0, 0x04,       // seen: ldh a, (DIV)
+        0xFE, 0x13,       // cp 0x13
+        0x28, 0xFA,       // jr z, seen
+        0x18, 0xF2,       // jr wait
+    };
+    std::copy(std::begin(program), std::end(program), rom.begin() + 0x0100);
+
+    int seen[2] = {};
+    for (int mode = 0; mode < 2; ++mode)
+    {
+        std::shared_ptr<const RomImage> image = RomImage::fromMemory(rom.data(), rom.size());
+        auto gb = std::make_unique<GameBoy>();
+        gb->initMemory();
+        gb->loadROM(image);
+        gb->bootSetup();
+        gb->postBootSetup();
+        gb->setBlockCache(mode > 0);
+        gb->runUntil(gb->sched.cycles + 300000);
+
+        seen[mode] = gb->memory[0xC000];
+        std::printf("  %-12s saw DIV hit 0x13 %d times\n", mode ? "blocks" : "interpreter", seen[mode]);
+    }
+    return seen[0] > 0 && seen[0] == seen[1];
+}
+
+
+// an instance that crashed on one rom and gets another loaded runs it
+// exactly like an instance that never ran anything
+static bool apiReload(const Options& opts)
+{
+    std::ifstream file(opts.rom, std::ios::binary);
+    std::vector<uint8_t> tetris((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (tetris.empty()) return false;
+
+    std::vector<uint8_t> bad(0x8000, 0x00);
+    bad[0x0100] = 0xD3; // a hole in the opcode table
+
+    gb_instance* used = gb_create();
+    gb_instance* fresh = gb_create();
+    gb_load_rom(used, bad.data(), bad.size());
+    const uint32_t crashedAfter = gb_run_frames(used, 10);
+
+    bool ok = gb_crashed(used) && crashedAfter < 10;
+    gb_load_rom(used, tetris.data(), tetris.size());
+    gb_load_rom(fresh, tetris.data(), tetris.size());
+    for (uint64_t f = 0; f < 600; ++f)
+    {
+        gb_set_joypad(used, tetrisInput(f));
+        gb_set_joypad(fresh, tetrisInput(f));
+        ok = ok && gb_run_frames(used, 1) == 1;
+        gb_run_frames(fresh, 1);
+    }
+
+    std::vector<uint8_t> a(gb_state_size(used)), b(gb_state_size(fresh));
+    ok = ok && gb_save_state(used, a.data(), a.size()) && gb_save_state(fresh, b.data(), b.size()) && a == b;
+    std::printf("  reloaded instance %s a fresh one after 600 frames\n", a == b ? "matches" : "differs from");
+
+    gb_destroy(used);
+    gb_destroy(fresh);
+    return ok;
+}
+
+
+// a state one byte short or long is refused, the exact one loads
+static bool stateSize(const Options& opts)
+{
+    auto gb = bootTetris(opts.rom);
+    if (!gb) return false;
+    gb->runFrame();
+
+    std::vector<uint8_t> state;
+    gb->saveState(state);
+    const bool shortRefused = !gb->loadState(state.data(), state.size() - 1);
+    state.push_back(0);
+    const bool longRefused = !gb->loadState(state.data(), state.size());
+    const bool exactLoads = gb->loadState(state.data(), state.size() - 1);
+    return shortRefused && longRefused && exactLoads;
+}
+
+
+// record a stretch of frames, step all the way back through them and get every state
+// back byte for byte, then run forward again from the oldest and land on the same states
+static bool rewindRoundTrip(const Options& opts)
+{
+    const uint64_t frames = 600;
+    auto gb = bootTetris(opts.rom);
+    if (!gb) return false;
+    gb->setBlockCache(true);
+
+    // from before the start press to well into the game
+    for (uint64_t f = 0; f < 200; ++f)
+    {
+        gb->joypad = tetrisInput(f);
+        gb->runFrame();
+    }
+
+    Rewind rewind;
+    std::vector<std::vector<uint8_t>> states(frames);
+    for (uint64_t f = 0; f < frames; ++f)
+    {
+        gb->joypad = tetrisInput(200 + f);
+        gb->runFrame();
+        rewind.record(*gb);
+        gb->saveState(states[f]);
+    }
+
+    std::vector<uint8_t> state;
+    uint64_t back = 0, wrong = 0;
+    for (uint64_t f = frames - 1; f > 0 && rewind.stepBack(*gb); --f)
+    {
+        gb->saveState(state);
+        if (state != states[f - 1]) wrong++;
+        back++;
+    }
+
+    // the oldest state is live again, the same input from there has to retrace the recording
+    uint64_t replayWrong = 0;
+    for (uint64_t f = 1; f < frames; ++f)
+    {
+        gb->joypad = tetrisInput(200 + f);
+        gb->runFrame();
+        gb->saveState(state);
+        if (state != states[f]) replayWrong++;
+    }
+
+    std::printf("  stepped back %llu of %llu frames, %llu differ, %llu differ replaying forward\n",
+        (unsigned long long)back, (unsigned long long)(frames - 1), (unsigned long long)wrong, (unsigned long long)replayWrong);
+    return back == frames - 1 && wrong == 0 && replayWrong == 0;
+}
+
+
+// record a movie through a file, then seek a fresh console to frames on and off keyframes
+// and compare with the states the recording run passed through, under blocks and the jit
+static bool movieSeek(const Options& opts)
+{
+    const uint64_t frames = 1500;
+    const uint32_t interval = 300;
+    const uint64_t targets[] = { 0, 1, 299, 300, 301, 505, 777, 1200, 1499, 1500 };
+    const std::string path = tempPath("gb_tests_movie.gbmv");
+
+    auto gb = bootTetris(opts.rom);
+    if (!gb) return false;
+    gb->setBlockCache(true);
+
+    Movie recording(interval);
+    std::vector<std::vector<uint8_t>> expected;
+    for (uint64_t f = 0; f <= frames; ++f)
+    {
+        // something to replay besides start, past the end the last frame's input stays
+        if (f < frames) gb->joypad = tetrisInput(f) | ((f / 97) % 3 == 0 ? BUTTON_LEFT : 0);
+        std::vector<uint8_t> state;
+        gb->saveState(state);
+        for (uint64_t t : targets)
+            if (t == f) expected.push_back(state);
+        if (f == frames) break;
+
+        recording.record(*gb);
+        gb->runFrame();
+    }
+    if (!recording.write(path)) return false;
+
+    std::unique_ptr<Movie> movie = Movie::open(path);
+    std::filesystem::remove(path);
+    if (!movie || movie->frames() != frames) return false;
+
+    bool ok = true;
+    for (int jit = 0; jit < 2; ++jit)
+    {
+        auto player = bootTetris(opts.rom);
+        player->setBlockCache(true);
+        if (jit && !player->setJit(true)) continue;
+
+        std::vector<uint8_t> state;
+        for (size_t i = 0; i < expected.size(); ++i)
+        {
+            // later targets first too, so seeks go backwards as well as forwards
+            const size_t n = (i % 2) ? expected.size() - 1 - i / 2 : i / 2;
+            const bool seeked = movie->seek(*player, targets[n]);
+            player->saveState(state);
+            if (!seeked || state != expected[n])
+            {
+                std::printf("  %s seek to %llu %s\n", jit ? "jit" : "blocks", (unsigned long long)targets[n], seeked ? "differs" : "failed");
+                ok = false;
+            }
+        }
+    }
+    std::printf("  %llu frames, %zu keyframes, %zu seeks each\n", (unsigned long long)movie->frames(), movie->keyframes(), expected.size());
+    return ok;
+}
+
+
+// movies cut short anywhere are refused when opened, and varints that never end, in the
+// input runs or in a keyframe, fail instead of running off the buffer
+static bool movieCorrupt(const Options& opts)
+{
+    const std::string path = tempPath("gb_tests_corrupt.gbmv");
+    auto gb = bootTetris(opts.rom);
+    if (!gb) return false;
+
+    Movie recording(20);
+    for (uint64_t f = 0; f < 60; ++f)
+    {
+        gb->joypad = uint8_t(f * 37);
+        recording.record(*gb);
+        gb->runFrame();
+    }
+    if (!recording.write(path)) return false;
+
+    std::vector<uint8_t> whole;
+    {
+        std::ifstream in(path, std::ios::binary);
+        whole.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    auto openBytes = [&](const std::vector<uint8_t>& bytes) {
+        std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), std::streamsize(bytes.size()));
+        return Movie::open(path);
+    };
+
+    // the biggest size_t reads back, one cut off or carrying on past it doesnt
+    uint8_t longest[16];
+    const uint8_t* longestEnd = putVarint(longest, SIZE_MAX);
+    const uint8_t overlong[] = { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x01 };
+    size_t value = 0;
+    bool ok = getVarint(longest, longestEnd, value) == longestEnd && value == SIZE_MAX;
+    ok = ok && !getVarint(longest, longestEnd - 1, value) && !getVarint(overlong, overlong + sizeof(overlong), value);
+
+    ok = ok && openBytes(whole) != nullptr;
+    size_t openedShort = 0;
+    for (size_t size = 0; size < whole.size(); size += 1 + size / 16)
+    {
+        if (openBytes(std::vector<uint8_t>(whole.begin(), whole.begin() + size))) openedShort++;
+    }
+
+    MovieHeader h;
+    std::memcpy(&h, whole.data(), sizeof(h));
+    std::vector<uint8_t> runs = whole;
+    std::fill(runs.begin() + sizeof(h), runs.begin() + sizeof(h) + h.inputSize, 0xFF);
+    const bool runsRefused = openBytes(runs) == nullptr;
+
+    // the keyframes are only unpacked by a seek
+    std::vector<uint8_t> keyframes = whole;
+    KeyframeEntry first;
+    std::memcpy(&first, whole.data() + sizeof(h) + h.inputSize, sizeof(first));
+    std::fill(keyframes.begin() + first.offset, keyframes.begin() + first.offset + first.size, 0xFF);
+    std::unique_ptr<Movie> movie = openBytes(keyframes);
+    const bool keyframeRefused = movie && !movie->seek(*gb, 5);
+    movie.reset();
+    std::filesystem::remove(path);
+
+    std::printf("  %zu cut short movies opened, junk runs %s, junk keyframe %s\n", openedShort,
+        runsRefused ? "refused" : "opened", keyframeRefused ? "refused" : "seeked");
+    return ok && openedShort == 0 && runsRefused && keyframeRefused;
+}
+
+
+// peek8 answers what read8 would for every address, checked against a clone that really reads,
+// at a few points of a run with the joypad held and the apu busy
+static bool peekMatchesRead(const Options& opts)
+{
+    auto gb = bootTetris(opts.rom);
+    if (!gb) return false;
+    gb->setBlockCache(true);
+
+    uint64_t differ = 0;
+    for (uint64_t f = 0; f < 1000; ++f)
+    {
+        gb->joypad = tetrisInput(f) | ((f % 7) ? BUTTON_A | BUTTON_LEFT : 0);
+        gb->runFrame();
+        if (f % 250 != 249) continue;
+
+        // part way into a frame too, so the apu and timer are behind
+        gb->runUntil(gb->sched.cycles + 12345);
+        std::unique_ptr<GameBoy> reader = gb->clone();
+        for (uint32_t addr = 0; addr < 0x10000; ++addr)
+        {
+            const uint8_t peeked = gb->peek8(uint16_t(addr));
+            const uint8_t read = reader->read8(uint16_t(addr));
+            if (peeked == read) continue;
+            if (differ++ < 5) std::printf("  frame %llu %04x: peek %02x, read %02x\n", (unsigned long long)f, addr, peeked, read);
+        }
+    }
+    return differ == 0;
+}
+
+
+#ifndef _WIN32
+// plugs an end into the cable and dies without unplugging, the way a crash or kill -9 would
+static int crashedEnd(const std::string& name)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        std::unique_ptr<LinkCable> cable = LinkCable::open(name);
+        if (cable) cable->publish(1234);
+        _exit(cable ? cable->end() : 9);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+#endif
+
+// a name left behind by a dead end is taken over instead of joined,
+// and an end that dies while we wait on it reads as gone instead of hanging us
+static bool linkStale(const Options&)
+{
+#ifdef _WIN32
+    return true; // the mapping goes with the last handle, nothing is left to go stale
+#else
+    const std::string name = "test-" + std::to_string(getpid());
+    if (crashedEnd(name) != 0) return false;
+
+    std::unique_ptr<LinkCable> cable = LinkCable::open(name);
+    if (!cable || cable->end() != 0)
+    {
+        std::printf("  plugged into the dead end's cable\n");
+        return false;
+    }
+    if (crashedEnd(name) != 1) return false;
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+    unsigned spins = 0;
+    while (cable->peerTime() != LinkCable::GONE)
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+        {
+            std::printf("  still waiting on the dead end\n");
+            return false;
+        }
+        cable->wait(spins);
+    }
+    return true;
+#endif
+}
+
+
+struct Check
+{
+    const char* name;
+    bool (*run)(const Options& opts);
+};
+
+static const Check checks[] = {
+    { "api.reload", apiReload },
+    { "batch.lockstep", batchLockstep },
+    { "cart.romram", cartRomRam },
+    { "div.spin", divSpin },
+    { "jit.fuzz", Tests::jitFuzz },
+    { "jit.nowx", jitNoWx },
+    { "link.stale", linkStale },
+    { "modes.tetris", modesTetris },
+    { "movie.corrupt", movieCorrupt },
+    { "movie.seek", movieSeek },
+    { "peek.read", peekMatchesRead },
+    { "rewind.roundtrip", rewindRoundTrip },
+    { "state.size", stateSize },
+};
+
+int main(int argc, char* argv[])
+{
+    Options opts;
+    std::vector<std::string> wanted;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        bool ok = true;
+
+        if (arg == "--rom" && hasValue) opts.rom = argv[++i];
+        else if (arg == "--frames" && hasValue) ok = parseNumber(argv[++i], opts.frames);
+        else if (arg == "--blocks" && hasValue) ok = parseNumber(argv[++i], opts.blocks);
+        else if (arg[0] != '-') wanted.push_back(arg);
+        else ok = false;
+
+        if (!ok)
+        {
+            std::cerr << "usage: GB_Tests [--rom F] [--frames N] [--blocks N] [check ...]\n";
+            return 1;
+        }
+    }
+
+    int failed = 0, ran = 0;
+    for (const Check& c : checks)
+    {
+        bool named = wanted.empty();
+        for (const std::string& w : wanted) named = named || w == c.name;
+        if (!named) continue;
+
+        std::cout << c.name << "\n";
+        const bool passed = c.run(opts);
+        std::cout << c.name << ": " << (passed ? "passed" : "FAILED") << "\n";
+        if (!passed) failed++;
+        ran++;
+    }
+
+    if (ran < int(wanted.size()))
+    {
+        std::cerr << "no such check, there are:";
+        for (const Check& c : checks) std::cerr << " " << c.name;
+        std::cerr << "\n";
+        return 1;
+    }
+    return failed ? 1 : 0;
+}
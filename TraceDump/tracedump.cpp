@@ -0,0 +1,60 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "../GB_Emu/trace.h"
+
+
+// turns a GB_Emu --trace log back into one line per instruction
+// usage: TraceDump trace.bin [first [count]]
+
+static void printRecord(const TraceRecord& r)
+{
+    std::printf("%12llu PC: 0x%04X | %s0x%02X | A: 0x%02X | F: 0x%02X | B: 0x%02X | C: 0x%02X"
+        " | D: 0x%02X | E: 0x%02X | H: 0x%02X | L: 0x%02X | SP: 0x%04X%s\n",
+        (unsigned long long)r.cycles, r.pc, (r.flags & TRACE_CB) ? "CB " : "", r.opcode,
+        r.a, r.f, r.b, r.c, r.d, r.e, r.h, r.l, r.sp, (r.flags & TRACE_IME) ? " | IME" : "");
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: TraceDump trace.bin [first [count]]\n";
+        return 1;
+    }
+    unsigned long long first = argc > 2 ? std::stoull(argv[2]) : 0;
+    unsigned long long count = argc > 3 ? std::stoull(argv[3]) : ~0ULL;
+
+    std::ifstream file(argv[1], std::ios::binary);
+    if (!file)
+    {
+        std::cerr << argv[1] << " couldnt be opened!" << "\n";
+        return 1;
+    }
+
+    TraceFileHeader h;
+    if (!file.read(reinterpret_cast<char*>(&h), sizeof(h)) || h.magic != TraceFileHeader::MAGIC)
+    {
+        std::cerr << argv[1] << " is not a trace\n";
+        return 1;
+    }
+    if (h.version != TraceFileHeader::VERSION || h.recordSize != sizeof(TraceRecord))
+    {
+        std::cerr << argv[1] << " is from another version\n";
+        return 1;
+    }
+
+    // records are fixed size so skipping ahead is just a seek
+    file.seekg(std::streamoff(sizeof(h) + first * sizeof(TraceRecord)));
+
+    static TraceRecord buf[4096];
+    while (count && file)
+    {
+        file.read(reinterpret_cast<char*>(buf), sizeof(buf));
+        size_t got = size_t(file.gcount()) / sizeof(TraceRecord);
+        for (size_t i = 0; i < got && count; ++i, --count)
+            printRecord(buf[i]);
+    }
+    return 0;
+}